@@ -0,0 +1,81 @@
+// Looking up keys in a HashSet<uint64_t> with 4M keys (too big for the caches),
+// where 99% of the lookups are misses: the HashSet alone versus a BloomFilter in front of it.
+
+#include <random>
+#include <vector>
+
+#include <emilib/bloom_filter.hpp>
+#include <emilib/hash_functions.hpp>
+#include <emilib/hash_set.hpp>
+#include <emilib/timer.cpp>
+
+#define LOGURU_IMPLEMENTATION 1
+#include <loguru.hpp>
+
+using namespace emilib;
+
+using KeyHash = IntHash<uint64_t>;
+using Set     = HashSet<uint64_t, KeyHash>;
+
+const size_t NUM_KEYS    = 4 * 1000 * 1000;
+const size_t NUM_LOOKUPS = 10 * 1000 * 1000;
+
+template<typename Func>
+void bench(const char* name, const std::vector<uint64_t>& queries, const Func& contains)
+{
+	Timer timer;
+	size_t num_found = 0;
+	for (uint64_t key : queries) {
+		num_found += contains(key);
+	}
+	printf("%-28s %5.1f ns/lookup  (%lu found)\n", name, 1e9 * timer.reset() / queries.size(), num_found);
+}
+
+int main()
+{
+	std::mt19937_64 rng(0);
+	Set set;
+	while (set.size() < NUM_KEYS) {
+		set.insert(rng());
+	}
+	std::vector<uint64_t> keys(set.begin(), set.end());
+
+	Timer timer;
+	const BloomFilter filter(set);
+	printf("Building a %lu kB BloomFilter: %.1f ms\n\n", filter.num_bits() / 8 / 1024, 1e3 * timer.reset());
+
+	std::vector<uint64_t> queries;
+	for (size_t i = 0; i < NUM_LOOKUPS; ++i) {
+		queries.push_back(i % 100 == 0 ? keys[rng() % keys.size()] : rng());
+	}
+
+	for (int run = 0; run < 2; ++run) {
+		bench("HashSet::contains", queries, [&](uint64_t key) {
+			return set.contains(key);
+		});
+		bench("BloomFilter + contains", queries, [&](uint64_t key) {
+			return filter.may_contain_hash(KeyHash()(key)) && set.contains(key);
+		});
+		bench("BloomFilter only", queries, [&](uint64_t key) {
+			return filter.may_contain_hash(KeyHash()(key));
+		});
+		printf("\n");
+	}
+}
+
+/*
+Linux VM, g++ 12.2 -O2, x86-64:
+
+Building a 4882 kB BloomFilter: 52.6 ms
+
+HashSet::contains             30.0 ns/lookup  (100000 found)
+BloomFilter + contains        14.8 ns/lookup  (100000 found)
+BloomFilter only               8.9 ns/lookup  (225592 found)
+
+HashSet::contains             27.0 ns/lookup  (100000 found)
+BloomFilter + contains        15.5 ns/lookup  (100000 found)
+BloomFilter only              11.2 ns/lookup  (225592 found)
+
+The filter lets through 1.3% of the misses. Each lookup still costs a cache miss into the 5 MB filter,
+so the gain is 2x rather than 10x. It grows with the cost of a miss in the set, e.g. for long string keys.
+*/
@@ -4,6 +4,25 @@ touch *.cpp
 g++-mp-6 --std=c++17 -Wall -I .. -I . -O2 rw_mutex_benchmark.cpp -o rw_mutex_benchmark.bin &
 
 g++ --std=c++14 -Wall -I .. -I . -O2 hash_cache_benchmark.cpp -o hash_cache_benchmark_clang_apple.bin &
+g++ --std=c++14 -Wall -I .. -I . -O2 hash_probe_benchmark.cpp -o hash_probe_benchmark.bin &
+g++ --std=c++14 -Wall -I .. -I . -O2 hash_churn_benchmark.cpp -o hash_churn_benchmark.bin &
+g++ --std=c++14 -Wall -I .. -I . -O2 hash_insert_latency_benchmark.cpp -o hash_insert_latency_benchmark.bin &
+g++ --std=c++14 -Wall -I .. -I . -O2 hash_split_storage_benchmark.cpp -o hash_split_storage_benchmark.bin &
+g++ --std=c++14 -Wall -I .. -I . -O2 hash_store_hash_benchmark.cpp -o hash_store_hash_benchmark.bin &
+g++ --std=c++14 -Wall -I .. -I . -O2 hash_function_benchmark.cpp -o hash_function_benchmark.bin &
+g++ --std=c++14 -Wall -I .. -I . -O2 small_hash_map_benchmark.cpp -o small_hash_map_benchmark.bin &
+g++ --std=c++14 -Wall -I .. -I . -O2 hash_huge_page_benchmark.cpp -o hash_huge_page_benchmark.bin &
+g++ --std=c++14 -Wall -I .. -I . -O2 hash_parallel_build_benchmark.cpp -o hash_parallel_build_benchmark.bin -lpthread &
+g++ --std=c++14 -Wall -I .. -I . -O2 hash_iteration_benchmark.cpp -o hash_iteration_benchmark.bin -lpthread &
+g++ --std=c++14 -Wall -I .. -I . -O2 lru_cache_benchmark.cpp -o lru_cache_benchmark.bin &
+g++ --std=c++14 -Wall -I .. -I . -O2 persistent_hash_map_benchmark.cpp -o persistent_hash_map_benchmark.bin &
+g++ --std=c++14 -Wall -I .. -I . -O2 hash_set_algebra_benchmark.cpp -o hash_set_algebra_benchmark.bin &
+g++ --std=c++14 -Wall -I .. -I . -O2 bloom_filter_benchmark.cpp -o bloom_filter_benchmark.bin &
+g++ --std=c++14 -Wall -I .. -I . -O2 list_map_benchmark.cpp -o list_map_benchmark.bin &
+g++ --std=c++14 -Wall -I .. -I . -O2 thread_pool_benchmark.cpp -o thread_pool_benchmark.bin -lpthread &
+g++ --std=c++14 -Wall -I .. -I . -O2 parallel_benchmark.cpp -o parallel_benchmark.bin -lpthread &
+g++ --std=c++14 -Wall -I .. -I . -O2 concurrent_hash_map_benchmark.cpp -o concurrent_hash_map_benchmark.bin -lpthread &
+g++ --std=c++14 -Wall -I .. -I . -O2 frozen_hash_map_benchmark.cpp -o frozen_hash_map_benchmark.bin &
 clang++-mp-3.7 --std=c++14 -Wall -I .. -I . -O2 hash_cache_benchmark.cpp -o hash_cache_benchmark_clang_37.bin &
 g++-mp-5 --std=c++14 -Wall -I .. -I . -O2 hash_cache_benchmark.cpp -o hash_cache_benchmark_gcc5.bin &
 g++-mp-6 --std=c++14 -Wall -I .. -I . -O2 hash_cache_benchmark.cpp -o hash_cache_benchmark_gcc6.bin &
@@ -0,0 +1,102 @@
+// Compares a single HashMap behind one FastReadWriteMutex with ConcurrentHashMap
+// for a 90% read / 10% write workload at 1-64 threads.
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <emilib/concurrent_hash_map.hpp>
+#include <emilib/timer.cpp>
+
+#define LOGURU_IMPLEMENTATION 1
+#include <loguru.hpp>
+
+using namespace emilib;
+
+const size_t NUM_KEYS      = 1000000;
+const size_t NUM_OPS_TOTAL = 8000000; // Split over all threads
+const size_t NUM_RUNS      = 3;       // Best of NUM_RUNS
+const size_t WRITE_EVERY   = 10;      // Every n:th operation is a write
+
+const std::vector<size_t> num_threads_vec = {1, 2, 4, 8, 16, 32, 64};
+
+struct LockedHashMap
+{
+	mutable FastReadWriteMutex     _mutex;
+	HashMap<uint64_t, uint64_t>    _map;
+
+	bool find(uint64_t key, uint64_t* out_value) const
+	{
+		ReadLock<FastReadWriteMutex> lock(_mutex);
+		const uint64_t* value = _map.try_get(key);
+		if (value) { *out_value = *value; }
+		return value != nullptr;
+	}
+
+	void insert_or_assign(uint64_t key, uint64_t value)
+	{
+		WriteLock<FastReadWriteMutex> lock(_mutex);
+		_map.insert_or_assign(key, std::move(value));
+	}
+};
+
+using ShardedHashMap = ConcurrentHashMap<uint64_t, uint64_t>;
+
+// Returns million operations per second
+template<typename Map>
+double bench(size_t num_threads)
+{
+	double best_secs = std::numeric_limits<double>::infinity();
+
+	for (size_t run = 0; run < NUM_RUNS; ++run) {
+		Map map;
+		for (uint64_t key = 0; key < NUM_KEYS; key += 2) {
+			map.insert_or_assign(key, key);
+		}
+
+		std::atomic<bool> start{false};
+		std::atomic<size_t> num_found{0};
+		std::vector<std::thread> threads;
+		for (size_t t = 0; t < num_threads; ++t) {
+			threads.emplace_back([&, t]() {
+				std::mt19937_64 rng(t);
+				size_t found = 0;
+				while (!start) { std::this_thread::yield(); }
+				for (size_t i = 0; i < NUM_OPS_TOTAL / num_threads; ++i) {
+					const uint64_t key = rng() % NUM_KEYS;
+					if (i % WRITE_EVERY == 0) {
+						map.insert_or_assign(key, i);
+					} else {
+						uint64_t value;
+						found += map.find(key, &value);
+					}
+				}
+				num_found += found;
+			});
+		}
+
+		Timer timer;
+		start = true;
+		for (auto& thread : threads) {
+			thread.join();
+		}
+		best_secs = std::min(best_secs, timer.secs());
+		CHECK_GT_F(num_found.load(), 0u);
+	}
+
+	return NUM_OPS_TOTAL / best_secs / 1e6;
+}
+
+int main()
+{
+	printf("%u hardware threads\n", std::thread::hardware_concurrency());
+	printf("             HashMap+FastReadWriteMutex  ConcurrentHashMap (64 shards)\n");
+	for (const size_t num_threads : num_threads_vec) {
+		printf("%2lu threads:  %8.1f                    %8.1f                 Mops/s (higher is better)\n",
+			num_threads, bench<LockedHashMap>(num_threads), bench<ShardedHashMap>(num_threads));
+		fflush(stdout);
+	}
+}
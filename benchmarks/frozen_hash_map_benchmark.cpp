@@ -0,0 +1,99 @@
+// Compares the startup cost of building a HashMap<std::string, AssetInfo> from scratch
+// with memory mapping a FrozenHashMap written earlier, and the lookup speed of the two.
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <emilib/frozen_hash_map.hpp>
+#include <emilib/mem_map.cpp>
+#include <emilib/timer.cpp>
+
+#define LOGURU_IMPLEMENTATION 1
+#include <loguru.hpp>
+
+using namespace emilib;
+
+const size_t NUM_ASSETS = 2000000;
+const char*  PATH       = "frozen_hash_map_benchmark.frozen";
+
+struct AssetInfo
+{
+	uint64_t offset;
+	uint32_t size;
+	uint32_t flags;
+};
+
+std::string asset_name(size_t i)
+{
+	return "textures/level_" + std::to_string(i % 97) + "/asset_" + std::to_string(i) + ".png";
+}
+
+template<typename Map>
+double ns_per_lookup(const Map& map, const std::vector<std::string>& keys)
+{
+	Timer timer;
+	uint64_t sum = 0;
+	for (const auto& key : keys) {
+		const AssetInfo* info = map.try_get(key);
+		CHECK_NOTNULL_F(info);
+		sum += info->size;
+	}
+	CHECK_GT_F(sum, 0u);
+	return 1e9 * timer.secs() / keys.size();
+}
+
+int main()
+{
+	std::vector<std::string> keys;
+	for (size_t i = 0; i < NUM_ASSETS; ++i) {
+		keys.push_back(asset_name(i));
+	}
+
+	{
+		FrozenHashMapBuilder<std::string, AssetInfo> builder;
+		for (size_t i = 0; i < NUM_ASSETS; ++i) {
+			builder.insert(keys[i], AssetInfo{i * 4096, (uint32_t)i + 1, 0});
+		}
+		Timer timer;
+		builder.save(PATH);
+		printf("FrozenHashMapBuilder::save:        %8.1f ms\n", 1e3 * timer.secs());
+	}
+
+	Timer timer;
+	HashMap<std::string, AssetInfo> hash_map;
+	for (size_t i = 0; i < NUM_ASSETS; ++i) {
+		hash_map.insert(keys[i], AssetInfo{i * 4096, (uint32_t)i + 1, 0});
+	}
+	printf("HashMap startup (insert all):      %8.1f ms\n", 1e3 * timer.secs());
+
+	timer.reset();
+	FrozenHashMap<std::string, AssetInfo> frozen(PATH);
+	printf("FrozenHashMap startup (mmap):      %8.3f ms\n", 1e3 * timer.secs());
+
+	// Look up in a different order than the insertion order, so HashMap's heap-allocated
+	// strings are not visited sequentially:
+	std::shuffle(keys.begin(), keys.end(), std::mt19937_64(0));
+
+	// First pass over the FrozenHashMap includes page faults:
+	printf("FrozenHashMap lookup (cold pages): %8.1f ns\n", ns_per_lookup(frozen, keys));
+	printf("FrozenHashMap lookup (warm):       %8.1f ns\n", ns_per_lookup(frozen, keys));
+	printf("HashMap lookup:                    %8.1f ns\n", ns_per_lookup(hash_map, keys));
+
+	std::remove(PATH);
+}
+
+/*
+Linux, g++ 12.2 -O2, x86-64, 2M assets:
+
+FrozenHashMapBuilder::save:          1126.3 ms
+HashMap startup (insert all):         721.9 ms
+FrozenHashMap startup (mmap):           0.096 ms
+FrozenHashMap lookup (cold pages):    378.0 ns
+FrozenHashMap lookup (warm):          413.6 ns
+HashMap lookup:                       276.6 ns
+
+Lookups are all cache misses at this size. FrozenHashMap keeps the key bytes in a separate
+string section, so a hit is one more miss than the entry itself.
+*/
@@ -0,0 +1,86 @@
+// Iterating over all values of a HashMap<uint64_t, uint64_t> with 16M buckets,
+// densely filled and after erasing 99% of the elements (mostly tombstones),
+// with a range-based for loop, with bucket_range slices and with for_each_parallel.
+
+#include <atomic>
+#include <vector>
+
+#include <emilib/hash_functions.hpp>
+#include <emilib/hash_map.hpp>
+#include <emilib/parallel.hpp>
+#include <emilib/thread_pool.cpp>
+#include <emilib/timer.cpp>
+
+#define LOGURU_IMPLEMENTATION 1
+#include <loguru.hpp>
+
+using namespace emilib;
+
+const size_t NUM_KEYS = 10 * 1000 * 1000;
+const int    NUM_RUNS = 10;
+
+using Map = HashMap<uint64_t, uint64_t, IntHash<uint64_t>>;
+
+void bench(const char* name, Map& map, ThreadPool& pool)
+{
+	Timer timer;
+	uint64_t sum = 0;
+	for (int run = 0; run < NUM_RUNS; ++run) {
+		for (const auto& pair : map) {
+			sum += pair.second;
+		}
+	}
+	const double range_for_ms = 1e3 * timer.reset() / NUM_RUNS;
+
+	for (int run = 0; run < NUM_RUNS; ++run) {
+		const size_t SLICE_SIZE = 64 * 1024;
+		for (size_t bucket = 0; bucket < map.bucket_count(); bucket += SLICE_SIZE) {
+			for (const auto& pair : map.bucket_range(bucket, bucket + SLICE_SIZE)) {
+				sum += pair.second;
+			}
+		}
+	}
+	const double slices_ms = 1e3 * timer.reset() / NUM_RUNS;
+
+	for (int run = 0; run < NUM_RUNS; ++run) {
+		map.for_each_parallel(pool, [&](Map::reference pair) {
+			pair.second += 1;
+		});
+	}
+	const double parallel_ms = 1e3 * timer.reset() / NUM_RUNS;
+	CHECK_NE_F(sum, 0u);
+
+	printf("%-7s %8lu elements in %8lu buckets: range-for: %6.1f ms   bucket_range slices: %6.1f ms   for_each_parallel: %6.1f ms\n",
+		name, map.size(), map.bucket_count(), range_for_ms, slices_ms, parallel_ms);
+}
+
+int main()
+{
+	printf("%u hardware threads\n", std::thread::hardware_concurrency());
+	ThreadPool pool;
+
+	Map map;
+	for (uint64_t i = 0; i < NUM_KEYS; ++i) {
+		map[i] = i;
+	}
+	bench("dense", map, pool);
+
+	for (uint64_t i = 0; i < NUM_KEYS; ++i) {
+		if (i % 100 != 0) {
+			map.erase(i);
+		}
+	}
+	bench("sparse", map, pool);
+}
+
+/*
+Linux VM, g++ 12.2 -O2, x86-64, ONE hardware thread (so for_each_parallel can't go faster than the slices):
+
+1 hardware threads
+dense   10000000 elements in 16777216 buckets: range-for:   73.2 ms   bucket_range slices:   73.7 ms   for_each_parallel:   78.8 ms
+sparse    100000 elements in 16777216 buckets: range-for:    8.1 ms   bucket_range slices:    6.5 ms   for_each_parallel:    5.4 ms
+
+With the old iterators, which checked one control byte at a time, range-for took:
+dense   106.3 ms
+sparse   35.9 ms
+*/
@@ -0,0 +1,70 @@
+// Building a HashMap<uint64_t, uint64_t> from a vector of pairs:
+// insert one by one, insert(begin, end) and insert_parallel with a ThreadPool.
+
+#include <random>
+#include <vector>
+
+#include <emilib/hash_functions.hpp>
+#include <emilib/hash_map.hpp>
+#include <emilib/parallel.hpp>
+#include <emilib/thread_pool.cpp>
+#include <emilib/timer.cpp>
+
+#define LOGURU_IMPLEMENTATION 1
+#include <loguru.hpp>
+
+using namespace emilib;
+
+const size_t NUM_PAIRS = 10 * 1000 * 1000;
+
+using Pair = std::pair<uint64_t, uint64_t>;
+using Map  = HashMap<uint64_t, uint64_t, IntHash<uint64_t>>;
+
+int main()
+{
+	std::mt19937_64 rng(0);
+	std::vector<Pair> pairs;
+	for (size_t i = 0; i < NUM_PAIRS; ++i) {
+		pairs.emplace_back(rng(), i);
+	}
+
+	printf("%lu pairs, %u hardware threads\n", NUM_PAIRS, std::thread::hardware_concurrency());
+	{
+		Timer timer;
+		Map map;
+		for (const auto& pair : pairs) {
+			map.insert(pair);
+		}
+		printf("insert one by one:          %5.0f ms\n", 1e3 * timer.secs());
+	}
+	{
+		Timer timer;
+		Map map;
+		map.insert(pairs.begin(), pairs.end());
+		printf("insert(begin, end):         %5.0f ms\n", 1e3 * timer.secs());
+	}
+	for (size_t num_threads : {1, 2, 4, 8, 16, 32}) {
+		ThreadPool pool(num_threads);
+		Timer timer;
+		Map map;
+		map.insert_parallel(pairs.begin(), pairs.end(), pool);
+		printf("insert_parallel, %2lu threads: %5.0f ms\n", num_threads, 1e3 * timer.secs());
+		CHECK_EQ_F(map.size(), NUM_PAIRS);
+		fflush(stdout);
+	}
+}
+
+/*
+Linux VM, g++ 12.2 -O2, x86-64, ONE hardware thread (so no speedup is possible here,
+the numbers only show the overhead of the three passes and the job handoff):
+
+10000000 pairs, 1 hardware threads
+insert one by one:           1110 ms
+insert(begin, end):           623 ms
+insert_parallel,  1 threads:   968 ms
+insert_parallel,  2 threads:  1163 ms
+insert_parallel,  4 threads:  1277 ms
+insert_parallel,  8 threads:  1253 ms
+insert_parallel, 16 threads:  1261 ms
+insert_parallel, 32 threads:  1252 ms
+*/
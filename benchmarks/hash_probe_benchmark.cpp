@@ -0,0 +1,99 @@
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <emilib/hash_map.hpp>
+#include <emilib/hash_set.hpp>
+#include <emilib/timer.cpp>
+
+#define LOGURU_IMPLEMENTATION 1
+#include <loguru.hpp>
+
+using namespace emilib;
+
+const size_t NUM_KEYS = 1000000;
+const size_t NUM_RUNS = 5; // Best of NUM_RUNS
+
+std::vector<std::string> generate_keys(size_t seed)
+{
+	std::mt19937_64 rng(seed);
+	std::vector<std::string> keys;
+	keys.reserve(NUM_KEYS);
+	for (size_t i = 0; i < NUM_KEYS; ++i) {
+		keys.emplace_back("asset/textures/" + std::to_string(rng()) + ".png");
+	}
+	return keys;
+}
+
+struct Results
+{
+	double insert = std::numeric_limits<double>::infinity();
+	double hit    = std::numeric_limits<double>::infinity();
+	double miss   = std::numeric_limits<double>::infinity();
+};
+
+template<typename Set>
+Results bench(const std::vector<std::string>& keys, const std::vector<std::string>& missing)
+{
+	Results results;
+	for (size_t run = 0; run < NUM_RUNS; ++run) {
+		Set set;
+
+		Timer timer;
+		for (const auto& key : keys) {
+			set.insert(key);
+		}
+		results.insert = std::min(results.insert, timer.secs());
+
+		size_t num_found = 0;
+		timer.reset();
+		for (const auto& key : keys) {
+			num_found += set.count(key);
+		}
+		results.hit = std::min(results.hit, timer.secs());
+		CHECK_EQ_F(num_found, keys.size());
+
+		num_found = 0;
+		timer.reset();
+		for (const auto& key : missing) {
+			num_found += set.count(key);
+		}
+		results.miss = std::min(results.miss, timer.secs());
+		CHECK_EQ_F(num_found, 0u);
+	}
+	return results;
+}
+
+void print(const char* name, const Results& results)
+{
+	printf("%-28s insert: %5.0f ms   hit: %5.0f ms   miss: %5.0f ms\n",
+		name, 1e3 * results.insert, 1e3 * results.hit, 1e3 * results.miss);
+}
+
+int main()
+{
+	using namespace std;
+
+	const auto keys    = generate_keys(0);
+	const auto missing = generate_keys(1);
+
+	printf("%lu string keys (e.g. \"%s\"):\n", NUM_KEYS, keys[0].c_str());
+	print("HashSet<string>", bench<HashSet<string>>(keys, missing));
+	print("HashSet<string> (grouped)", bench<HashSet<string, hash<string>, HashSetEqualTo<string>, GroupProbingHashPolicy>>(keys, missing));
+}
+
+/*
+Linux, g++ 12.2 -O2, x86-64 (SSE2), typical run:
+
+Before (one State byte per bucket, EqT called on every FILLED bucket in the chain):
+	HashSet<string>              insert:   329 ms   hit:   151 ms   miss:   146 ms
+
+After (7-bit hash fragment in each control byte):
+	HashSet<string>              insert:   305 ms   hit:    94 ms   miss:    52 ms
+	HashSet<string> (grouped)    insert:   313 ms   hit:   115 ms   miss:    58 ms
+
+The fragment alone removes almost all EqT calls on misses.
+At this load factor most chains are only a bucket or two long, so the SSE2 group scan
+costs a little more than it saves. It is meant for long chains (clustered hashes, many tombstones).
+*/
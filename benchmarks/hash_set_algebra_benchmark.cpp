@@ -0,0 +1,120 @@
+// Union, intersection and difference of a HashSet<uint32_t> of 1M ids and one of 200k ids
+// (half of which are in the big set): naive insert/count loops versus the set algebra functions.
+
+#include <random>
+#include <vector>
+
+#include <emilib/hash_functions.hpp>
+#include <emilib/hash_set.hpp>
+#include <emilib/timer.cpp>
+
+#define LOGURU_IMPLEMENTATION 1
+#include <loguru.hpp>
+
+using namespace emilib;
+
+using Set = HashSet<uint32_t, IntHash<uint32_t>>;
+
+const int NUM_RUNS = 10;
+
+template<typename Func>
+void bench(const char* name, const Func& fn)
+{
+	Timer timer;
+	size_t result_size = 0;
+	for (int run = 0; run < NUM_RUNS; ++run) {
+		result_size += fn();
+	}
+	printf("%-32s %6.1f ms  (size %lu)\n", name, 1e3 * timer.reset() / NUM_RUNS, result_size / NUM_RUNS);
+}
+
+int main()
+{
+	std::mt19937 rng(0);
+	Set big, small;
+	while (big.size() < 1000 * 1000) {
+		big.insert(rng());
+	}
+	for (uint32_t id : big) {
+		if (small.size() == 100 * 1000) { break; }
+		small.insert(id);
+	}
+	while (small.size() < 200 * 1000) {
+		small.insert(rng());
+	}
+
+	bench("naive union", [&]() {
+		Set result = big;
+		for (uint32_t id : small) { result.insert(id); }
+		return result.size();
+	});
+	bench("set_union", [&]() { return set_union(big, small).size(); });
+	bench("union_with", [&]() {
+		Set result = big;
+		result.union_with(small);
+		return result.size();
+	});
+	printf("\n");
+
+	bench("naive intersection", [&]() {
+		Set result;
+		for (uint32_t id : small) { if (big.count(id)) { result.insert(id); } }
+		return result.size();
+	});
+	bench("set_intersection", [&]() { return set_intersection(big, small).size(); });
+	printf("\n");
+
+	bench("naive difference (big - small)", [&]() {
+		Set result;
+		for (uint32_t id : big) { if (!small.count(id)) { result.insert(id); } }
+		return result.size();
+	});
+	bench("set_difference (big - small)", [&]() { return set_difference(big, small).size(); });
+	bench("naive difference (small - big)", [&]() {
+		Set result;
+		for (uint32_t id : small) { if (!big.count(id)) { result.insert(id); } }
+		return result.size();
+	});
+	bench("set_difference (small - big)", [&]() { return set_difference(small, big).size(); });
+	bench("subtract (small - big)", [&]() {
+		Set result = small;
+		result.subtract(big);
+		return result.size();
+	});
+	printf("\n");
+
+	// A real subset, so that both have to look up every key:
+	const Set common = set_intersection(big, small);
+	bench("naive is_subset", [&]() {
+		size_t num_found = 0;
+		for (uint32_t id : common) { num_found += big.count(id); }
+		return static_cast<size_t>(num_found == common.size());
+	});
+	bench("is_subset", [&]() { return static_cast<size_t>(is_subset(common, big)); });
+}
+
+/*
+Linux VM, g++ 12.2 -O2, x86-64:
+
+naive union                        28.5 ms  (size 1099975)
+set_union                          17.8 ms  (size 1099975)
+union_with                         29.2 ms  (size 1099975)
+
+naive intersection                  8.7 ms  (size 100025)
+set_intersection                    4.9 ms  (size 100025)
+
+naive difference (big - small)     54.6 ms  (size 899975)
+set_difference (big - small)       37.3 ms  (size 899975)
+naive difference (small - big)      9.1 ms  (size 99975)
+set_difference (small - big)        5.2 ms  (size 99975)
+subtract (small - big)              9.1 ms  (size 99975)
+
+naive is_subset                     1.6 ms  (size 1)
+is_subset                           1.7 ms  (size 1)
+
+set_union copies the bigger set bucket by bucket instead of re-inserting it.
+union_with is timed including the copy of big, which dominates it.
+The union functions count the new keys in a first pass over the smaller set, and insert them in a second,
+so that they reserve exactly once without a temporary list of the keys.
+is_subset gains nothing here: 100k lookups into 1M uint32_t keys mostly hit the cache.
+*/
@@ -0,0 +1,103 @@
+// A cache of 100k entries in front of 200k possible keys (so about half of all lookups miss):
+// emilib::LruCache versus the usual std::unordered_map + std::list.
+
+#include <list>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include <emilib/hash_functions.hpp>
+#include <emilib/lru_cache.hpp>
+#include <emilib/timer.cpp>
+
+#define LOGURU_IMPLEMENTATION 1
+#include <loguru.hpp>
+
+using namespace emilib;
+
+const size_t   CACHE_SIZE  = 100 * 1000;
+const uint64_t NUM_KEYS    = 200 * 1000;
+const size_t   NUM_LOOKUPS = 20 * 1000 * 1000;
+
+/// The classic: a list in order of use, and a map to the list nodes.
+class StdLruCache
+{
+public:
+	explicit StdLruCache(size_t max_count) : _max_count(max_count) { }
+
+	uint64_t* try_get(uint64_t key)
+	{
+		auto it = _map.find(key);
+		if (it == _map.end()) { return nullptr; }
+		_list.splice(_list.begin(), _list, it->second);
+		return &it->second->second;
+	}
+
+	void insert(uint64_t key, uint64_t value)
+	{
+		_list.emplace_front(key, value);
+		_map[key] = _list.begin();
+		if (_list.size() > _max_count) {
+			_map.erase(_list.back().first);
+			_list.pop_back();
+		}
+	}
+
+private:
+	using List = std::list<std::pair<uint64_t, uint64_t>>;
+	size_t                                   _max_count;
+	List                                     _list;
+	std::unordered_map<uint64_t, List::iterator> _map;
+};
+
+template<typename Cache>
+void bench(const char* name, Cache& cache)
+{
+	std::mt19937_64 rng(0);
+	std::vector<uint64_t> keys(NUM_LOOKUPS);
+	for (auto& key : keys) {
+		key = rng() % NUM_KEYS;
+	}
+
+	Timer timer;
+	size_t num_hits = 0;
+	for (uint64_t key : keys) {
+		if (uint64_t* value = cache.try_get(key)) {
+			num_hits += (*value == key);
+		} else {
+			cache.insert(key, key);
+		}
+	}
+	const double ms = 1e3 * timer.reset();
+	printf("%-36s %5.0f ms (%.1f ns/lookup, %.0f%% hits)\n",
+		name, ms, 1e6 * ms / NUM_LOOKUPS, 100.0 * num_hits / NUM_LOOKUPS);
+}
+
+int main()
+{
+	for (int run = 0; run < 3; ++run) {
+		StdLruCache std_cache(CACHE_SIZE);
+		bench("std::unordered_map + std::list", std_cache);
+
+		LruCache<uint64_t, uint64_t, IntHash<uint64_t>> emilib_cache(CACHE_SIZE);
+		bench("emilib::LruCache", emilib_cache);
+
+		LruCache<uint64_t, uint64_t, IntHash<uint64_t>> reserved_cache(CACHE_SIZE);
+		reserved_cache.reserve(CACHE_SIZE + 1);
+		bench("emilib::LruCache (reserved)", reserved_cache);
+	}
+}
+
+/*
+Linux VM, g++ 12.2 -O2, x86-64 (noisy, but LruCache is consistently 1.5-2x faster):
+
+std::unordered_map + std::list        3615 ms (180.8 ns/lookup, 50% hits)
+emilib::LruCache                      1908 ms (95.4 ns/lookup, 50% hits)
+emilib::LruCache (reserved)           1552 ms (77.6 ns/lookup, 50% hits)
+std::unordered_map + std::list        2752 ms (137.6 ns/lookup, 50% hits)
+emilib::LruCache                      1776 ms (88.8 ns/lookup, 50% hits)
+emilib::LruCache (reserved)           1939 ms (96.9 ns/lookup, 50% hits)
+std::unordered_map + std::list        2796 ms (139.8 ns/lookup, 50% hits)
+emilib::LruCache                      1669 ms (83.4 ns/lookup, 50% hits)
+emilib::LruCache (reserved)           1951 ms (97.6 ns/lookup, 50% hits)
+*/
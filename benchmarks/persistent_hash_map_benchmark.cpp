@@ -0,0 +1,106 @@
+// Publishing a new version of a 1M element map with one changed value:
+// copying a HashMap versus a PersistentHashMap (which only copies the path to the changed key).
+// Also compares the lookup speed of the two, and measures SharedSnapshot::load() with several reader threads.
+
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <emilib/hash_functions.hpp>
+#include <emilib/hash_map.hpp>
+#include <emilib/persistent_hash_map.hpp>
+#include <emilib/shared_snapshot.hpp>
+#include <emilib/timer.cpp>
+
+#define LOGURU_IMPLEMENTATION 1
+#include <loguru.hpp>
+
+using namespace emilib;
+
+const size_t NUM_KEYS    = 1000 * 1000;
+const size_t NUM_UPDATES = 100;
+const size_t NUM_LOOKUPS = 10 * 1000 * 1000;
+
+template<typename Map>
+void bench(const char* name, const Map& start)
+{
+	Timer timer;
+	SharedSnapshot<Map> shared(start);
+	for (size_t i = 0; i < NUM_UPDATES; ++i) {
+		shared.update([&](Map& map) { map.insert_or_assign(i, i + 1); });
+	}
+	const double update_us = 1e6 * timer.reset() / NUM_UPDATES;
+
+	const auto snapshot = shared.load();
+	std::mt19937_64 rng(0);
+	uint64_t sum = 0;
+	for (size_t i = 0; i < NUM_LOOKUPS; ++i) {
+		sum += *snapshot->try_get(rng() % NUM_KEYS);
+	}
+	const double lookup_ns = 1e9 * timer.reset() / NUM_LOOKUPS;
+	CHECK_NE_F(sum, 0u);
+
+	printf("%-20s update: %9.1f us   random lookup: %5.1f ns\n", name, update_us, lookup_ns);
+}
+
+// Each of num_threads threads loads a snapshot NUM_LOADS times.
+void bench_loads(size_t num_threads)
+{
+	const size_t NUM_LOADS = 1000 * 1000;
+	SharedSnapshot<PersistentHashMap<uint64_t, uint64_t>> shared;
+	std::atomic<size_t> sum(0);
+	Timer timer;
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < num_threads; ++i) {
+		threads.emplace_back([&]() {
+			size_t local_sum = 0;
+			for (size_t n = 0; n < NUM_LOADS; ++n) {
+				local_sum += shared.load()->size();
+			}
+			sum += local_sum;
+		});
+	}
+	for (auto& thread : threads) { thread.join(); }
+	printf("SharedSnapshot::load() with %lu threads: %5.1f ns per load\n", num_threads, 1e9 * timer.secs() / (num_threads * NUM_LOADS));
+	CHECK_EQ_F(sum.load(), 0u);
+}
+
+int main()
+{
+	using Key = uint64_t;
+	HashMap<Key, Key, IntHash<Key>> hash_map;
+	PersistentHashMap<Key, Key, IntHash<Key>> persistent_map;
+	for (Key i = 0; i < NUM_KEYS; ++i) {
+		hash_map.insert_or_assign(i, i);
+		persistent_map.insert_or_assign(i, i);
+	}
+
+	for (int run = 0; run < 3; ++run) {
+		bench("HashMap", hash_map);
+		bench("PersistentHashMap", persistent_map);
+	}
+	for (size_t num_threads : {1, 4}) {
+		bench_loads(num_threads);
+	}
+}
+
+/*
+Linux VM, g++ 12.2 -O2, x86-64:
+
+HashMap              update:   41746.9 us   random lookup:  37.0 ns
+PersistentHashMap    update:       4.7 us   random lookup: 223.4 ns
+HashMap              update:   42419.8 us   random lookup:  51.3 ns
+PersistentHashMap    update:       5.1 us   random lookup: 244.8 ns
+HashMap              update:   42653.3 us   random lookup:  50.5 ns
+PersistentHashMap    update:       5.3 us   random lookup: 272.8 ns
+SharedSnapshot::load() with 1 threads:  29.8 ns per load
+SharedSnapshot::load() with 4 threads:  31.0 ns per load
+
+With std::atomic_load on a shared_ptr (which in libstdc++ locks one of a global pool of mutexes):
+SharedSnapshot::load() with 1 threads:  50.8 ns per load
+SharedSnapshot::load() with 4 threads:  45.4 ns per load
+
+With 1M keys a lookup visits about five nodes, each most likely a cache miss.
+This VM has a single core, so the threads take turns rather than contend.
+*/
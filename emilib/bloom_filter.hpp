@@ -0,0 +1,208 @@
+// By Emil Ernerfeldt 2014-2017
+// LICENSE:
+//   This software is dual-licensed to the public domain and under the following
+//   license: you are granted a perpetual, irrevocable license to copy, modify,
+//   publish, and distribute this file as you see fit.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <loguru.hpp>
+
+#include "hash_set.hpp"
+
+namespace emilib {
+
+/// A blocked Bloom filter: a compact set of hash values that answers "definitely not in the set"
+/// or "maybe in the set". Use it in front of a big HashSet/HashMap where most lookups are misses:
+///
+///     emilib::BloomFilter filter(big_set); // Or: filter(expected_num_keys) + insert_hash() for each key.
+///     if (filter.may_contain_hash(key.hash()) && big_set.contains(key)) { ... }
+///
+/// The filter only sees hash values, so a key wrapped in a HashCache is never hashed again.
+/// Each hash value sets one bit in each of the eight 32-bit words of a single 32-byte block, so an
+/// insertion or a lookup touches one cache line. With SSE2 (see EMILIB_HASH_SSE2) the eight bits
+/// are computed and tested with a handful of vector instructions.
+///
+/// With the default 10 bits per key about 1% of misses are let through.
+/// Each extra bit per key roughly divides the false positive rate by 1.5.
+/// The filter can't erase keys: build a new one instead.
+class BloomFilter
+{
+public:
+	/// Room for expected_num_keys with a false positive rate given by bits_per_key.
+	explicit BloomFilter(size_t expected_num_keys, double bits_per_key = 10)
+	{
+		CHECK_GT_F(bits_per_key, 0.0);
+		const double num_bits = std::ceil(static_cast<double>(expected_num_keys) * bits_per_key);
+		_num_blocks = std::max<size_t>(1, static_cast<size_t>(num_bits / BITS_PER_BLOCK) + 1);
+		_storage.resize(_num_blocks * WORDS_PER_BLOCK + WORDS_PER_BLOCK - 1, 0u);
+	}
+
+	/// Contains the hash values of all keys in the set, as given by HashT()(key).
+	/// Note that this is before any mixing by PostMixHashPolicy, i.e. HashCache::hash() for a HashCache key.
+	template <typename KeyT, typename HashT, typename EqT, typename PolicyT>
+	explicit BloomFilter(const HashSet<KeyT, HashT, EqT, PolicyT>& set, double bits_per_key = 10)
+		: BloomFilter(set.size(), bits_per_key)
+	{
+		HashT hasher;
+		for (const KeyT& key : set) {
+			insert_hash(hasher(key));
+		}
+	}
+
+	BloomFilter(const BloomFilter& other)
+		: _num_blocks(other._num_blocks), _storage(other._storage.size(), 0u)
+	{
+		// The blocks may start at different offsets into _storage:
+		std::copy_n(other.blocks(), _num_blocks * WORDS_PER_BLOCK, blocks());
+	}
+
+	BloomFilter& operator=(const BloomFilter& other)
+	{
+		BloomFilter copy(other);
+		swap(copy);
+		return *this;
+	}
+
+	BloomFilter(BloomFilter&& other) noexcept { swap(other); }
+
+	BloomFilter& operator=(BloomFilter&& other) noexcept
+	{
+		swap(other);
+		return *this;
+	}
+
+	void swap(BloomFilter& other) noexcept
+	{
+		std::swap(_num_blocks, other._num_blocks);
+		std::swap(_storage,    other._storage);
+	}
+
+	/// Size of the filter in bits.
+	size_t num_bits() const { return _num_blocks * BITS_PER_BLOCK; }
+
+	/// Forget all inserted hash values.
+	void clear()
+	{
+		std::fill_n(blocks(), _num_blocks * WORDS_PER_BLOCK, 0u);
+	}
+
+	void insert_hash(size_t hash_value)
+	{
+		const uint64_t mixed = hash_mix(hash_value);
+		uint32_t* block = blocks() + block_index(mixed) * WORDS_PER_BLOCK;
+#if EMILIB_HASH_SSE2
+		__m128i lo, hi;
+		make_masks(static_cast<uint32_t>(mixed), &lo, &hi);
+		__m128i* words = reinterpret_cast<__m128i*>(block);
+		_mm_store_si128(words + 0, _mm_or_si128(_mm_load_si128(words + 0), lo));
+		_mm_store_si128(words + 1, _mm_or_si128(_mm_load_si128(words + 1), hi));
+#else
+		for (int i = 0; i < WORDS_PER_BLOCK; ++i) {
+			block[i] |= bit_in_word(static_cast<uint32_t>(mixed), i);
+		}
+#endif
+	}
+
+	/// False if the hash value was never inserted. True if it was, or for a small fraction of those that weren't.
+	bool may_contain_hash(size_t hash_value) const
+	{
+		const uint64_t mixed = hash_mix(hash_value);
+		const uint32_t* block = blocks() + block_index(mixed) * WORDS_PER_BLOCK;
+#if EMILIB_HASH_SSE2
+		__m128i lo, hi;
+		make_masks(static_cast<uint32_t>(mixed), &lo, &hi);
+		const __m128i* words = reinterpret_cast<const __m128i*>(block);
+		// Bits set in the masks but missing in the block:
+		const __m128i missing = _mm_or_si128(_mm_andnot_si128(_mm_load_si128(words + 0), lo),
+		                                     _mm_andnot_si128(_mm_load_si128(words + 1), hi));
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(missing, _mm_setzero_si128())) == 0xFFFF;
+#else
+		for (int i = 0; i < WORDS_PER_BLOCK; ++i) {
+			const uint32_t bit = bit_in_word(static_cast<uint32_t>(mixed), i);
+			if ((block[i] & bit) == 0) {
+				return false;
+			}
+		}
+		return true;
+#endif
+	}
+
+	/// Start fetching the block of this hash value into the cache, e.g. a few lookups ahead.
+	void prefetch_hash(size_t hash_value) const
+	{
+		hash_detail::prefetch(blocks() + block_index(hash_mix(hash_value)) * WORDS_PER_BLOCK);
+	}
+
+private:
+	static const int    WORDS_PER_BLOCK = 8;
+	static const size_t BITS_PER_BLOCK  = 32 * WORDS_PER_BLOCK;
+
+	// Odd constants which pick the bit in each word (the same as in the split block Bloom filter of Parquet).
+	static uint32_t salt(int i)
+	{
+		static const uint32_t SALT[WORDS_PER_BLOCK] = {
+			0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du,
+			0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u,
+		};
+		return SALT[i];
+	}
+
+	// The high bits pick the block, the low bits the bits within it.
+	size_t block_index(uint64_t mixed) const
+	{
+		return static_cast<size_t>(((mixed >> 32) * _num_blocks) >> 32);
+	}
+
+#if EMILIB_HASH_SSE2
+	// Same as bit_in_word for words [0, 4) in lo and [4, 8) in hi.
+	static void make_masks(uint32_t bits, __m128i* lo, __m128i* hi)
+	{
+		const __m128i input = _mm_set1_epi32(static_cast<int>(bits));
+		*lo = masks_from_salts(input, _mm_setr_epi32(static_cast<int>(salt(0)), static_cast<int>(salt(1)), static_cast<int>(salt(2)), static_cast<int>(salt(3))));
+		*hi = masks_from_salts(input, _mm_setr_epi32(static_cast<int>(salt(4)), static_cast<int>(salt(5)), static_cast<int>(salt(6)), static_cast<int>(salt(7))));
+	}
+
+	static __m128i masks_from_salts(__m128i input, __m128i salts)
+	{
+		// SSE2 has no 32-bit multiplication, so multiply the even and odd lanes separately:
+		const __m128i even = _mm_mul_epu32(input, salts);
+		const __m128i odd  = _mm_mul_epu32(_mm_srli_epi64(input, 32), _mm_srli_epi64(salts, 32));
+		const __m128i products = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+		                                            _mm_shuffle_epi32(odd,  _MM_SHUFFLE(0, 0, 2, 0)));
+		const __m128i bit_indices = _mm_srli_epi32(products, 27);
+		// Nor any variable shifts, so build the float 2^index and convert it to an integer.
+		// 2^31 is out of range and converts to 0x80000000, which happens to be the right answer.
+		const __m128i exponents = _mm_slli_epi32(_mm_add_epi32(bit_indices, _mm_set1_epi32(127)), 23);
+		return _mm_cvttps_epi32(_mm_castsi128_ps(exponents));
+	}
+#else
+	static uint32_t bit_in_word(uint32_t bits, int i)
+	{
+		return 1u << ((bits * salt(i)) >> 27);
+	}
+#endif
+
+	// The blocks start at the first 32-byte boundary of _storage, so that none straddles two cache lines.
+	uint32_t* blocks()
+	{
+		const uintptr_t address = reinterpret_cast<uintptr_t>(_storage.data());
+		return _storage.data() + ((-address & 31) / sizeof(uint32_t));
+	}
+
+	const uint32_t* blocks() const
+	{
+		return const_cast<BloomFilter*>(this)->blocks();
+	}
+
+	size_t                _num_blocks = 0;
+	std::vector<uint32_t> _storage;
+};
+
+} // namespace emilib
@@ -0,0 +1,204 @@
+// By Emil Ernerfeldt 2014-2017
+// LICENSE:
+//   This software is dual-licensed to the public domain and under the following
+//   license: you are granted a perpetual, irrevocable license to copy, modify,
+//   publish, and distribute this file as you see fit.
+
+#pragma once
+
+#include <memory>
+
+#include <loguru.hpp>
+
+#include "hash_map.hpp"
+#include "read_write_mutex.hpp"
+
+namespace emilib {
+
+/// A thread-safe hash map made up of many HashMap:s (shards), each protected by its own mutex.
+/// Keys are spread over the shards by their hash, so threads working on different keys
+/// rarely contend for the same lock.
+///
+/// All operations on a single key are atomic.
+/// Operations touching all shards (size, clear, for_each) lock one shard at a time,
+/// so they do NOT see a consistent snapshot of the whole map.
+///
+/// Example:
+///     ConcurrentHashMap<std::string, int> map;
+///     map.insert_or_assign("foo", 42);
+///     map.visit("foo", [](int& value) { value += 1; });
+///     int value;
+///     if (map.find("foo", &value)) { ... }
+template <typename KeyT, typename ValueT, typename HashT = std::hash<KeyT>, typename EqT = HashMapEqualTo<KeyT>, typename MutexT = FastReadWriteMutex>
+class ConcurrentHashMap
+{
+public:
+	using Map = HashMap<KeyT, ValueT, HashT, EqT>;
+
+	/// num_shards must be a power of two.
+	/// Use a few times more shards than you have threads.
+	explicit ConcurrentHashMap(size_t num_shards = 64)
+		: _shards(new Shard[num_shards])
+		, _shard_mask(num_shards - 1)
+	{
+		CHECK_F(num_shards != 0 && (num_shards & (num_shards - 1)) == 0,
+			"num_shards must be a power of two, got %lu", num_shards);
+	}
+
+	size_t num_shards() const { return _shard_mask + 1; }
+
+	/// Number of elements. Only approximate if other threads are modifying the map.
+	size_t size() const
+	{
+		size_t num_elements = 0;
+		for (size_t i = 0; i < num_shards(); ++i) {
+			ReadLock<MutexT> lock(_shards[i].mutex);
+			num_elements += _shards[i].map.size();
+		}
+		return num_elements;
+	}
+
+	bool empty() const { return size() == 0; }
+
+	// ------------------------------------------------------------------------
+
+	/// If the key is in the map, copy its value to *out_value (if non-null) and return true.
+	bool find(const KeyT& key, ValueT* out_value = nullptr) const
+	{
+		const auto hash_value = _hasher(key);
+		const Shard& shard = shard_for(hash_value);
+		ReadLock<MutexT> lock(shard.mutex);
+		const ValueT* value = shard.map.try_get_with_hash(key, hash_value);
+		if (value && out_value) {
+			*out_value = *value;
+		}
+		return value != nullptr;
+	}
+
+	bool contains(const KeyT& key) const
+	{
+		return find(key);
+	}
+
+	/// Insert unless the key is already in the map.
+	/// Returns true if the insertion took place.
+	bool insert(const KeyT& key, const ValueT& value)
+	{
+		Shard& shard = shard_for(_hasher(key));
+		WriteLock<MutexT> lock(shard.mutex);
+		return shard.map.insert(key, value).second;
+	}
+
+	/// Returns true if this was a new key, false if an old value was overwritten.
+	bool insert_or_assign(const KeyT& key, ValueT value)
+	{
+		Shard& shard = shard_for(_hasher(key));
+		WriteLock<MutexT> lock(shard.mutex);
+		return shard.map.insert_or_assign(key, std::move(value)).second;
+	}
+
+	/// Returns false if the key was not found.
+	bool erase(const KeyT& key)
+	{
+		Shard& shard = shard_for(_hasher(key));
+		WriteLock<MutexT> lock(shard.mutex);
+		return shard.map.erase(key);
+	}
+
+	/// Call visitor(ValueT&) while holding the lock of the key's shard.
+	/// Returns false (without calling visitor) if the key was not found.
+	/// The visitor must not access this map.
+	template<typename Visitor>
+	bool visit(const KeyT& key, const Visitor& visitor)
+	{
+		const auto hash_value = _hasher(key);
+		Shard& shard = shard_for(hash_value);
+		WriteLock<MutexT> lock(shard.mutex);
+		ValueT* value = shard.map.try_get_with_hash(key, hash_value);
+		if (value) {
+			visitor(*value);
+		}
+		return value != nullptr;
+	}
+
+	/// Call visitor(const ValueT&) while holding a read lock of the key's shard.
+	/// Returns false (without calling visitor) if the key was not found.
+	/// The visitor must not modify this map.
+	template<typename Visitor>
+	bool visit(const KeyT& key, const Visitor& visitor) const
+	{
+		const auto hash_value = _hasher(key);
+		const Shard& shard = shard_for(hash_value);
+		ReadLock<MutexT> lock(shard.mutex);
+		const ValueT* value = shard.map.try_get_with_hash(key, hash_value);
+		if (value) {
+			visitor(*value);
+		}
+		return value != nullptr;
+	}
+
+	/// Call visitor(const KeyT&, ValueT&) for each element, locking one shard at a time.
+	/// The visitor must not access this map.
+	template<typename Visitor>
+	void for_each(const Visitor& visitor)
+	{
+		for (size_t i = 0; i < num_shards(); ++i) {
+			WriteLock<MutexT> lock(_shards[i].mutex);
+			for (auto& pair : _shards[i].map) {
+				visitor(static_cast<const KeyT&>(pair.first), pair.second);
+			}
+		}
+	}
+
+	/// Call visitor(const KeyT&, const ValueT&) for each element, read-locking one shard at a time.
+	/// The visitor must not modify this map.
+	template<typename Visitor>
+	void for_each(const Visitor& visitor) const
+	{
+		for (size_t i = 0; i < num_shards(); ++i) {
+			ReadLock<MutexT> lock(_shards[i].mutex);
+			for (const auto& pair : _shards[i].map) {
+				visitor(pair.first, pair.second);
+			}
+		}
+	}
+
+	/// Remove all elements, one shard at a time.
+	void clear()
+	{
+		for (size_t i = 0; i < num_shards(); ++i) {
+			WriteLock<MutexT> lock(_shards[i].mutex);
+			_shards[i].map.clear();
+		}
+	}
+
+private:
+	struct Shard
+	{
+		mutable MutexT mutex;
+		Map            map;
+		char           padding[64]; // Keep neighboring shards out of each others cache lines.
+	};
+
+	// The inner HashMap:s use the low bits of the hash, so we pick the shard from the upper half
+	// of a Fibonacci multiplication, which spreads well even for an identity hash.
+	size_t shard_index(size_t hash_value) const
+	{
+		const size_t num_bits = sizeof(size_t) * 8;
+		const size_t golden = static_cast<size_t>(0x9E3779B97F4A7C15ull >> (64 - num_bits));
+		const size_t mixed = hash_value * golden;
+		return (mixed >> (num_bits / 2)) & _shard_mask;
+	}
+
+	Shard& shard_for(size_t hash_value) { return _shards[shard_index(hash_value)]; }
+	const Shard& shard_for(size_t hash_value) const { return _shards[shard_index(hash_value)]; }
+
+	ConcurrentHashMap(const ConcurrentHashMap&) = delete;
+	ConcurrentHashMap& operator=(const ConcurrentHashMap&) = delete;
+
+	HashT                    _hasher;
+	std::unique_ptr<Shard[]> _shards;
+	size_t                   _shard_mask;
+};
+
+} // namespace emilib
@@ -0,0 +1,557 @@
+// By Emil Ernerfeldt 2014-2017
+// LICENSE:
+//   This software is dual-licensed to the public domain and under the following
+//   license: you are granted a perpetual, irrevocable license to copy, modify,
+//   publish, and distribute this file as you see fit.
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <loguru.hpp>
+
+#include "hash_map.hpp"
+#include "mem_map.hpp"
+
+namespace emilib {
+
+/*
+An immutable hash map stored in a flat blob that can be memory mapped and used as-is.
+No parsing, no copying and no heap allocations are done when opening it,
+and several processes mapping the same file will share the pages.
+Opening does validate the header, counts the filled buckets, and checks that every string key lies
+within the blob, so a corrupt file throws instead of being read out of bounds or probed forever.
+
+Keys are either std::string or an integral/enum type.
+Values must be trivially copyable (they are stored as raw bytes).
+The blob uses the native endianness and struct layout, so it is only portable between
+builds with the same ValueT on the same kind of platform.
+
+Example:
+	FrozenHashMapBuilder<std::string, AssetInfo> builder;
+	builder.insert("textures/grass.png", info);
+	builder.save("assets.frozen");
+
+	FrozenHashMap<std::string, AssetInfo> assets("assets.frozen");
+	if (const AssetInfo* info = assets.try_get("textures/grass.png")) { ... }
+*/
+
+/// A key of a FrozenHashMap<std::string, ...>, pointing into the mapped memory.
+struct FrozenString
+{
+	const char* data;
+	size_t      size;
+
+	std::string str() const { return std::string(data, size); }
+};
+
+namespace frozen_detail {
+
+const char     MAGIC[8] = {'e', 'm', 'F', 'r', 'o', 'z', 'e', 'n'};
+const uint32_t VERSION  = 1;
+
+struct Header
+{
+	char     magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint64_t key_size;         // sizeof(KeyT), or 0 for string keys
+	uint64_t value_size;       // sizeof(ValueT)
+	uint64_t entry_size;       // sizeof(Entry)
+	uint64_t num_elements;
+	uint64_t num_buckets;      // Power of two
+	uint64_t states_offset;    // From start of blob
+	uint64_t entries_offset;   // From start of blob
+	uint64_t strings_offset;   // From start of blob
+	uint64_t strings_size;
+	uint64_t total_size;
+};
+
+/// Aligns all offsets so that entries can be read directly from the (page-aligned) mapping.
+const size_t ALIGNMENT = 64;
+
+inline size_t align_up(size_t offset)
+{
+	return (offset + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+/// Is [offset, offset + length) inside [0, size)? Can't overflow, whatever garbage is in the header.
+inline bool is_within(uint64_t offset, uint64_t length, uint64_t size)
+{
+	return offset <= size && length <= size - offset;
+}
+
+/// Stable across processes and compilers (unlike std::hash).
+inline uint64_t mix64(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdull;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ull;
+	x ^= x >> 33;
+	return x;
+}
+
+/// Eight bytes at a time, with a final mix so that the low bits are good enough for picking a bucket.
+/// Uses native byte order, like the rest of the file format.
+inline uint64_t hash_bytes(const char* data, size_t size)
+{
+	uint64_t hash = 0xcbf29ce484222325ull ^ size;
+	while (size >= 8) {
+		uint64_t word;
+		std::memcpy(&word, data, 8);
+		hash = (hash ^ mix64(word)) * 0x9E3779B97F4A7C15ull;
+		data += 8;
+		size -= 8;
+	}
+	uint64_t tail = 0;
+	std::memcpy(&tail, data, size);
+	return mix64(hash ^ tail);
+}
+
+/// Each bucket has a control byte, like in HashMap.
+/// EMPTY, or the top 7 bits of the hash of the key in that bucket.
+/// Probing only touches the compact control bytes until a likely match is found.
+const uint8_t EMPTY = 0x80;
+
+inline uint8_t hash_fragment(uint64_t hash_value)
+{
+	return static_cast<uint8_t>(hash_value >> 57);
+}
+
+/// How keys of type KeyT are hashed, stored and compared.
+template<typename KeyT>
+struct KeyTraits
+{
+	static_assert(std::is_integral<KeyT>::value || std::is_enum<KeyT>::value,
+		"FrozenHashMap keys must be std::string or an integral/enum type");
+
+	using Stored = KeyT;
+	using View   = KeyT;
+
+	static const uint64_t SIZE = sizeof(KeyT);
+
+	static uint64_t hash(const KeyT& key)
+	{
+		return mix64(static_cast<uint64_t>(key));
+	}
+
+	static bool equals(const Stored& stored, const char* /*strings*/, const KeyT& key)
+	{
+		return stored == key;
+	}
+
+	static bool is_valid(const Stored& /*stored*/, const char* /*strings*/, uint64_t /*strings_size*/) { return true; }
+
+	static View view(const Stored& stored, const char* /*strings*/) { return stored; }
+
+	static Stored store(const KeyT& key, std::string* /*strings*/) { return key; }
+};
+
+template<>
+struct KeyTraits<std::string>
+{
+	struct Stored
+	{
+		uint64_t offset; // Into the string section
+		uint64_t size;
+	};
+	using View = FrozenString;
+
+	static const uint64_t SIZE = 0;
+
+	static uint64_t hash(const char* data, size_t size)
+	{
+		return hash_bytes(data, size);
+	}
+
+	static uint64_t hash(const std::string& key) { return hash(key.data(), key.size()); }
+
+	static bool equals(const Stored& stored, const char* strings, const char* data, size_t size)
+	{
+		return stored.size == size && std::memcmp(strings + stored.offset, data, size) == 0;
+	}
+
+	static bool equals(const Stored& stored, const char* strings, const std::string& key)
+	{
+		return equals(stored, strings, key.data(), key.size());
+	}
+
+	/// The string and its terminating zero must be inside the string section.
+	static bool is_valid(const Stored& stored, const char* strings, uint64_t strings_size)
+	{
+		return stored.size < strings_size && is_within(stored.offset, stored.size + 1, strings_size) &&
+		       strings[stored.offset + stored.size] == '\0';
+	}
+
+	static View view(const Stored& stored, const char* strings)
+	{
+		return View{strings + stored.offset, static_cast<size_t>(stored.size)};
+	}
+
+	static Stored store(const std::string& key, std::string* strings)
+	{
+		Stored stored{strings->size(), key.size()};
+		strings->append(key);
+		strings->push_back('\0'); // So that FrozenString::data can be used as a C string.
+		return stored;
+	}
+};
+
+template<typename KeyT, typename ValueT>
+struct Entry
+{
+	typename KeyTraits<KeyT>::Stored key;
+	ValueT                           value;
+};
+
+} // namespace frozen_detail
+
+// ----------------------------------------------------------------------------
+
+/// Read-only view of a blob written by FrozenHashMapBuilder.
+template<typename KeyT, typename ValueT>
+class FrozenHashMap
+{
+	static_assert(std::is_trivially_copyable<ValueT>::value, "FrozenHashMap values must be trivially copyable");
+
+	using Traits = frozen_detail::KeyTraits<KeyT>;
+	using Entry  = frozen_detail::Entry<KeyT, ValueT>;
+
+public:
+	using KeyView = typename Traits::View;
+
+	/// What you get when dereferencing an iterator.
+	struct value_type
+	{
+		KeyView       first;
+		const ValueT& second;
+	};
+
+	class const_iterator
+	{
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using difference_type   = size_t;
+		using value_type        = FrozenHashMap::value_type;
+		using reference         = value_type;
+
+		struct pointer
+		{
+			value_type value;
+			const value_type* operator->() const { return &value; }
+		};
+
+		const_iterator(const FrozenHashMap* map, size_t bucket) : _map(map), _bucket(bucket) { }
+
+		const_iterator& operator++()
+		{
+			this->goto_next_element();
+			return *this;
+		}
+
+		const_iterator operator++(int)
+		{
+			size_t old_index = _bucket;
+			this->goto_next_element();
+			return const_iterator(_map, old_index);
+		}
+
+		reference operator*() const
+		{
+			const Entry& entry = _map->_entries[_bucket];
+			return value_type{Traits::view(entry.key, _map->_strings), entry.value};
+		}
+
+		pointer operator->() const { return pointer{**this}; }
+
+		bool operator==(const const_iterator& rhs) const
+		{
+			DCHECK_EQ_F(_map, rhs._map);
+			return this->_bucket == rhs._bucket;
+		}
+
+		bool operator!=(const const_iterator& rhs) const
+		{
+			DCHECK_EQ_F(_map, rhs._map);
+			return this->_bucket != rhs._bucket;
+		}
+
+	private:
+		void goto_next_element()
+		{
+			DCHECK_LT_F(_bucket, _map->_num_buckets);
+			do {
+				_bucket++;
+			} while (_bucket < _map->_num_buckets && _map->_states[_bucket] == frozen_detail::EMPTY);
+		}
+
+		const FrozenHashMap* _map;
+		size_t               _bucket;
+	};
+
+	using iterator = const_iterator;
+
+	// ------------------------------------------------------------------------
+
+	/// Memory map a file written by FrozenHashMapBuilder::save.
+	/// Throws std::runtime_error if the file is missing, corrupt, or was not written for these types.
+	explicit FrozenHashMap(const char* path) : FrozenHashMap(MemMap(path)) { }
+
+	/// Take ownership of a memory mapping of a file written by FrozenHashMapBuilder::save.
+	explicit FrozenHashMap(MemMap mem_map) : _mem_map(std::move(mem_map))
+	{
+		attach(_mem_map.data(), _mem_map.size());
+	}
+
+	/// Use a blob from FrozenHashMapBuilder::build without copying it.
+	/// The data must be at least as aligned as the keys and values, and outlive the FrozenHashMap.
+	/// Throws std::runtime_error like the constructor above.
+	FrozenHashMap(const void* data, size_t size)
+	{
+		attach(data, size);
+	}
+
+	FrozenHashMap(FrozenHashMap&& other) { *this = std::move(other); }
+
+	void operator=(FrozenHashMap&& other)
+	{
+		_mem_map     = std::move(other._mem_map);
+		_states      = other._states;
+		_entries     = other._entries;
+		_strings     = other._strings;
+		_num_buckets = other._num_buckets;
+		_num_filled  = other._num_filled;
+		_mask        = other._mask;
+	}
+
+	// ------------------------------------------------------------------------
+
+	const_iterator begin() const
+	{
+		size_t bucket = 0;
+		while (bucket < _num_buckets && _states[bucket] == frozen_detail::EMPTY) {
+			++bucket;
+		}
+		return const_iterator(this, bucket);
+	}
+
+	const_iterator end() const { return const_iterator(this, _num_buckets); }
+
+	size_t size() const { return _num_filled; }
+	bool empty() const { return _num_filled == 0; }
+	size_t bucket_count() const { return _num_buckets; }
+
+	// ------------------------------------------------------------------------
+
+	template<typename... Key>
+	const_iterator find(const Key&... key) const
+	{
+		auto bucket = find_filled_bucket(key...);
+		return bucket == (size_t)-1 ? end() : const_iterator(this, bucket);
+	}
+
+	/// Returns the matching ValueT or nullptr if the key isn't found.
+	/// For string keys, both try_get(std::string) and try_get(const char* data, size_t size) works.
+	template<typename... Key>
+	const ValueT* try_get(const Key&... key) const
+	{
+		auto bucket = find_filled_bucket(key...);
+		return bucket == (size_t)-1 ? nullptr : &_entries[bucket].value;
+	}
+
+	template<typename... Key>
+	bool contains(const Key&... key) const
+	{
+		return find_filled_bucket(key...) != (size_t)-1;
+	}
+
+	template<typename... Key>
+	size_t count(const Key&... key) const
+	{
+		return find_filled_bucket(key...) != (size_t)-1 ? 1 : 0;
+	}
+
+private:
+	FrozenHashMap(const FrozenHashMap&) = delete;
+	FrozenHashMap& operator=(const FrozenHashMap&) = delete;
+
+	void attach(const void* data, size_t size)
+	{
+		using namespace frozen_detail;
+		const char* blob = static_cast<const char*>(data);
+		const Header* header = reinterpret_cast<const Header*>(blob);
+
+		if (size < sizeof(Header) || std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0) {
+			throw std::runtime_error("Not a FrozenHashMap");
+		}
+		if (header->version != VERSION || header->header_size != sizeof(Header)) {
+			throw std::runtime_error("Unsupported FrozenHashMap version");
+		}
+		if (header->key_size != Traits::SIZE || header->value_size != sizeof(ValueT) ||
+			header->entry_size != sizeof(Entry)) {
+			throw std::runtime_error("FrozenHashMap was written for different key/value types");
+		}
+		// Probing wraps around with a mask, and stops at the first empty bucket:
+		const uint64_t num_buckets = header->num_buckets;
+		if (num_buckets == 0 || (num_buckets & (num_buckets - 1)) != 0 || header->num_elements >= num_buckets) {
+			throw std::runtime_error("FrozenHashMap is corrupt (bad bucket count)");
+		}
+		if (header->total_size != size ||
+			!is_within(header->states_offset, num_buckets, size) ||
+			num_buckets > size / sizeof(Entry) ||
+			!is_within(header->entries_offset, num_buckets * sizeof(Entry), size) ||
+			!is_within(header->strings_offset, header->strings_size, size)) {
+			throw std::runtime_error("FrozenHashMap is truncated");
+		}
+		if (reinterpret_cast<uintptr_t>(blob) % alignof(Entry) != 0 || header->entries_offset % alignof(Entry) != 0) {
+			throw std::runtime_error("FrozenHashMap data is not aligned");
+		}
+
+		_states      = reinterpret_cast<const uint8_t*>(blob + header->states_offset);
+		_entries     = reinterpret_cast<const Entry*>(blob + header->entries_offset);
+		_strings     = blob + header->strings_offset;
+		_num_buckets = header->num_buckets;
+		_num_filled  = header->num_elements;
+		_mask        = _num_buckets - 1;
+
+		// The control bytes must agree with num_elements, which leaves at least one empty bucket to end each probe:
+		size_t num_filled = 0;
+		for (size_t bucket = 0; bucket < _num_buckets; ++bucket) {
+			if (_states[bucket] == EMPTY) { continue; }
+			num_filled += 1;
+			if (!Traits::is_valid(_entries[bucket].key, _strings, header->strings_size)) {
+				throw std::runtime_error("FrozenHashMap is corrupt (key outside of the string section)");
+			}
+		}
+		if (num_filled != _num_filled) {
+			throw std::runtime_error("FrozenHashMap is corrupt (wrong number of filled buckets)");
+		}
+	}
+
+	template<typename... Key>
+	size_t find_filled_bucket(const Key&... key) const
+	{
+		if (empty()) { return (size_t)-1; }
+
+		const uint64_t hash_value = Traits::hash(key...);
+		const uint8_t fragment = frozen_detail::hash_fragment(hash_value);
+		for (size_t bucket = hash_value & _mask; ; bucket = (bucket + 1) & _mask) {
+			const uint8_t state = _states[bucket];
+			if (state == fragment && Traits::equals(_entries[bucket].key, _strings, key...)) {
+				return bucket;
+			}
+			if (state == frozen_detail::EMPTY) {
+				return (size_t)-1; // End of the chain!
+			}
+		}
+	}
+
+	MemMap         _mem_map;
+	const uint8_t* _states      = nullptr;
+	const Entry*   _entries     = nullptr;
+	const char*    _strings     = nullptr;
+	size_t         _num_buckets = 0;
+	size_t         _num_filled  = 0;
+	size_t         _mask        = 0;
+};
+
+// ----------------------------------------------------------------------------
+
+/// Collects elements and writes them in the format read by FrozenHashMap.
+template<typename KeyT, typename ValueT>
+class FrozenHashMapBuilder
+{
+	static_assert(std::is_trivially_copyable<ValueT>::value, "FrozenHashMap values must be trivially copyable");
+
+	using Traits = frozen_detail::KeyTraits<KeyT>;
+	using Entry  = frozen_detail::Entry<KeyT, ValueT>;
+
+public:
+	/// Like HashMap::insert_or_assign.
+	void insert_or_assign(const KeyT& key, const ValueT& value)
+	{
+		_map.insert_or_assign(key, ValueT(value));
+	}
+
+	/// Returns false if the key was already added.
+	bool insert(const KeyT& key, const ValueT& value)
+	{
+		return _map.insert(key, value).second;
+	}
+
+	size_t size() const { return _map.size(); }
+
+	/// Returns the blob. Use it with FrozenHashMap(data, size) or write it to a file.
+	std::vector<uint8_t> build() const
+	{
+		using namespace frozen_detail;
+
+		size_t num_buckets = 4;
+		while (num_buckets < _map.size() + _map.size() / 2 + 1) { num_buckets *= 2; }
+
+		std::vector<uint8_t> states(num_buckets, EMPTY);
+		std::vector<Entry> entries(num_buckets);
+		std::memset(entries.data(), 0, entries.size() * sizeof(Entry)); // No uninitialized padding in the file
+		std::string strings;
+		for (const auto& pair : _map) {
+			const uint64_t hash_value = Traits::hash(pair.first);
+			size_t bucket = hash_value & (num_buckets - 1);
+			while (states[bucket] != EMPTY) {
+				bucket = (bucket + 1) & (num_buckets - 1);
+			}
+			states[bucket]        = hash_fragment(hash_value);
+			entries[bucket].key   = Traits::store(pair.first, &strings);
+			entries[bucket].value = pair.second;
+		}
+
+		Header header;
+		std::memset(&header, 0, sizeof(header));
+		std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+		header.version        = VERSION;
+		header.header_size    = sizeof(Header);
+		header.key_size       = Traits::SIZE;
+		header.value_size     = sizeof(ValueT);
+		header.entry_size     = sizeof(Entry);
+		header.num_elements   = _map.size();
+		header.num_buckets    = num_buckets;
+		header.states_offset  = align_up(sizeof(Header));
+		header.entries_offset = align_up(header.states_offset + num_buckets);
+		header.strings_offset = align_up(header.entries_offset + num_buckets * sizeof(Entry));
+		header.strings_size   = strings.size();
+		header.total_size     = header.strings_offset + strings.size();
+
+		std::vector<uint8_t> blob(header.total_size, 0);
+		std::memcpy(blob.data(), &header, sizeof(header));
+		std::memcpy(blob.data() + header.states_offset, states.data(), num_buckets);
+		std::memcpy(blob.data() + header.entries_offset, entries.data(), num_buckets * sizeof(Entry));
+		std::memcpy(blob.data() + header.strings_offset, strings.data(), strings.size());
+		return blob;
+	}
+
+	/// Write the blob to a file. Throws std::runtime_error on failure.
+	void save(const char* path) const
+	{
+		const auto blob = build();
+		FILE* file = fopen(path, "wb");
+		if (!file) {
+			throw std::runtime_error((std::string)"Failed to open '" + path + "' for writing");
+		}
+		const bool ok = fwrite(blob.data(), 1, blob.size(), file) == blob.size();
+		if (fclose(file) != 0 || !ok) {
+			throw std::runtime_error((std::string)"Failed to write '" + path + "'");
+		}
+	}
+
+private:
+	HashMap<KeyT, ValueT> _map;
+};
+
+} // namespace emilib
@@ -0,0 +1,250 @@
+// By Emil Ernerfeldt 2014-2017
+// LICENSE:
+//   This software is dual-licensed to the public domain and under the following
+//   license: you are granted a perpetual, irrevocable license to copy, modify,
+//   publish, and distribute this file as you see fit.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+	#include <intrin.h>
+#endif
+
+/// Fast, well-distributed hash functions for HashMap, HashSet and friends.
+///
+/// libstdc++ implements std::hash for integers as the identity function, which is fine for
+/// std::unordered_map (prime number of buckets) but terrible for tables that pick the bucket
+/// by masking the low bits (power-of-two capacity, like HashMap): keys that are multiples of 1024
+/// all land in every 1024th bucket, and linear probing turns that into long clusters.
+///
+/// Example:
+///     emilib::HashMap<int, Foo, emilib::IntHash<int>> map;
+///     emilib::HashMap<std::string, Foo, emilib::StringHash> map;
+///     emilib::HashMap<std::pair<int, std::string>, Foo, emilib::Hash<std::pair<int, std::string>>> map;
+///
+/// None of these are stable across platforms (size_t differs), nor are they cryptographic.
+/// If you can't change the hash function, use PostMixHashPolicy (see hash_policy.hpp) instead.
+
+namespace emilib {
+
+namespace hash_detail {
+
+const uint64_t GOLDEN_RATIO_64 = 0x9E3779B97F4A7C15ull;
+
+// Secrets from wyhash by Wang Yi (public domain).
+const uint64_t WY_SECRET_0 = 0xa0761d6478bd642full;
+const uint64_t WY_SECRET_1 = 0xe7037ed1a0b428dbull;
+const uint64_t WY_SECRET_2 = 0x8ebc6af09c88c6e3ull;
+const uint64_t WY_SECRET_3 = 0x589965cc75374cc3ull;
+
+/// Full 64x64 -> 128 bit multiplication, folded back to 64 bits by xor:ing the two halves.
+/// All input bits affect both the low and the high bits of the result.
+inline uint64_t mum(uint64_t a, uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+	const __uint128_t r = static_cast<__uint128_t>(a) * b;
+	return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+	uint64_t hi;
+	const uint64_t lo = _umul128(a, b, &hi);
+	return lo ^ hi;
+#else
+	const uint64_t a_lo = a & 0xFFFFFFFFu, a_hi = a >> 32;
+	const uint64_t b_lo = b & 0xFFFFFFFFu, b_hi = b >> 32;
+	const uint64_t lo_lo = a_lo * b_lo;
+	const uint64_t hi_lo = a_hi * b_lo;
+	const uint64_t lo_hi = a_lo * b_hi;
+	const uint64_t hi_hi = a_hi * b_hi;
+	const uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFFu) + lo_hi;
+	const uint64_t hi = hi_hi + (hi_lo >> 32) + (cross >> 32);
+	const uint64_t lo = (cross << 32) | (lo_lo & 0xFFFFFFFFu);
+	return lo ^ hi;
+#endif
+}
+
+inline uint64_t read_u64(const uint8_t* p)
+{
+	uint64_t value;
+	std::memcpy(&value, p, 8);
+	return value;
+}
+
+inline uint64_t read_u32(const uint8_t* p)
+{
+	uint32_t value;
+	std::memcpy(&value, p, 4);
+	return value;
+}
+
+/// Reads 1-3 bytes.
+inline uint64_t read_small(const uint8_t* p, size_t size)
+{
+	return (uint64_t(p[0]) << 16) | (uint64_t(p[size >> 1]) << 8) | p[size - 1];
+}
+
+} // namespace hash_detail
+
+/// Multiplicative (Fibonacci) mixing of a 64-bit value.
+/// Cheap (a single wide multiplication) and both the low bits (used for picking the bucket)
+/// and the high bits (used for the hash fragment in the control bytes) depend on all input bits.
+inline size_t hash_mix(uint64_t value)
+{
+	return static_cast<size_t>(hash_detail::mum(value, hash_detail::GOLDEN_RATIO_64));
+}
+
+/// wyhash-style hash of a byte range: reads 8 or 16 bytes at a time.
+/// Same input and seed gives the same hash in every process on the same platform.
+inline uint64_t hash_bytes(const void* data, size_t size, uint64_t seed = 0)
+{
+	using namespace hash_detail;
+	const uint8_t* p = static_cast<const uint8_t*>(data);
+	seed ^= mum(seed ^ WY_SECRET_0, WY_SECRET_1);
+	uint64_t a, b;
+	if (size <= 16) {
+		if (size >= 4) {
+			const size_t mid = (size >> 3) << 2;
+			a = (read_u32(p) << 32) | read_u32(p + mid);
+			b = (read_u32(p + size - 4) << 32) | read_u32(p + size - 4 - mid);
+		} else if (size > 0) {
+			a = read_small(p, size);
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		size_t left = size;
+		if (left > 48) {
+			uint64_t seed_1 = seed, seed_2 = seed;
+			do {
+				seed   = mum(read_u64(p)      ^ WY_SECRET_1, read_u64(p + 8)  ^ seed);
+				seed_1 = mum(read_u64(p + 16) ^ WY_SECRET_2, read_u64(p + 24) ^ seed_1);
+				seed_2 = mum(read_u64(p + 32) ^ WY_SECRET_3, read_u64(p + 40) ^ seed_2);
+				p += 48;
+				left -= 48;
+			} while (left > 48);
+			seed ^= seed_1 ^ seed_2;
+		}
+		while (left > 16) {
+			seed = mum(read_u64(p) ^ WY_SECRET_1, read_u64(p + 8) ^ seed);
+			p += 16;
+			left -= 16;
+		}
+		a = read_u64(p + left - 16);
+		b = read_u64(p + left - 8);
+	}
+	return mum(mum(a ^ WY_SECRET_1, b ^ seed) ^ WY_SECRET_0 ^ size, WY_SECRET_1);
+}
+
+/// Combine the hash of another value into seed, e.g. for hashing the members of a struct.
+/// Unlike the boost version, the order of the values matters and the result is well mixed.
+inline size_t hash_combine(size_t seed, size_t hash_value)
+{
+	return static_cast<size_t>(hash_detail::mum(seed ^ hash_detail::WY_SECRET_0, hash_value ^ hash_detail::WY_SECRET_1));
+}
+
+// ----------------------------------------------------------------------------
+
+/// Hasher for integers, enums and pointers.
+template<typename T>
+struct IntHash
+{
+	static_assert(std::is_integral<T>::value || std::is_enum<T>::value || std::is_pointer<T>::value,
+		"IntHash is for integers, enums and pointers");
+
+	size_t operator()(T value) const
+	{
+		return hash_mix(to_u64(value));
+	}
+
+private:
+	template<typename U>
+	static uint64_t to_u64(U* ptr) { return static_cast<uint64_t>(reinterpret_cast<uintptr_t>(ptr)); }
+
+	template<typename U>
+	static uint64_t to_u64(U value) { return static_cast<uint64_t>(value); }
+};
+
+/// Hasher for strings. Also accepts C strings, so it works with HashMap:s heterogenous lookup.
+struct StringHash
+{
+	size_t operator()(const std::string& str) const
+	{
+		return static_cast<size_t>(hash_bytes(str.data(), str.size()));
+	}
+
+	size_t operator()(const char* str) const
+	{
+		return static_cast<size_t>(hash_bytes(str, std::strlen(str)));
+	}
+};
+
+/// A good default hasher.
+/// Integers, enums and pointers use IntHash, strings use StringHash,
+/// std::pair and std::tuple combine the Hash of their members.
+/// Anything else falls back to std::hash<T>, followed by hash_mix.
+template<typename T, typename Enable = void>
+struct Hash
+{
+	size_t operator()(const T& value) const
+	{
+		return hash_mix(std::hash<T>()(value));
+	}
+};
+
+template<typename T>
+struct Hash<T, typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value || std::is_pointer<T>::value>::type>
+	: IntHash<T> { };
+
+template<>
+struct Hash<std::string> : StringHash { };
+
+/// Hash any number of values with emilib::Hash and combine the results.
+/// Example:
+///     struct Foo { int a; std::string b; };
+///     struct FooHash { size_t operator()(const Foo& f) const { return emilib::hash_members(f.a, f.b); } };
+inline size_t hash_members()
+{
+	return 0;
+}
+
+template<typename T, typename... Rest>
+size_t hash_members(const T& first, const Rest&... rest)
+{
+	return hash_combine(Hash<T>()(first), hash_members(rest...));
+}
+
+template<typename A, typename B>
+struct Hash<std::pair<A, B>>
+{
+	size_t operator()(const std::pair<A, B>& pair) const
+	{
+		return hash_members(pair.first, pair.second);
+	}
+};
+
+template<typename... Types>
+struct Hash<std::tuple<Types...>>
+{
+	size_t operator()(const std::tuple<Types...>& tuple) const
+	{
+		return hash_tuple(tuple, std::index_sequence_for<Types...>());
+	}
+
+private:
+	template<size_t... Indices>
+	static size_t hash_tuple(const std::tuple<Types...>& tuple, std::index_sequence<Indices...>)
+	{
+		return hash_members(std::get<Indices>(tuple)...);
+	}
+};
+
+} // namespace emilib
@@ -6,12 +6,18 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cstdlib>
 #include <iterator>
+#include <tuple>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 #include <loguru.hpp>
 
+#include "hash_policy.hpp"
+
 namespace emilib {
 
 /// like std::equal_to but no need to #include <functional>
@@ -24,19 +30,161 @@ struct HashMapEqualTo
 	}
 };
 
-/// A cache-friendly hash table with open addressing, linear probing and power-of-two capacity
-template <typename KeyT, typename ValueT, typename HashT = std::hash<KeyT>, typename EqT = HashMapEqualTo<KeyT>>
+namespace hash_detail {
+
+/// HashMap element storage: one array of std::pair<KeyT, ValueT>.
+/// A storage is a plain handle: HashMap decides when to allocate, construct, destroy and deallocate.
+template<typename KeyT, typename ValueT>
+class PairStorage
+{
+public:
+	using PairT           = std::pair<KeyT, ValueT>;
+	using reference       = PairT&;
+	using const_reference = const PairT&;
+	using pointer         = PairT*;
+	using const_pointer   = const PairT*;
+
+	template<typename Allocator>
+	bool allocate(size_t num_buckets, Allocator& allocator)
+	{
+		_pairs = (PairT*)allocator.allocate(num_buckets * sizeof(PairT));
+		return _pairs != nullptr;
+	}
+
+	template<typename Allocator>
+	void deallocate(size_t num_buckets, Allocator& allocator)
+	{
+		allocator.deallocate(_pairs, num_buckets * sizeof(PairT));
+		_pairs = nullptr;
+	}
+
+	KeyT&           key(size_t bucket)   const { return _pairs[bucket].first;  }
+	ValueT&         value(size_t bucket) const { return _pairs[bucket].second; }
+	reference       ref(size_t bucket)   const { return _pairs[bucket];        }
+	const_reference cref(size_t bucket)  const { return _pairs[bucket];        }
+	pointer         ptr(size_t bucket)   const { return _pairs + bucket;       }
+	const_pointer   cptr(size_t bucket)  const { return _pairs + bucket;       }
+
+	template<typename K, typename ValueArgs>
+	void construct(size_t bucket, K&& key, ValueArgs&& value_args) const
+	{
+		new(_pairs + bucket) PairT(std::piecewise_construct,
+			std::forward_as_tuple(std::forward<K>(key)), std::forward<ValueArgs>(value_args));
+	}
+
+	/// Move-construct from src. The source element is NOT destroyed.
+	void move_construct(size_t bucket, const PairStorage& src, size_t src_bucket) const
+	{
+		new(_pairs + bucket) PairT(std::move(src._pairs[src_bucket]));
+	}
+
+	void destroy(size_t bucket) const
+	{
+		_pairs[bucket].~PairT();
+	}
+
+private:
+	PairT* _pairs = nullptr;
+};
+
+/// Returned by operator-> of iterators that return proxy references.
+template<typename Reference>
+struct ArrowProxy
+{
+	Reference ref;
+	const Reference* operator->() const { return &ref; }
+};
+
+/// HashMap element storage: keys and values in separate arrays (HashPolicy::split_storage).
+/// Iterators return std::pair:s of references into the two arrays.
+template<typename KeyT, typename ValueT>
+class SplitStorage
+{
+public:
+	using reference       = std::pair<const KeyT&, ValueT&>;
+	using const_reference = std::pair<const KeyT&, const ValueT&>;
+	using pointer         = ArrowProxy<reference>;
+	using const_pointer   = ArrowProxy<const_reference>;
+
+	template<typename Allocator>
+	bool allocate(size_t num_buckets, Allocator& allocator)
+	{
+		_keys   = (KeyT*)allocator.allocate(num_buckets * sizeof(KeyT));
+		_values = (ValueT*)allocator.allocate(num_buckets * sizeof(ValueT));
+		if (!_keys || !_values) {
+			deallocate(num_buckets, allocator);
+			return false;
+		}
+		return true;
+	}
+
+	template<typename Allocator>
+	void deallocate(size_t num_buckets, Allocator& allocator)
+	{
+		allocator.deallocate(_keys, num_buckets * sizeof(KeyT));
+		allocator.deallocate(_values, num_buckets * sizeof(ValueT));
+		_keys   = nullptr;
+		_values = nullptr;
+	}
+
+	KeyT&           key(size_t bucket)   const { return _keys[bucket];   }
+	ValueT&         value(size_t bucket) const { return _values[bucket]; }
+	reference       ref(size_t bucket)   const { return reference(_keys[bucket], _values[bucket]);       }
+	const_reference cref(size_t bucket)  const { return const_reference(_keys[bucket], _values[bucket]); }
+	pointer         ptr(size_t bucket)   const { return pointer{ref(bucket)};   }
+	const_pointer   cptr(size_t bucket)  const { return const_pointer{cref(bucket)}; }
+
+	template<typename K, typename ValueArgs>
+	void construct(size_t bucket, K&& key, ValueArgs&& value_args) const
+	{
+		new(_keys + bucket) KeyT(std::forward<K>(key));
+		try {
+			construct_from_tuple(_values + bucket, std::forward<ValueArgs>(value_args));
+		} catch (...) {
+			_keys[bucket].~KeyT();
+			throw;
+		}
+	}
+
+	/// Move-construct from src. The source element is NOT destroyed.
+	void move_construct(size_t bucket, const SplitStorage& src, size_t src_bucket) const
+	{
+		new(_keys + bucket) KeyT(std::move(src._keys[src_bucket]));
+		new(_values + bucket) ValueT(std::move(src._values[src_bucket]));
+	}
+
+	void destroy(size_t bucket) const
+	{
+		_keys[bucket].~KeyT();
+		_values[bucket].~ValueT();
+	}
+
+private:
+	KeyT*   _keys   = nullptr;
+	ValueT* _values = nullptr;
+};
+
+} // namespace hash_detail
+
+/// A cache-friendly hash table with open addressing, linear probing and power-of-two capacity.
+/// See HashPolicy for compile-time options.
+template <typename KeyT, typename ValueT, typename HashT = std::hash<KeyT>, typename EqT = HashMapEqualTo<KeyT>, typename PolicyT = HashPolicy>
 class HashMap
 {
 private:
-	using MyType = HashMap<KeyT, ValueT, HashT, EqT>;
+	using MyType = HashMap<KeyT, ValueT, HashT, EqT, PolicyT>;
 
 	using PairT = std::pair<KeyT, ValueT>;
+
+	using StorageT = typename std::conditional<PolicyT::split_storage,
+		hash_detail::SplitStorage<KeyT, ValueT>,
+		hash_detail::PairStorage<KeyT, ValueT>>::type;
 public:
+	using allocator_type  = typename PolicyT::Allocator;
 	using size_type       = size_t;
 	using value_type      = PairT;
-	using reference       = PairT&;
-	using const_reference = const PairT&;
+	using reference       = typename StorageT::reference;
+	using const_reference = typename StorageT::const_reference;
 
 	class iterator
 	{
@@ -45,8 +193,8 @@ public:
 		using difference_type   = size_t;
 		using distance_type     = size_t;
 		using value_type        = std::pair<KeyT, ValueT>;
-		using pointer           = value_type*;
-		using reference         = value_type&;
+		using pointer           = typename StorageT::pointer;
+		using reference         = typename StorageT::reference;
 
 		iterator() { }
 
@@ -69,12 +217,14 @@ public:
 
 		reference operator*() const
 		{
-			return _map->_pairs[_bucket];
+			size_t bucket = _bucket;
+			return _map->storage_at(&bucket).ref(bucket);
 		}
 
 		pointer operator->() const
 		{
-			return _map->_pairs + _bucket;
+			size_t bucket = _bucket;
+			return _map->storage_at(&bucket).ptr(bucket);
 		}
 
 		bool operator==(const iterator& rhs) const
@@ -92,10 +242,8 @@ public:
 	private:
 		void goto_next_element()
 		{
-			DCHECK_LT_F(_bucket, _map->_num_buckets);
-			do {
-				_bucket++;
-			} while (_bucket < _map->_num_buckets && _map->_states[_bucket] != State::FILLED);
+			DCHECK_LT_F(_bucket, _map->end_bucket());
+			_bucket = _map->next_filled_bucket(_bucket + 1);
 		}
 
 	//private:
@@ -112,8 +260,8 @@ public:
 		using difference_type   = size_t;
 		using distance_type     = size_t;
 		using value_type        = const std::pair<KeyT, ValueT>;
-		using pointer           = value_type*;
-		using reference         = value_type&;
+		using pointer           = typename StorageT::const_pointer;
+		using reference         = typename StorageT::const_reference;
 
 		const_iterator() { }
 
@@ -140,12 +288,14 @@ public:
 
 		reference operator*() const
 		{
-			return _map->_pairs[_bucket];
+			size_t bucket = _bucket;
+			return _map->storage_at(&bucket).cref(bucket);
 		}
 
 		pointer operator->() const
 		{
-			return _map->_pairs + _bucket;
+			size_t bucket = _bucket;
+			return _map->storage_at(&bucket).cptr(bucket);
 		}
 
 		bool operator==(const const_iterator& rhs) const
@@ -163,10 +313,8 @@ public:
 	private:
 		void goto_next_element()
 		{
-			DCHECK_LT_F(_bucket, _map->_num_buckets);
-			do {
-				_bucket++;
-			} while (_bucket < _map->_num_buckets && _map->_states[_bucket] != State::FILLED);
+			DCHECK_LT_F(_bucket, _map->end_bucket());
+			_bucket = _map->next_filled_bucket(_bucket + 1);
 		}
 
 	//private:
@@ -180,9 +328,11 @@ public:
 
 	HashMap() = default;
 
-	HashMap(const HashMap& other)
+	/// Use a copy of this allocator for all bucket arrays.
+	explicit HashMap(const allocator_type& allocator) : _allocator(allocator) { }
+
+	HashMap(const HashMap& other) : _allocator(other._allocator), _max_load_factor(other._max_load_factor)
 	{
-		reserve(other.size());
 		insert(other.cbegin(), other.cend());
 	}
 
@@ -193,8 +343,9 @@ public:
 
 	HashMap& operator=(const HashMap& other)
 	{
+		if (this == &other) { return *this; }
 		clear();
-		reserve(other.size());
+		_max_load_factor = other._max_load_factor;
 		insert(other.cbegin(), other.cend());
 		return *this;
 	}
@@ -207,44 +358,37 @@ public:
 	~HashMap()
 	{
 		for (size_t bucket=0; bucket<_num_buckets; ++bucket) {
-			if (_states[bucket] == State::FILLED) {
-				_pairs[bucket].~PairT();
+			if (hash_detail::is_filled(_states[bucket])) {
+				_storage.destroy(bucket);
 			}
 		}
-		free(_states);
-		free(_pairs);
+		deallocate_table();
+		delete _old;
 	}
 
 	void swap(HashMap& other)
 	{
 		std::swap(_hasher,           other._hasher);
 		std::swap(_eq,               other._eq);
-		std::swap(_states,           other._states);
-		std::swap(_pairs,            other._pairs);
-		std::swap(_num_buckets,      other._num_buckets);
-		std::swap(_num_filled,       other._num_filled);
-		std::swap(_max_probe_length, other._max_probe_length);
-		std::swap(_mask,             other._mask);
+		std::swap(_allocator,        other._allocator);
+		std::swap(_max_load_factor,  other._max_load_factor);
+		std::swap(_old,              other._old);
+		std::swap(_rehash_pos,       other._rehash_pos);
+		std::swap(_num_rehashes,     other._num_rehashes);
+		std::swap(_rehash_seconds,   other._rehash_seconds);
+		swap_tables(other);
 	}
 
 	// -------------------------------------------------------------
 
 	iterator begin()
 	{
-		size_t bucket = 0;
-		while (bucket<_num_buckets && _states[bucket] != State::FILLED) {
-			++bucket;
-		}
-		return iterator(this, bucket);
+		return iterator(this, next_filled_bucket(0));
 	}
 
 	const_iterator cbegin() const
 	{
-		size_t bucket = 0;
-		while (bucket<_num_buckets && _states[bucket] != State::FILLED) {
-			++bucket;
-		}
-		return const_iterator(this, bucket);
+		return const_iterator(this, next_filled_bucket(0));
 	}
 
 	const_iterator begin() const
@@ -254,12 +398,12 @@ public:
 
 	iterator end()
 	{
-		return iterator(this, _num_buckets);
+		return iterator(this, end_bucket());
 	}
 
 	const_iterator cend() const
 	{
-		return const_iterator(this, _num_buckets);
+		return const_iterator(this, end_bucket());
 	}
 
 	const_iterator end() const
@@ -267,14 +411,63 @@ public:
 		return cend();
 	}
 
+	/// The elements in the buckets [bucket_begin, bucket_end), for a range-based for loop.
+	/// Split [0, bucket_count()) into slices to process the map in chunks, e.g. on several threads.
+	/// While rehashing incrementally the buckets of the old table come after bucket_count(),
+	/// and bucket_end is clamped, so end the last slice with (size_t)-1.
+	IteratorRange<iterator> bucket_range(size_t bucket_begin, size_t bucket_end)
+	{
+		bucket_end = std::min(bucket_end, end_bucket());
+		bucket_begin = std::min(bucket_begin, bucket_end);
+		return {iterator(this, next_filled_bucket(bucket_begin)), iterator(this, next_filled_bucket(bucket_end))};
+	}
+
+	IteratorRange<const_iterator> bucket_range(size_t bucket_begin, size_t bucket_end) const
+	{
+		bucket_end = std::min(bucket_end, end_bucket());
+		bucket_begin = std::min(bucket_begin, bucket_end);
+		return {const_iterator(this, next_filled_bucket(bucket_begin)), const_iterator(this, next_filled_bucket(bucket_end))};
+	}
+
+	/// Calls fn(*it) for every element, splitting the buckets into slices that run on the threads of pool
+	/// (an emilib::ThreadPool; include parallel.hpp to use this).
+	/// Returns when all elements are done. fn may modify the values, but must not insert or erase.
+	/// Small maps are done on the calling thread.
+	template<typename Func>
+	void for_each_parallel(ThreadPool& pool, const Func& fn)
+	{
+		const size_t num_buckets = end_bucket();
+		const size_t num_jobs = hash_detail::num_parallel_jobs(num_buckets);
+		hash_detail::run_parallel(pool, num_jobs, [&](size_t job) {
+			for (auto&& element : bucket_range(num_buckets * job / num_jobs, num_buckets * (job + 1) / num_jobs)) {
+				fn(element);
+			}
+		});
+	}
+
+	template<typename Func>
+	void for_each_parallel(ThreadPool& pool, const Func& fn) const
+	{
+		const size_t num_buckets = end_bucket();
+		const size_t num_jobs = hash_detail::num_parallel_jobs(num_buckets);
+		hash_detail::run_parallel(pool, num_jobs, [&](size_t job) {
+			for (auto&& element : bucket_range(num_buckets * job / num_jobs, num_buckets * (job + 1) / num_jobs)) {
+				fn(element);
+			}
+		});
+	}
+
 	size_t size() const
 	{
+		if (PolicyT::incremental_rehash && _old) {
+			return _num_filled + _old->_num_filled;
+		}
 		return _num_filled;
 	}
 
 	bool empty() const
 	{
-		return _num_filled==0;
+		return size()==0;
 	}
 
 	// Returns the number of buckets.
@@ -289,6 +482,23 @@ public:
 		return static_cast<float>(_num_filled) / static_cast<float>(_num_buckets);
 	}
 
+	allocator_type get_allocator() const { return _allocator; }
+
+	/// Probe lengths, tombstones, clusters etc, for finding out why a map is slow.
+	/// O(N), and calls HashT for every element (unless the policy has robin_hood or store_hash).
+	/// While rehashing incrementally, this covers both the new and the old table.
+	HashTableStats stats() const
+	{
+		HashTableStats stats;
+		add_stats(&stats);
+		if (is_rehashing()) {
+			_old->add_stats(&stats);
+		}
+		stats.num_rehashes   = _num_rehashes;
+		stats.rehash_seconds = _rehash_seconds;
+		return stats;
+	}
+
 	// ------------------------------------------------------------
 
 	template<typename KeyLike>
@@ -330,7 +540,7 @@ public:
 	{
 		auto bucket = find_filled_bucket(k);
 		if (bucket != (size_t)-1) {
-			return &_pairs[bucket].second;
+			return &value_at(bucket);
 		} else {
 			return nullptr;
 		}
@@ -342,7 +552,7 @@ public:
 	{
 		auto bucket = find_filled_bucket(k);
 		if (bucket != (size_t)-1) {
-			return &_pairs[bucket].second;
+			return &value_at(bucket);
 		} else {
 			return nullptr;
 		}
@@ -360,6 +570,84 @@ public:
 		}
 	}
 
+	/// Like find, but with a precomputed hash_value, which MUST be equal to HashT()(key).
+	/// Useful if you already have the hash, e.g. from a HashCache.
+	template<typename KeyLike>
+	iterator find_with_hash(const KeyLike& key, size_t hash_value)
+	{
+		auto bucket = find_filled_bucket_with_hash(key, hash_detail::post_mix<PolicyT>(hash_value));
+		if (bucket == (size_t)-1) {
+			return this->end();
+		}
+		return iterator(this, bucket);
+	}
+
+	/// Const version of the above
+	template<typename KeyLike>
+	const_iterator find_with_hash(const KeyLike& key, size_t hash_value) const
+	{
+		auto bucket = find_filled_bucket_with_hash(key, hash_detail::post_mix<PolicyT>(hash_value));
+		if (bucket == (size_t)-1) {
+			return this->end();
+		}
+		return const_iterator(this, bucket);
+	}
+
+	/// Like try_get, but with a precomputed hash_value, which MUST be equal to HashT()(key).
+	template<typename KeyLike>
+	ValueT* try_get_with_hash(const KeyLike& key, size_t hash_value)
+	{
+		auto bucket = find_filled_bucket_with_hash(key, hash_detail::post_mix<PolicyT>(hash_value));
+		return bucket == (size_t)-1 ? nullptr : &value_at(bucket);
+	}
+
+	/// Const version of the above
+	template<typename KeyLike>
+	const ValueT* try_get_with_hash(const KeyLike& key, size_t hash_value) const
+	{
+		auto bucket = find_filled_bucket_with_hash(key, hash_detail::post_mix<PolicyT>(hash_value));
+		return bucket == (size_t)-1 ? nullptr : &value_at(bucket);
+	}
+
+	/// Look up many keys at once: out_its[i] = find(keys[i]).
+	/// Faster than calling find in a loop on big maps, as the buckets of several keys
+	/// are prefetched in parallel instead of missing the cache one key at a time.
+	template<typename KeyLike>
+	void find_batch(const KeyLike* keys, size_t num_keys, iterator* out_its)
+	{
+		for_each_in_batch(keys, num_keys, [&](size_t i, size_t bucket) {
+			out_its[i] = (bucket == (size_t)-1 ? this->end() : iterator(this, bucket));
+		});
+	}
+
+	/// Const version of the above
+	template<typename KeyLike>
+	void find_batch(const KeyLike* keys, size_t num_keys, const_iterator* out_its) const
+	{
+		for_each_in_batch(keys, num_keys, [&](size_t i, size_t bucket) {
+			out_its[i] = (bucket == (size_t)-1 ? this->end() : const_iterator(this, bucket));
+		});
+	}
+
+	/// Look up many keys at once: out_values[i] = try_get(keys[i]).
+	/// See find_batch.
+	template<typename KeyLike>
+	void try_get_batch(const KeyLike* keys, size_t num_keys, ValueT** out_values)
+	{
+		for_each_in_batch(keys, num_keys, [&](size_t i, size_t bucket) {
+			out_values[i] = (bucket == (size_t)-1 ? nullptr : &value_at(bucket));
+		});
+	}
+
+	/// Const version of the above
+	template<typename KeyLike>
+	void try_get_batch(const KeyLike* keys, size_t num_keys, const ValueT** out_values) const
+	{
+		for_each_in_batch(keys, num_keys, [&](size_t i, size_t bucket) {
+			out_values[i] = (bucket == (size_t)-1 ? nullptr : &value_at(bucket));
+		});
+	}
+
 	// -----------------------------------------------------
 
 	/// Returns a pair consisting of an iterator to the inserted element
@@ -367,41 +655,197 @@ public:
 	/// and a bool denoting whether the insertion took place.
 	std::pair<iterator, bool> insert(const KeyT& key, const ValueT& value)
 	{
-		check_expand_need();
+		return try_emplace(key, value);
+	}
 
-		auto bucket = find_or_allocate(key);
+	/// Same as above, but moves the value into the map.
+	/// Nothing is moved from if the key was already in the map.
+	std::pair<iterator, bool> insert(const KeyT& key, ValueT&& value)
+	{
+		return try_emplace(key, std::move(value));
+	}
 
-		if (_states[bucket] == State::FILLED) {
-			return { iterator(this, bucket), false };
-		} else {
-			_states[bucket] = State::FILLED;
-			new(_pairs + bucket) PairT(key, value);
-			_num_filled++;
-			return { iterator(this, bucket), true };
-		}
+	/// Same as above, but moves the key and value into the map.
+	/// Nothing is moved from if the key was already in the map.
+	std::pair<iterator, bool> insert(KeyT&& key, ValueT&& value)
+	{
+		return try_emplace(std::move(key), std::move(value));
 	}
 
 	std::pair<iterator, bool> insert(const std::pair<KeyT, ValueT>& p)
 	{
-		return insert(p.first, p.second);
+		return try_emplace(p.first, p.second);
 	}
 
-	void insert(const_iterator begin, const_iterator end)
+	std::pair<iterator, bool> insert(std::pair<KeyT, ValueT>&& p)
 	{
-		// TODO: reserve space exactly once.
+		return try_emplace(std::move(p.first), std::move(p.second));
+	}
+
+	/// Insert all elements in [begin, end), reserving space once up front if possible.
+	/// Use std::make_move_iterator to move the elements instead of copying them.
+	template<typename InputIt, typename = typename std::enable_if<
+		std::is_convertible<decltype(*std::declval<InputIt&>()), PairT>::value>::type>
+	void insert(InputIt begin, InputIt end)
+	{
+		using Category = typename std::iterator_traits<InputIt>::iterator_category;
+		if (std::is_base_of<std::forward_iterator_tag, Category>::value) {
+			reserve(_num_filled + static_cast<size_t>(std::distance(begin, end)));
+		}
 		for (; begin != end; ++begin) {
-			insert(begin->first, begin->second);
+			insert(*begin);
+		}
+	}
+
+	/// Like insert(begin, end), but hashes and inserts the elements on the threads of pool
+	/// (an emilib::ThreadPool; include parallel.hpp to use this).
+	///
+	/// Reserves once, then sorts the elements by the top bits of their home bucket, so that each job
+	/// fills its own region of the table without locks. Elements whose probe sequence would run past
+	/// the end of their region are inserted afterwards, on the calling thread.
+	/// As with insert, the first of several elements with the same key wins.
+	/// The result is an ordinary HashMap, laid out like one built by insert.
+	///
+	/// Needs 16 bytes of scratch memory per element.
+	/// Falls back to insert(begin, end) for small inputs and with PolicyT::robin_hood
+	/// (where inserting can move elements between regions).
+	template<typename RandomIt>
+	void insert_parallel(RandomIt begin, RandomIt end, ThreadPool& pool)
+	{
+		const size_t num_elems = static_cast<size_t>(std::distance(begin, end));
+		if (PolicyT::robin_hood || num_elems < 4096) {
+			insert(begin, end);
+			return;
+		}
+
+		finish_rehash();
+		reserve(_num_filled + num_elems);
+
+		const size_t NUM_JOBS = 64; // Both the number of input chunks and of table regions.
+		const size_t num_regions = std::min(NUM_JOBS, _num_buckets / hash_detail::GROUP_WIDTH);
+		size_t region_shift = 0; // home bucket >> region_shift = region
+		while ((_num_buckets >> region_shift) > num_regions) { ++region_shift; }
+		const size_t chunk_size = (num_elems + NUM_JOBS - 1) / NUM_JOBS;
+
+		// Hash everything, and count the elements going to each region from each chunk:
+		std::vector<size_t> hash_values(num_elems);
+		std::vector<size_t> offsets(NUM_JOBS * num_regions, 0); // [chunk * num_regions + region]
+		hash_detail::run_parallel(pool, NUM_JOBS, [&](size_t chunk) {
+			const size_t chunk_end = std::min(num_elems, (chunk + 1) * chunk_size);
+			for (size_t i = chunk * chunk_size; i < chunk_end; ++i) {
+				hash_values[i] = hash_key((*(begin + i)).first);
+				offsets[chunk * num_regions + ((hash_values[i] & _mask) >> region_shift)] += 1;
+			}
+		});
+
+		// Where each chunk starts writing into each region, keeping the input order within a region:
+		std::vector<size_t> region_starts(num_regions + 1);
+		size_t sum = 0;
+		for (size_t region = 0; region < num_regions; ++region) {
+			region_starts[region] = sum;
+			for (size_t chunk = 0; chunk < NUM_JOBS; ++chunk) {
+				const size_t count = offsets[chunk * num_regions + region];
+				offsets[chunk * num_regions + region] = sum;
+				sum += count;
+			}
+		}
+		region_starts[num_regions] = sum;
+
+		std::vector<size_t> order(num_elems); // Element indices, sorted by region
+		hash_detail::run_parallel(pool, NUM_JOBS, [&](size_t chunk) {
+			const size_t chunk_end = std::min(num_elems, (chunk + 1) * chunk_size);
+			for (size_t i = chunk * chunk_size; i < chunk_end; ++i) {
+				order[offsets[chunk * num_regions + ((hash_values[i] & _mask) >> region_shift)]++] = i;
+			}
+		});
+
+		// Fill each region:
+		std::vector<int>    max_probe_lengths(num_regions, _max_probe_length);
+		std::vector<size_t> num_inserted(num_regions, 0);
+		hash_detail::run_parallel(pool, num_regions, [&](size_t region) {
+			const size_t region_end = (region + 1) << region_shift;
+			int& max_probe_length = max_probe_lengths[region];
+			for (size_t j = region_starts[region]; j < region_starts[region + 1]; ++j) {
+				const size_t i = order[j];
+				const size_t hash_value = hash_values[i];
+				const size_t bucket = find_or_allocate_in_region((*(begin + i)).first, hash_value, region_end, &max_probe_length);
+				if (bucket == (size_t)-1) {
+					continue; // Inserted afterwards
+				}
+				if (hash_detail::is_filled(_states[bucket])) {
+					order[j] = (size_t)-1; // Duplicate key
+					continue;
+				}
+				auto&& pair = *(begin + i);
+				_storage.construct(bucket, std::forward<decltype(pair)>(pair).first,
+					std::forward_as_tuple(std::forward<decltype(pair)>(pair).second));
+				set_state(bucket, hash_detail::hash_fragment(hash_value));
+				set_hash(bucket, hash_value);
+				num_inserted[region] += 1;
+				order[j] = (size_t)-1;
+			}
+		});
+
+		for (size_t region = 0; region < num_regions; ++region) {
+			_max_probe_length = std::max(_max_probe_length, max_probe_lengths[region]);
+			_num_filled += num_inserted[region];
+		}
+
+		// The elements that didn't fit in their region:
+		for (size_t index : order) {
+			if (index != (size_t)-1) {
+				insert(*(begin + index));
+			}
 		}
 	}
 
+	/// If the key is not in the map, insert an element with a ValueT constructed from args.
+	/// Otherwise do nothing: neither key nor args are moved from.
+	/// Returns an iterator to the element with this key, and whether it was inserted.
+	template<typename... Args>
+	std::pair<iterator, bool> try_emplace(const KeyT& key, Args&&... args)
+	{
+		return emplace_with_tuple(key, std::forward_as_tuple(std::forward<Args>(args)...));
+	}
+
+	/// Same as above, but moves the key into the map on insertion.
+	template<typename... Args>
+	std::pair<iterator, bool> try_emplace(KeyT&& key, Args&&... args)
+	{
+		return emplace_with_tuple(std::move(key), std::forward_as_tuple(std::forward<Args>(args)...));
+	}
+
+	/// Like std::unordered_map::emplace(key, value), but the key is only copied if inserted.
+	template<typename V>
+	std::pair<iterator, bool> emplace(const KeyT& key, V&& value)
+	{
+		return try_emplace(key, std::forward<V>(value));
+	}
+
+	template<typename V>
+	std::pair<iterator, bool> emplace(KeyT&& key, V&& value)
+	{
+		return try_emplace(std::move(key), std::forward<V>(value));
+	}
+
+	/// Like std::unordered_map::emplace(std::piecewise_construct, key_args, value_args).
+	/// The key is constructed first (it is needed for the lookup), the value only if inserted.
+	template<typename... KeyArgs, typename... ValueArgs>
+	std::pair<iterator, bool> emplace(std::piecewise_construct_t, std::tuple<KeyArgs...> key_args, std::tuple<ValueArgs...> value_args)
+	{
+		return emplace_with_tuple(hash_detail::make_from_tuple<KeyT>(std::move(key_args)), std::move(value_args));
+	}
+
 	/// Same as above, but contains(key) MUST be false
 	void insert_unique(KeyT&& key, ValueT&& value)
 	{
 		DCHECK_F(!contains(key));
 		check_expand_need();
-		auto bucket = find_empty_bucket(key);
-		_states[bucket] = State::FILLED;
-		new(_pairs + bucket) PairT(std::move(key), std::move(value));
+		auto hash_value = hash_key(key);
+		auto bucket = find_empty_bucket(hash_value);
+		construct_in_claimed(bucket, std::move(key), std::forward_as_tuple(std::move(value)));
+		set_state(bucket, hash_detail::hash_fragment(hash_value));
+		set_hash(bucket, hash_value);
 		_num_filled++;
 	}
 
@@ -410,57 +854,52 @@ public:
 		insert_unique(std::move(p.first), std::move(p.second));
 	}
 
-	void insert_or_assign(const KeyT& key, ValueT&& value)
+	/// Insert the value, or assign it to the existing element with this key.
+	/// The value is forwarded, so an rvalue is moved rather than copied.
+	/// Returns an iterator to the element, and true if it was inserted rather than assigned.
+	template<typename V>
+	std::pair<iterator, bool> insert_or_assign(const KeyT& key, V&& value)
 	{
-		check_expand_need();
-
-		auto bucket = find_or_allocate(key);
+		auto result = try_emplace(key, std::forward<V>(value));
+		if (!result.second) {
+			result.first->second = std::forward<V>(value);
+		}
+		return result;
+	}
 
-		// Check if inserting a new value rather than overwriting an old entry
-		if (_states[bucket] == State::FILLED) {
-			_pairs[bucket].second = value;
-		} else {
-			_states[bucket] = State::FILLED;
-			new(_pairs + bucket) PairT(key, value);
-			_num_filled++;
+	/// Same as above, but moves the key into the map on insertion.
+	template<typename V>
+	std::pair<iterator, bool> insert_or_assign(KeyT&& key, V&& value)
+	{
+		auto result = try_emplace(std::move(key), std::forward<V>(value));
+		if (!result.second) {
+			result.first->second = std::forward<V>(value);
 		}
+		return result;
 	}
 
 	/// Return the old value or ValueT() if it didn't exist.
 	ValueT set_get(const KeyT& key, const ValueT& new_value)
 	{
-		check_expand_need();
-
-		auto bucket = find_or_allocate(key);
-
-		// Check if inserting a new value rather than overwriting an old entry
-		if (_states[bucket] == State::FILLED) {
-			ValueT old_value = _pairs[bucket].second;
-			_pairs[bucket] = new_value.second;
-			return old_value;
-		} else {
-			_states[bucket] = State::FILLED;
-			new(_pairs + bucket) PairT(key, new_value);
-			_num_filled++;
+		auto result = try_emplace(key, new_value);
+		if (result.second) {
 			return ValueT();
 		}
+		ValueT old_value = std::move(result.first->second);
+		result.first->second = new_value;
+		return old_value;
 	}
 
 	/// Like std::map<KeyT,ValueT>::operator[].
 	ValueT& operator[](const KeyT& key)
 	{
-		check_expand_need();
-
-		auto bucket = find_or_allocate(key);
-
-		/* Check if inserting a new value rather than overwriting an old entry */
-		if (_states[bucket] != State::FILLED) {
-			_states[bucket] = State::FILLED;
-			new(_pairs + bucket) PairT(key, ValueT());
-			_num_filled++;
-		}
+		return try_emplace(key).first->second;
+	}
 
-		return _pairs[bucket].second;
+	/// Same as above, but moves the key into the map on insertion.
+	ValueT& operator[](KeyT&& key)
+	{
+		return try_emplace(std::move(key)).first->second;
 	}
 
 	// -------------------------------------------------------
@@ -471,9 +910,7 @@ public:
 	{
 		auto bucket = find_filled_bucket(key);
 		if (bucket != (size_t)-1) {
-			_states[bucket] = State::ACTIVE;
-			_pairs[bucket].~PairT();
-			_num_filled -= 1;
+			erase_at(bucket);
 			return true;
 		} else {
 			return false;
@@ -485,22 +922,26 @@ public:
 	iterator erase(iterator it)
 	{
 		DCHECK_EQ_F(it._map, this);
-		DCHECK_LT_F(it._bucket, _num_buckets);
-		_states[it._bucket] = State::ACTIVE;
-		_pairs[it._bucket].~PairT();
-		_num_filled -= 1;
+		DCHECK_LT_F(it._bucket, end_bucket());
+		if (erase_at(it._bucket)) {
+			return it; // Another element was shifted into this bucket
+		}
 		return ++it;
 	}
 
 	/// Remove all elements, keeping full capacity.
 	void clear()
 	{
+		delete _old;
+		_old = nullptr;
 		for (size_t bucket=0; bucket<_num_buckets; ++bucket) {
-			if (_states[bucket] == State::FILLED) {
-				_states[bucket] = State::INACTIVE;
-				_pairs[bucket].~PairT();
+			if (hash_detail::is_filled(_states[bucket])) {
+				_storage.destroy(bucket);
 			}
 		}
+		if (_num_buckets != 0) {
+			std::fill_n(_states, num_state_bytes(_num_buckets), hash_detail::INACTIVE);
+		}
 		_num_filled = 0;
 		_max_probe_length = -1;
 	}
@@ -508,63 +949,361 @@ public:
 	/// Make room for this many elements
 	void reserve(size_t num_elems)
 	{
-		size_t required_buckets = num_elems + num_elems/2 + 1;
+		size_t required_buckets = min_buckets_for(num_elems);
 		if (required_buckets <= _num_buckets) {
 			return;
 		}
-		size_t num_buckets = 4;
+		finish_rehash();
+		rehash_to(num_buckets_for(required_buckets));
+	}
+
+	/// Set the number of buckets to the smallest power of two that is at least num_buckets
+	/// and fits size() elements at max_load_factor(). This can both grow and shrink the table.
+	/// rehash(0) on an empty map frees all memory.
+	void rehash(size_t num_buckets)
+	{
+		finish_rehash();
+		if (_num_filled == 0 && num_buckets == 0) {
+			deallocate_table();
+			_states           = nullptr;
+			_storage          = StorageT();
+			_dists            = nullptr;
+			_hashes           = nullptr;
+			_num_buckets      = 0;
+			_mask             = 0;
+			_max_probe_length = -1;
+			return;
+		}
+		const size_t new_num_buckets = num_buckets_for(std::max(num_buckets, min_buckets_for(_num_filled)));
+		if (new_num_buckets != _num_buckets) {
+			rehash_to(new_num_buckets);
+		}
+	}
+
+	/// Shrink the table to fit the current elements, e.g. after clear() or a lot of erase:s.
+	void shrink_to_fit()
+	{
+		rehash(0);
+	}
+
+	/// The table grows when size() would exceed max_load_factor() * bucket_count().
+	float max_load_factor() const
+	{
+		return _max_load_factor;
+	}
+
+	/// Default is 2/3. Higher saves memory, lower gives shorter probes.
+	/// Must be in (0, 1). Grows the table right away if needed, but never shrinks it (see shrink_to_fit).
+	void max_load_factor(float max_load_factor)
+	{
+		CHECK_F(0.0f < max_load_factor && max_load_factor < 1.0f,
+			"max_load_factor must be in (0, 1), got %f", max_load_factor);
+		_max_load_factor = max_load_factor;
+		reserve(size());
+	}
+
+	/// Only with PolicyT::incremental_rehash:
+	/// are there still elements left in the old table since the last time the map grew?
+	bool is_rehashing() const
+	{
+		return PolicyT::incremental_rehash && _old;
+	}
+
+	/// Only with PolicyT::incremental_rehash:
+	/// move all remaining elements from the old table now, e.g. during a loading screen.
+	void finish_rehash()
+	{
+		if (PolicyT::incremental_rehash && _old) {
+			migrate_some((size_t)-1);
+		}
+	}
+
+private:
+	// We always keep at least one bucket empty, so that lookups of missing keys terminate.
+	size_t min_buckets_for(size_t num_elems) const
+	{
+		return static_cast<size_t>(static_cast<double>(num_elems) / _max_load_factor) + 1;
+	}
+
+	static size_t num_buckets_for(size_t required_buckets)
+	{
+		size_t num_buckets = PolicyT::group_probing ? hash_detail::GROUP_WIDTH : 4;
 		while (num_buckets < required_buckets) { num_buckets *= 2; }
+		return num_buckets;
+	}
 
-		auto new_states = (State*)malloc(num_buckets * sizeof(State));
-		auto new_pairs  = (PairT*)malloc(num_buckets * sizeof(PairT));
+	// Move all elements to a new table with this many buckets.
+	void rehash_to(size_t num_buckets)
+	{
+		if (PolicyT::count_rehashes) {
+			_num_rehashes += 1;
+		}
+		hash_detail::ScopedRehashTimer timer(PolicyT::count_rehashes ? &_rehash_seconds : nullptr);
 
-		if (!new_states || !new_pairs) {
-			free(new_states);
-			free(new_pairs);
+		if (PolicyT::store_hash) {
+			CHECK_LE_F((uint64_t)num_buckets, 0x100000000ull, "store_hash only supports 2^32 buckets");
+		}
+
+		auto new_states = allocate_array<uint8_t>(num_state_bytes(num_buckets));
+		StorageT new_storage;
+		const bool storage_ok = new_storage.allocate(num_buckets, _allocator);
+		auto new_dists  = PolicyT::robin_hood ? allocate_array<uint16_t>(num_buckets) : nullptr;
+		auto new_hashes = PolicyT::store_hash ? allocate_array<uint32_t>(num_buckets) : nullptr;
+
+		if (!new_states || !storage_ok || (PolicyT::robin_hood && !new_dists) || (PolicyT::store_hash && !new_hashes)) {
+			deallocate_array(new_states, num_state_bytes(num_buckets));
+			if (storage_ok) { new_storage.deallocate(num_buckets, _allocator); }
+			deallocate_array(new_dists, num_buckets);
+			deallocate_array(new_hashes, num_buckets);
 			throw std::bad_alloc();
 		}
 
 		//auto old_num_filled  = _num_filled;
 		auto old_num_buckets = _num_buckets;
 		auto old_states      = _states;
-		auto old_pairs       = _pairs;
+		auto old_dists       = _dists;
+		auto old_hashes      = _hashes;
+		auto old_storage     = _storage;
 
 		_num_filled  = 0;
 		_num_buckets = num_buckets;
 		_mask        = _num_buckets - 1;
 		_states      = new_states;
-		_pairs       = new_pairs;
+		_dists       = new_dists;
+		_hashes      = new_hashes;
+		_storage     = new_storage;
 
-		std::fill_n(_states, num_buckets, State::INACTIVE);
+		std::fill_n(_states, num_state_bytes(num_buckets), hash_detail::INACTIVE);
 
 		_max_probe_length = -1;
 
 		for (size_t src_bucket=0; src_bucket<old_num_buckets; src_bucket++) {
-			if (old_states[src_bucket] == State::FILLED) {
-				auto& src_pair = old_pairs[src_bucket];
-
-				auto dst_bucket = find_empty_bucket(src_pair.first);
+			if (hash_detail::is_filled(old_states[src_bucket])) {
+				auto hash_value = PolicyT::store_hash ? old_hashes[src_bucket] : hash_key(old_storage.key(src_bucket));
+				auto dst_bucket = find_empty_bucket(hash_value);
 				DCHECK_NE_F(dst_bucket, (size_t)-1);
-				DCHECK_NE_F(_states[dst_bucket], State::FILLED);
-				_states[dst_bucket] = State::FILLED;
-				new(_pairs + dst_bucket) PairT(std::move(src_pair));
+				DCHECK_F(!hash_detail::is_filled(_states[dst_bucket]));
+				set_state(dst_bucket, old_states[src_bucket]); // The hash fragment
+				set_hash(dst_bucket, hash_value);
+				_storage.move_construct(dst_bucket, old_storage, src_bucket);
 				_num_filled += 1;
 
-				src_pair.~PairT();
+				old_storage.destroy(src_bucket);
 			}
 		}
 
 		//DCHECK_EQ_F(old_num_filled, _num_filled);
 
-		free(old_states);
-		free(old_pairs);
+		deallocate_array(old_states, num_state_bytes(old_num_buckets));
+		old_storage.deallocate(old_num_buckets, _allocator);
+		deallocate_array(old_dists, old_num_buckets);
+		deallocate_array(old_hashes, old_num_buckets);
+	}
+
+	template<typename T>
+	T* allocate_array(size_t count)
+	{
+		return static_cast<T*>(_allocator.allocate(count * sizeof(T)));
+	}
+
+	template<typename T>
+	void deallocate_array(T* ptr, size_t count)
+	{
+		_allocator.deallocate(ptr, count * sizeof(T));
+	}
+
+	void deallocate_table()
+	{
+		deallocate_array(_states, num_state_bytes(_num_buckets));
+		_storage.deallocate(_num_buckets, _allocator);
+		deallocate_array(_dists, _num_buckets);
+		deallocate_array(_hashes, _num_buckets);
 	}
 
-private:
 	// Can we fit another element?
 	void check_expand_need()
 	{
-		reserve(_num_filled + 1);
+		if (!PolicyT::incremental_rehash) {
+			reserve(_num_filled + 1);
+			return;
+		}
+
+		if (_old) {
+			migrate_some(PolicyT::rehash_buckets_per_insert);
+		}
+
+		const size_t num_elems = size() + 1;
+		const size_t required_buckets = min_buckets_for(num_elems);
+		if (required_buckets <= _num_buckets) {
+			return;
+		}
+		finish_rehash(); // Only happens if rehash_buckets_per_insert is too small.
+		if (_num_filled == 0) {
+			rehash_to(num_buckets_for(required_buckets)); // Nothing to move
+			return;
+		}
+
+		// Keep the current table around as _old, and start over with a bigger, empty table:
+		_old = new MyType();
+		_old->_hasher    = _hasher;
+		_old->_eq        = _eq;
+		_old->_allocator = _allocator;
+		swap_tables(*_old);
+		_rehash_pos = 0;
+		rehash_to(num_buckets_for(required_buckets));
+	}
+
+	// Incremental rehash: move elements from _old into this table,
+	// scanning at most max_buckets buckets of _old. Deletes _old when it is empty.
+	void migrate_some(size_t max_buckets)
+	{
+		hash_detail::ScopedRehashTimer timer(PolicyT::count_rehashes ? &_rehash_seconds : nullptr);
+		for (size_t i=0; i<max_buckets && _rehash_pos<_old->_num_buckets; ++i) {
+			if (!hash_detail::is_filled(_old->_states[_rehash_pos])) {
+				++_rehash_pos;
+				continue;
+			}
+
+			auto hash_value = PolicyT::store_hash ? _old->_hashes[_rehash_pos] : hash_key(_old->_storage.key(_rehash_pos));
+			auto dst_bucket = find_empty_bucket(hash_value);
+			_storage.move_construct(dst_bucket, _old->_storage, _rehash_pos);
+			set_state(dst_bucket, _old->_states[_rehash_pos]); // The hash fragment
+			set_hash(dst_bucket, hash_value);
+			_num_filled += 1;
+
+			// With Robin Hood the next element may be shifted into this bucket, so we stay.
+			// That means buckets before _rehash_pos are always empty.
+			if (!_old->erase_bucket(_rehash_pos)) {
+				++_rehash_pos;
+			}
+		}
+
+		if (_rehash_pos == _old->_num_buckets) {
+			DCHECK_EQ_F(_old->_num_filled, 0u);
+			delete _old;
+			_old = nullptr;
+		}
+	}
+
+	void add_stats(HashTableStats* stats) const
+	{
+		hash_detail::add_table_stats(stats, _states, _num_buckets, _max_probe_length, [this](size_t bucket) -> size_t {
+			if (PolicyT::robin_hood) {
+				return (bucket - _dists[bucket]) & _mask;
+			} else if (PolicyT::store_hash) {
+				return _hashes[bucket] & _mask;
+			} else {
+				return hash_key(_storage.key(bucket)) & _mask;
+			}
+		});
+	}
+
+	void swap_tables(HashMap& other)
+	{
+		std::swap(_states,           other._states);
+		std::swap(_storage,          other._storage);
+		std::swap(_dists,            other._dists);
+		std::swap(_hashes,           other._hashes);
+		std::swap(_num_buckets,      other._num_buckets);
+		std::swap(_num_filled,       other._num_filled);
+		std::swap(_max_probe_length, other._max_probe_length);
+		std::swap(_mask,             other._mask);
+	}
+
+	// While rehashing incrementally, iterators and lookups use one bucket index space for both tables:
+	// [0, _num_buckets) is this table and [_num_buckets, end_bucket()) is _old.
+	size_t end_bucket() const
+	{
+		return is_rehashing() ? _num_buckets + _old->_num_buckets : _num_buckets;
+	}
+
+	// The first filled bucket index at or after bucket, or end_bucket().
+	size_t next_filled_bucket(size_t bucket) const
+	{
+		if (bucket < _num_buckets) {
+			bucket = hash_detail::find_filled(_states, bucket, _num_buckets);
+		}
+		if (bucket < _num_buckets || !is_rehashing()) {
+			return bucket;
+		}
+		return _num_buckets + hash_detail::find_filled(_old->_states, bucket - _num_buckets, _old->_num_buckets);
+	}
+
+	bool is_filled_at(size_t bucket) const
+	{
+		if (!PolicyT::incremental_rehash || bucket < _num_buckets) {
+			return hash_detail::is_filled(_states[bucket]);
+		}
+		return hash_detail::is_filled(_old->_states[bucket - _num_buckets]);
+	}
+
+	// Returns the storage of this bucket index, and makes *bucket relative to it.
+	const StorageT& storage_at(size_t* bucket) const
+	{
+		if (!PolicyT::incremental_rehash || *bucket < _num_buckets) {
+			return _storage;
+		}
+		*bucket -= _num_buckets;
+		return _old->_storage;
+	}
+
+	ValueT& value_at(size_t bucket)
+	{
+		return storage_at(&bucket).value(bucket);
+	}
+
+	const ValueT& value_at(size_t bucket) const
+	{
+		return storage_at(&bucket).value(bucket);
+	}
+
+	// Returns true if another element was moved into the bucket.
+	bool erase_at(size_t bucket)
+	{
+		if (!PolicyT::incremental_rehash || bucket < _num_buckets) {
+			return erase_bucket(bucket);
+		}
+		return _old->erase_bucket(bucket - _num_buckets);
+	}
+
+	template<typename KeyLike>
+	size_t hash_key(const KeyLike& key) const
+	{
+		return hash_detail::post_mix<PolicyT>(_hasher(key));
+	}
+
+	// With group probing we keep a copy of the first GROUP_WIDTH-1 control bytes
+	// after the last bucket, so that a group can be loaded from any bucket without wrapping.
+	static size_t num_state_bytes(size_t num_buckets)
+	{
+		return PolicyT::group_probing ? num_buckets + hash_detail::GROUP_WIDTH - 1 : num_buckets;
+	}
+
+	void set_state(size_t bucket, uint8_t state)
+	{
+		_states[bucket] = state;
+		if (PolicyT::group_probing && bucket < hash_detail::GROUP_WIDTH - 1) {
+			_states[_num_buckets + bucket] = state;
+		}
+	}
+
+	// With store_hash we keep the low 32 bits of the hash, which is enough to find the bucket
+	// (together with the hash fragment in the control byte we can rehash without calling HashT).
+	void set_hash(size_t bucket, size_t hash_value)
+	{
+		if (PolicyT::store_hash) {
+			_hashes[bucket] = static_cast<uint32_t>(hash_value);
+		}
+	}
+
+	// The control byte of the bucket is known to match the hash fragment.
+	template<typename KeyLike>
+	bool key_equals(size_t bucket, const KeyLike& key, size_t hash_value) const
+	{
+		if (PolicyT::store_hash && _hashes[bucket] != static_cast<uint32_t>(hash_value)) {
+			return false;
+		}
+		return _eq(_storage.key(bucket), key);
 	}
 
 	// Find the bucket with this key, or return (size_t)-1
@@ -572,41 +1311,198 @@ private:
 	size_t find_filled_bucket(const KeyLike& key) const
 	{
 		if (empty()) { return (size_t)-1; } // Optimization
+		return find_filled_bucket_with_hash(key, hash_key(key));
+	}
+
+	// Also looks in _old. See end_bucket.
+	template<typename KeyLike>
+	size_t find_filled_bucket_with_hash(const KeyLike& key, size_t hash_value) const
+	{
+		auto bucket = find_in_table(key, hash_value);
+		if (bucket == (size_t)-1 && is_rehashing()) {
+			auto old_bucket = _old->find_in_table(key, hash_value);
+			if (old_bucket != (size_t)-1) {
+				return _num_buckets + old_bucket;
+			}
+		}
+		return bucket;
+	}
+
+	template<typename KeyLike>
+	size_t find_in_table(const KeyLike& key, size_t hash_value) const
+	{
+		if (_num_filled == 0) { return (size_t)-1; } // Optimization
+
+		const uint8_t fragment = hash_detail::hash_fragment(hash_value);
+
+		if (PolicyT::group_probing) {
+			// Most keys are in their home bucket. Checking it first lets the CPU fetch the
+			// key speculatively instead of waiting for the control bytes.
+			auto home = hash_value & _mask;
+			if (_states[home] == fragment && key_equals(home, key, hash_value)) {
+				return home;
+			}
+			uint32_t skip_home = ~1u;
+			for (int offset=0; offset<=_max_probe_length; offset += hash_detail::GROUP_WIDTH) {
+				auto group_start = (hash_value + offset) & _mask;
+				const hash_detail::HashGroup group(_states + group_start);
+				auto in_range = hash_detail::group_probe_mask(offset, _max_probe_length);
+				for (auto matches = group.match(fragment) & in_range & skip_home; matches; matches &= matches - 1) {
+					auto bucket = (group_start + hash_detail::lowest_bit_index(matches)) & _mask;
+					if (key_equals(bucket, key, hash_value)) {
+						return bucket;
+					}
+				}
+				if (group.match(hash_detail::INACTIVE) & in_range) {
+					return (size_t)-1; // End of the chain!
+				}
+				skip_home = ~0u;
+			}
+			return (size_t)-1;
+		}
 
-		auto hash_value = _hasher(key);
 		for (int offset=0; offset<=_max_probe_length; ++offset) {
 			auto bucket = (hash_value + offset) & _mask;
-			if (_states[bucket] == State::FILLED) {
-				if (_eq(_pairs[bucket].first, key)) {
+			if (_states[bucket] == fragment) {
+				if (key_equals(bucket, key, hash_value)) {
 					return bucket;
 				}
-			} else if (_states[bucket] == State::INACTIVE) {
+			} else if (_states[bucket] == hash_detail::INACTIVE) {
 				return (size_t)-1; // End of the chain!
 			}
+			if (PolicyT::robin_hood && _dists[bucket] < offset) {
+				return (size_t)-1; // The key would have displaced this richer element.
+			}
 		}
 		return (size_t)-1;
 	}
 
+	// Calls on_bucket(i, find_filled_bucket(keys[i])) for each key.
+	// Hashes and prefetches a batch of keys before probing for any of them.
+	template<typename KeyLike, typename Callback>
+	void for_each_in_batch(const KeyLike* keys, size_t num_keys, const Callback& on_bucket) const
+	{
+		const size_t BATCH_SIZE = 16;
+		size_t hash_values[BATCH_SIZE];
+		for (size_t batch_start = 0; batch_start < num_keys; batch_start += BATCH_SIZE) {
+			const size_t batch_size = std::min(BATCH_SIZE, num_keys - batch_start);
+			if (empty()) {
+				for (size_t i = 0; i < batch_size; ++i) {
+					on_bucket(batch_start + i, (size_t)-1);
+				}
+				continue;
+			}
+			for (size_t i = 0; i < batch_size; ++i) {
+				hash_values[i] = hash_key(keys[batch_start + i]);
+				const size_t bucket = hash_values[i] & _mask;
+				hash_detail::prefetch(_states + bucket);
+				hash_detail::prefetch(&_storage.key(bucket));
+			}
+			for (size_t i = 0; i < batch_size; ++i) {
+				on_bucket(batch_start + i, find_filled_bucket_with_hash(keys[batch_start + i], hash_values[i]));
+			}
+		}
+	}
+
+	// Insert (key, ValueT(value_args...)) unless the key is already in the map.
+	// Nothing is moved from unless the element is inserted.
+	template<typename K, typename ValueArgs>
+	std::pair<iterator, bool> emplace_with_tuple(K&& key, ValueArgs&& value_args)
+	{
+		check_expand_need();
+
+		auto hash_value = hash_key(key);
+		if (is_rehashing()) {
+			auto old_bucket = _old->find_in_table(key, hash_value);
+			if (old_bucket != (size_t)-1) {
+				return { iterator(this, _num_buckets + old_bucket), false };
+			}
+		}
+		auto bucket = find_or_allocate(key, hash_value);
+
+		if (hash_detail::is_filled(_states[bucket])) {
+			return { iterator(this, bucket), false };
+		}
+		construct_in_claimed(bucket, std::forward<K>(key), std::forward<ValueArgs>(value_args));
+		set_state(bucket, hash_detail::hash_fragment(hash_value));
+		set_hash(bucket, hash_value);
+		_num_filled++;
+		return { iterator(this, bucket), true };
+	}
+
+	// Construct an element in a bucket from find_or_allocate or find_empty_bucket. The caller marks it filled.
+	// If the constructor throws, the bucket is left empty, and a Robin Hood cluster that was shifted
+	// forward to make room for it is shifted back.
+	template<typename K, typename ValueArgs>
+	void construct_in_claimed(size_t bucket, K&& key, ValueArgs&& value_args)
+	{
+		try {
+			_storage.construct(bucket, std::forward<K>(key), std::forward<ValueArgs>(value_args));
+		} catch (...) {
+			if (PolicyT::robin_hood) {
+				robin_hood_shift_back(bucket);
+			}
+			throw;
+		}
+	}
+
 	// Find the bucket with this key, or return a good empty bucket to place the key in.
 	// In the latter case, the bucket is expected to be filled.
-	size_t find_or_allocate(const KeyT& key)
+	size_t find_or_allocate(const KeyT& key, size_t hash_value)
 	{
-		auto hash_value = _hasher(key);
+		const uint8_t fragment = hash_detail::hash_fragment(hash_value);
+
+		if (PolicyT::robin_hood) {
+			for (int offset=0; ; ++offset) {
+				auto bucket = (hash_value + offset) & _mask;
+				if (!hash_detail::is_filled(_states[bucket]) || _dists[bucket] < offset) {
+					return robin_hood_claim(bucket, offset);
+				}
+				if (_states[bucket] == fragment && key_equals(bucket, key, hash_value)) {
+					return bucket;
+				}
+			}
+		}
+
 		size_t hole = (size_t)-1;
 		int offset=0;
-		for (; offset<=_max_probe_length; ++offset) {
-			auto bucket = (hash_value + offset) & _mask;
 
-			if (_states[bucket] == State::FILLED) {
-				if (_eq(_pairs[bucket].first, key)) {
-					return bucket;
+		if (PolicyT::group_probing) {
+			for (; offset<=_max_probe_length; offset += hash_detail::GROUP_WIDTH) {
+				auto group_start = (hash_value + offset) & _mask;
+				const hash_detail::HashGroup group(_states + group_start);
+				auto in_range = hash_detail::group_probe_mask(offset, _max_probe_length);
+				for (auto matches = group.match(fragment) & in_range; matches; matches &= matches - 1) {
+					auto bucket = (group_start + hash_detail::lowest_bit_index(matches)) & _mask;
+					if (key_equals(bucket, key, hash_value)) {
+						return bucket;
+					}
 				}
-			} else if (_states[bucket] == State::INACTIVE) {
-				return bucket;
-			} else {
-				// ACTIVE: keep searching
-				if (hole == (size_t)-1) {
-					hole = bucket;
+				auto not_filled = group.match_not_filled() & in_range;
+				if (hole == (size_t)-1 && not_filled) {
+					// ACTIVE or INACTIVE - either way the key can go here if we don't find it.
+					hole = (group_start + hash_detail::lowest_bit_index(not_filled)) & _mask;
+				}
+				if (group.match(hash_detail::INACTIVE) & in_range) {
+					return hole; // End of the chain!
+				}
+			}
+			offset = _max_probe_length + 1;
+		} else {
+			for (; offset<=_max_probe_length; ++offset) {
+				auto bucket = (hash_value + offset) & _mask;
+
+				if (_states[bucket] == fragment) {
+					if (key_equals(bucket, key, hash_value)) {
+						return bucket;
+					}
+				} else if (_states[bucket] == hash_detail::INACTIVE) {
+					return hole != (size_t)-1 ? hole : bucket;
+				} else if (_states[bucket] == hash_detail::ACTIVE) {
+					// ACTIVE: keep searching
+					if (hole == (size_t)-1) {
+						hole = bucket;
+					}
 				}
 			}
 		}
@@ -623,7 +1519,7 @@ private:
 		for (; ; ++offset) {
 			auto bucket = (hash_value + offset) & _mask;
 
-			if (_states[bucket] != State::FILLED) {
+			if (!hash_detail::is_filled(_states[bucket])) {
 				_max_probe_length = offset;
 				return bucket;
 			}
@@ -631,12 +1527,62 @@ private:
 	}
 
 	// key is not in this map. Find a place to put it.
-	size_t find_empty_bucket(const KeyT& key)
+	// For insert_parallel: like find_or_allocate with linear probing,
+	// but never looks at buckets at or after region_end, and uses its own max_probe_length.
+	// Returns (size_t)-1 if we would need to probe past region_end.
+	size_t find_or_allocate_in_region(const KeyT& key, size_t hash_value, size_t region_end, int* max_probe_length) const
 	{
-		auto hash_value = _hasher(key);
+		const uint8_t fragment = hash_detail::hash_fragment(hash_value);
+		const size_t home = hash_value & _mask;
+		size_t hole = (size_t)-1;
+		for (int offset=0; home + offset < region_end; ++offset) {
+			const size_t bucket = home + offset;
+			const uint8_t state = _states[bucket];
+			if (state == fragment && offset <= *max_probe_length && key_equals(bucket, key, hash_value)) {
+				return bucket;
+			}
+			if (state == hash_detail::ACTIVE && hole == (size_t)-1) {
+				hole = bucket;
+			}
+			if (state == hash_detail::INACTIVE || (hole != (size_t)-1 && offset >= *max_probe_length)) {
+				if (hole == (size_t)-1) {
+					hole = bucket;
+				}
+				*max_probe_length = std::max(*max_probe_length, static_cast<int>(hole - home));
+				return hole;
+			}
+		}
+		return (size_t)-1;
+	}
+
+	size_t find_empty_bucket(size_t hash_value)
+	{
+		if (PolicyT::robin_hood) {
+			for (int offset=0; ; ++offset) {
+				auto bucket = (hash_value + offset) & _mask;
+				if (!hash_detail::is_filled(_states[bucket]) || _dists[bucket] < offset) {
+					return robin_hood_claim(bucket, offset);
+				}
+			}
+		}
+
+		if (PolicyT::group_probing) {
+			for (int offset=0; ; offset += hash_detail::GROUP_WIDTH) {
+				auto group_start = (hash_value + offset) & _mask;
+				auto not_filled = hash_detail::HashGroup(_states + group_start).match_not_filled();
+				if (not_filled) {
+					offset += hash_detail::lowest_bit_index(not_filled);
+					if (offset > _max_probe_length) {
+						_max_probe_length = offset;
+					}
+					return (hash_value + offset) & _mask;
+				}
+			}
+		}
+
 		for (int offset=0; ; ++offset) {
 			auto bucket = (hash_value + offset) & _mask;
-			if (_states[bucket] != State::FILLED) {
+			if (!hash_detail::is_filled(_states[bucket])) {
 				if (offset > _max_probe_length) {
 					_max_probe_length = offset;
 				}
@@ -645,22 +1591,90 @@ private:
 		}
 	}
 
-private:
-	enum class State : uint8_t
+	// Robin Hood: make room for an element at the given probe offset by shifting
+	// the rest of the cluster one step forward. Returns the now unfilled bucket.
+	size_t robin_hood_claim(size_t bucket, int offset)
 	{
-		INACTIVE, // Never been touched
-		ACTIVE,   // Is inside a search-chain, but is empty
-		FILLED    // Is set with key/value
-	};
+		size_t empty = bucket;
+		while (hash_detail::is_filled(_states[empty])) {
+			empty = (empty + 1) & _mask;
+		}
+		for (size_t dst = empty; dst != bucket; ) {
+			size_t src = (dst - 1) & _mask;
+			_storage.move_construct(dst, _storage, src);
+			_storage.destroy(src);
+			set_state(dst, _states[src]);
+			set_dist(dst, _dists[src] + 1);
+			if (PolicyT::store_hash) { _hashes[dst] = _hashes[src]; }
+			dst = src;
+		}
+		set_state(bucket, hash_detail::INACTIVE);
+		set_dist(bucket, offset);
+		return bucket;
+	}
+
+	void set_dist(size_t bucket, int dist)
+	{
+		CHECK_LT_F(dist, 0xFFFF, "Robin Hood probe length overflow - the hash function is broken");
+		_dists[bucket] = static_cast<uint16_t>(dist);
+		if (dist > _max_probe_length) {
+			_max_probe_length = dist;
+		}
+	}
 
-	HashT   _hasher;
-	EqT     _eq;
-	State*  _states           = nullptr;
-	PairT*  _pairs            = nullptr;
-	size_t  _num_buckets      =  0;
-	size_t  _num_filled       =  0;
-	int     _max_probe_length = -1; // Our longest bucket-brigade is this long. ONLY when we have zero elements is this ever negative (-1).
-	size_t  _mask             = 0;  // _num_buckets minus one
+	// Destroy the element in this bucket.
+	// Returns true if another element was moved into the bucket (Robin Hood backward shift).
+	bool erase_bucket(size_t bucket)
+	{
+		_storage.destroy(bucket);
+		_num_filled -= 1;
+
+		if (!PolicyT::robin_hood) {
+			set_state(bucket, hash_detail::ACTIVE);
+			return false;
+		}
+		return robin_hood_shift_back(bucket);
+	}
+
+	// Robin Hood: fill the hole in this (unfilled) bucket by shifting the rest of the cluster
+	// one step back. This undoes robin_hood_claim, and is the backward shift of erase.
+	// Returns true if another element was moved into the bucket.
+	bool robin_hood_shift_back(size_t bucket)
+	{
+		const size_t hole = bucket;
+		for (;;) {
+			size_t next = (bucket + 1) & _mask;
+			if (!hash_detail::is_filled(_states[next]) || _dists[next] == 0) {
+				break;
+			}
+			_storage.move_construct(bucket, _storage, next);
+			_storage.destroy(next);
+			set_state(bucket, _states[next]);
+			_dists[bucket] = _dists[next] - 1;
+			if (PolicyT::store_hash) { _hashes[bucket] = _hashes[next]; }
+			bucket = next;
+		}
+		set_state(bucket, hash_detail::INACTIVE);
+		return bucket != hole;
+	}
+
+private:
+	HashT     _hasher;
+	EqT       _eq;
+	allocator_type _allocator;
+	float     _max_load_factor  = 2.0f / 3.0f;
+	uint8_t*  _states           = nullptr; // One control byte per bucket, see hash_detail.
+	uint16_t* _dists            = nullptr; // Robin Hood only: probe offset of the element in each bucket.
+	uint32_t* _hashes           = nullptr; // store_hash only: low 32 bits of the hash of the key in each bucket.
+	StorageT  _storage;
+	size_t    _num_buckets      =  0;
+	size_t    _num_filled       =  0;
+	int       _max_probe_length = -1; // Our longest bucket-brigade is this long. ONLY when we have zero elements is this ever negative (-1).
+	size_t    _mask             = 0;  // _num_buckets minus one
+	MyType*   _old              = nullptr; // Incremental rehash only: the table we are moving elements from.
+	size_t    _rehash_pos       = 0;       // Incremental rehash only: next bucket in _old to move.
+	size_t    _num_rehashes     = 0;       // count_rehashes only.
+	double    _rehash_seconds   = 0;       // count_rehashes only.
 };
 
 } // namespace emilib
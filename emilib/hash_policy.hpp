@@ -0,0 +1,481 @@
+// By Emil Ernerfeldt 2014-2017
+// LICENSE:
+//   This software is dual-licensed to the public domain and under the following
+//   license: you are granted a perpetual, irrevocable license to copy, modify,
+//   publish, and distribute this file as you see fit.
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifndef EMILIB_HASH_SSE2
+	#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+		#define EMILIB_HASH_SSE2 1
+	#else
+		#define EMILIB_HASH_SSE2 0
+	#endif
+#endif
+
+#if EMILIB_HASH_SSE2
+	#include <emmintrin.h>
+#endif
+
+#include "hash_functions.hpp"
+
+#ifdef _MSC_VER
+	#include <intrin.h>
+#endif
+
+namespace emilib {
+
+class ThreadPool; // See thread_pool.hpp
+
+/// The default HashPolicy::Allocator.
+///
+/// An allocator is any default-constructible and copyable type with these two member functions:
+///     void* allocate(size_t bytes);              // Returns nullptr on failure.
+///     void deallocate(void* ptr, size_t bytes);  // bytes is what was passed to allocate. ptr may be nullptr.
+/// The returned memory must be aligned for any type (like malloc).
+/// HashMap and HashSet allocate all their bucket arrays with it, and keep a copy that you can pass to their constructors,
+/// so a stateful allocator can e.g. point to an arena.
+struct MallocHashAllocator
+{
+	void* allocate(size_t bytes) { return std::malloc(bytes); }
+	void deallocate(void* ptr, size_t /*bytes*/) { std::free(ptr); }
+};
+
+/// Compile-time options for HashMap and HashSet.
+/// Inherit from this and override the members you want to change, e.g.:
+///
+///     struct MyPolicy : emilib::HashPolicy { static constexpr bool group_probing = true; };
+///     emilib::HashSet<int, std::hash<int>, emilib::HashSetEqualTo<int>, MyPolicy> set;
+struct HashPolicy
+{
+	/// Probe 16 buckets at a time, comparing the 7-bit hash fragment stored in each
+	/// control byte so that EqT is only called on likely matches.
+	/// Uses SSE2 when available (see EMILIB_HASH_SSE2).
+	static constexpr bool group_probing = false;
+
+	/// Robin Hood insertion and backward-shift deletion instead of tombstones.
+	/// Probe lengths stay short no matter how many inserts/erases you do,
+	/// at the cost of moving elements on insert and erase, and two extra bytes per bucket.
+	/// NOTE: erasing while iterating may visit an element twice if a cluster wraps around the end of the table.
+	static constexpr bool robin_hood = false;
+
+	/// When HashMap grows, keep the old table and move a few of its buckets to the new table
+	/// on each following insertion, instead of moving all elements at once.
+	/// This bounds the worst-case latency of an insertion, at the cost of lookups
+	/// searching both tables until the move is done.
+	/// Lookups never move elements, so const member functions stay safe to call from many threads.
+	/// Only supported by HashMap.
+	static constexpr bool incremental_rehash = false;
+
+	/// Number of buckets of the old table moved on each insertion when incremental_rehash is on.
+	/// Should be at least 2, so that the move is done before the new table needs to grow again.
+	static constexpr size_t rehash_buckets_per_insert = 8;
+
+	/// HashMap only: store keys and values in two separate arrays instead of one array of std::pair.
+	/// Probing then only touches the keys, which is much faster for big values.
+	/// Iterators return proxies (std::pair<const KeyT&, ValueT&>) instead of real references,
+	/// so use `for (const auto& pair : map)` or `for (auto pair : map)`, not `for (auto& pair : map)`.
+	static constexpr bool split_storage = false;
+
+	/// HashMap only: store 32 bits of the hash of each key in the table (four extra bytes per bucket).
+	/// Growing then never calls HashT, and lookups compare the stored hash before calling EqT.
+	/// Like wrapping your keys in a HashCache, but without changing the key type.
+	/// Limited to 2^32 buckets.
+	static constexpr bool store_hash = false;
+
+	/// Run the result of HashT through hash_mix (see hash_functions.hpp) before using it.
+	/// Costs a multiplication per hash, but makes a weak HashT (like the identity std::hash<int>
+	/// of libstdc++) safe: sequential or strided keys no longer pile up in a few clusters,
+	/// and the hash fragments in the control bytes become useful.
+	/// Hashes passed to e.g. HashMap::find_with_hash should still be HashT()(key).
+	static constexpr bool post_mix_hash = false;
+
+	/// Count the number of times the table grows, and the time spent moving elements,
+	/// in HashTableStats::num_rehashes and HashTableStats::rehash_seconds.
+	/// Costs two clock reads per rehash (and per insertion while rehashing incrementally).
+	static constexpr bool count_rehashes = false;
+
+	/// Used for all bucket arrays (control bytes, elements, Robin Hood distances, stored hashes).
+	/// See MallocHashAllocator for the requirements, and huge_page_allocator.hpp for an alternative.
+	using Allocator = MallocHashAllocator;
+};
+
+/// HashPolicy with group_probing turned on.
+struct GroupProbingHashPolicy : HashPolicy
+{
+	static constexpr bool group_probing = true;
+};
+
+/// HashPolicy with robin_hood turned on.
+struct RobinHoodHashPolicy : HashPolicy
+{
+	static constexpr bool robin_hood = true;
+};
+
+/// HashPolicy with incremental_rehash turned on.
+struct IncrementalRehashHashPolicy : HashPolicy
+{
+	static constexpr bool incremental_rehash = true;
+};
+
+/// HashPolicy with split_storage turned on.
+struct SplitStorageHashPolicy : HashPolicy
+{
+	static constexpr bool split_storage = true;
+};
+
+/// HashPolicy with store_hash turned on.
+struct StoreHashHashPolicy : HashPolicy
+{
+	static constexpr bool store_hash = true;
+};
+
+/// HashPolicy with post_mix_hash turned on.
+struct PostMixHashPolicy : HashPolicy
+{
+	static constexpr bool post_mix_hash = true;
+};
+
+/// HashPolicy with count_rehashes turned on.
+struct CountRehashesHashPolicy : HashPolicy
+{
+	static constexpr bool count_rehashes = true;
+};
+
+/// What HashMap::stats() and HashSet::stats() return: for finding out why a table is slow.
+/// A bad hash shows up as long probe lengths at a low load factor,
+/// tombstone buildup as many num_active, and a too high load factor as long clusters.
+struct HashTableStats
+{
+	size_t num_buckets  = 0;
+	size_t num_filled   = 0; // Buckets with an element.
+	size_t num_active   = 0; // Tombstones: empty buckets that lookups must still probe past.
+	size_t num_inactive = 0; // Never used buckets, where lookups stop.
+
+	int max_probe_length = -1; // Longest allowed probe offset (what lookups of missing keys are limited by).
+
+	/// probe_length_histogram[d] is the number of elements d buckets from their home bucket.
+	std::vector<size_t> probe_length_histogram;
+
+	/// Average number of buckets inspected when looking up a key in the table.
+	double avg_successful_probe_length = 0;
+
+	/// Average number of buckets inspected when looking up a key NOT in the table,
+	/// assuming linear probing that stops at the first INACTIVE bucket
+	/// (group probing and Robin Hood can stop earlier).
+	double avg_unsuccessful_probe_length = 0;
+
+	/// Longest run of consecutive non-INACTIVE (filled or tombstone) buckets.
+	size_t longest_cluster = 0;
+
+	/// Only with HashPolicy::count_rehashes:
+	size_t num_rehashes   = 0; // Number of times the table has grown.
+	double rehash_seconds = 0; // Total time spent moving elements to bigger tables.
+};
+
+/// A pair of iterators, for use in a range-based for loop. See HashMap::bucket_range.
+template<typename IteratorT>
+struct IteratorRange
+{
+	IteratorT _begin;
+	IteratorT _end;
+
+	IteratorT begin() const { return _begin; }
+	IteratorT end()   const { return _end;   }
+};
+
+/// Implementation details shared by HashMap and HashSet.
+namespace hash_detail {
+
+/// Each bucket has a control byte.
+/// 0x00-0x7F means FILLED, and the value is the top 7 bits of the hash of the key in that bucket.
+enum : uint8_t
+{
+	INACTIVE = 0x80, // Never been touched
+	ACTIVE   = 0xFE, // Is inside a search-chain, but is empty
+};
+
+/// Number of control bytes inspected at once by group probing.
+const int GROUP_WIDTH = 16;
+
+inline bool is_filled(uint8_t state)
+{
+	return (state & 0x80) == 0;
+}
+
+/// The top 7 bits of the hash. The low bits are already used for picking the bucket.
+inline uint8_t hash_fragment(size_t hash_value)
+{
+	return static_cast<uint8_t>(hash_value >> (sizeof(size_t) * 8 - 7));
+}
+
+/// What HashMap and HashSet do with the result of HashT, see HashPolicy::post_mix_hash.
+template<typename PolicyT>
+size_t post_mix(size_t hash_value)
+{
+	return PolicyT::post_mix_hash ? hash_mix(hash_value) : hash_value;
+}
+
+/// Index of the lowest set bit. bits must not be zero.
+inline int lowest_bit_index(uint32_t bits)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, bits);
+	return static_cast<int>(index);
+#else
+	return __builtin_ctz(bits);
+#endif
+}
+
+/// Number of set bits.
+inline int popcount(uint32_t bits)
+{
+#ifdef _MSC_VER
+	return static_cast<int>(__popcnt(bits));
+#else
+	return __builtin_popcount(bits);
+#endif
+}
+
+/// Hint the CPU to start fetching this memory into the cache.
+inline void prefetch(const void* ptr)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	__builtin_prefetch(ptr);
+#elif EMILIB_HASH_SSE2
+	_mm_prefetch(static_cast<const char*>(ptr), _MM_HINT_T0);
+#else
+	(void)ptr;
+#endif
+}
+
+/// Bit mask of the buckets in a group starting at probe offset `offset`
+/// that are within `max_probe_length`.
+inline uint32_t group_probe_mask(int offset, int max_probe_length)
+{
+	const int remaining = max_probe_length - offset + 1;
+	return remaining >= GROUP_WIDTH ? 0xFFFFu : (1u << remaining) - 1u;
+}
+
+template<typename T, typename Tuple, size_t... Indices>
+T make_from_tuple(Tuple&& args, std::index_sequence<Indices...>)
+{
+	return T(std::get<Indices>(std::forward<Tuple>(args))...);
+}
+
+/// Like C++17 std::make_from_tuple. Used for piecewise emplace.
+template<typename T, typename Tuple>
+T make_from_tuple(Tuple&& args)
+{
+	using Indices = std::make_index_sequence<std::tuple_size<typename std::decay<Tuple>::type>::value>;
+	return make_from_tuple<T>(std::forward<Tuple>(args), Indices());
+}
+
+template<typename T, typename Tuple, size_t... Indices>
+void construct_from_tuple(T* where, Tuple&& args, std::index_sequence<Indices...>)
+{
+	new(where) T(std::get<Indices>(std::forward<Tuple>(args))...);
+}
+
+/// Placement-new version of make_from_tuple.
+template<typename T, typename Tuple>
+void construct_from_tuple(T* where, Tuple&& args)
+{
+	using Indices = std::make_index_sequence<std::tuple_size<typename std::decay<Tuple>::type>::value>;
+	construct_from_tuple(where, std::forward<Tuple>(args), Indices());
+}
+
+/// Adds the buckets of one table to stats.
+/// home_bucket(bucket) must return the home bucket of the element in a filled bucket.
+template<typename HomeBucketFunc>
+void add_table_stats(HashTableStats* stats, const uint8_t* states, size_t num_buckets,
+                     int max_probe_length, const HomeBucketFunc& home_bucket)
+{
+	const size_t old_num_filled    = stats->num_filled;
+	const size_t old_num_buckets   = stats->num_buckets;
+	double sum_successful_probes   = stats->avg_successful_probe_length   * old_num_filled;
+	double sum_unsuccessful_probes = stats->avg_unsuccessful_probe_length * old_num_buckets;
+
+	stats->num_buckets += num_buckets;
+	stats->max_probe_length = std::max(stats->max_probe_length, max_probe_length);
+	const size_t max_probes = static_cast<size_t>(max_probe_length + 1);
+
+	// Walk backwards from an INACTIVE bucket, so we always know how far it is to the next one.
+	size_t start = 0;
+	while (start < num_buckets && states[start] != INACTIVE) { ++start; }
+	const bool any_inactive = start < num_buckets;
+	size_t run = any_inactive ? 0 : num_buckets; // Non-INACTIVE buckets from here to the next INACTIVE.
+	if (!any_inactive) { start = 0; }
+
+	for (size_t i = 0; i < num_buckets; ++i) {
+		const size_t bucket = (start + num_buckets - i) & (num_buckets - 1);
+		const uint8_t state = states[bucket];
+		if (state == INACTIVE) {
+			stats->num_inactive += 1;
+			run = 0;
+		} else {
+			if (any_inactive) { run += 1; }
+			if (is_filled(state)) {
+				stats->num_filled += 1;
+				const size_t dist = (bucket - home_bucket(bucket)) & (num_buckets - 1);
+				if (stats->probe_length_histogram.size() <= dist) {
+					stats->probe_length_histogram.resize(dist + 1, 0);
+				}
+				stats->probe_length_histogram[dist] += 1;
+				sum_successful_probes += static_cast<double>(dist + 1);
+			} else {
+				stats->num_active += 1;
+			}
+			stats->longest_cluster = std::max(stats->longest_cluster, run);
+		}
+		sum_unsuccessful_probes += static_cast<double>(std::min(run + 1, max_probes));
+	}
+
+	if (stats->num_filled != 0) {
+		stats->avg_successful_probe_length = sum_successful_probes / stats->num_filled;
+	}
+	if (stats->num_buckets != 0) {
+		stats->avg_unsuccessful_probe_length = sum_unsuccessful_probes / stats->num_buckets;
+	}
+}
+
+/// Adds the time until it goes out of scope to *seconds, unless seconds is null.
+class ScopedRehashTimer
+{
+public:
+	explicit ScopedRehashTimer(double* seconds) : _seconds(seconds)
+	{
+		if (_seconds) {
+			_start = std::chrono::steady_clock::now();
+		}
+	}
+
+	~ScopedRehashTimer()
+	{
+		if (_seconds) {
+			*_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+		}
+	}
+
+private:
+	ScopedRehashTimer(const ScopedRehashTimer&) = delete;
+	ScopedRehashTimer& operator=(const ScopedRehashTimer&) = delete;
+
+	double*                               _seconds;
+	std::chrono::steady_clock::time_point _start;
+};
+
+/// GROUP_WIDTH consecutive control bytes.
+/// Each match function returns a bit mask where bit i corresponds to ctrl[i].
+class HashGroup
+{
+public:
+#if EMILIB_HASH_SSE2
+	explicit HashGroup(const uint8_t* ctrl)
+		: _ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl)))
+	{
+	}
+
+	uint32_t match(uint8_t state) const
+	{
+		const __m128i pattern = _mm_set1_epi8(static_cast<char>(state));
+		return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_ctrl, pattern)));
+	}
+
+	/// INACTIVE or ACTIVE, i.e. the high bit is set.
+	uint32_t match_not_filled() const
+	{
+		return static_cast<uint32_t>(_mm_movemask_epi8(_ctrl));
+	}
+
+private:
+	__m128i _ctrl;
+#else
+	explicit HashGroup(const uint8_t* ctrl) : _ctrl(ctrl) { }
+
+	uint32_t match(uint8_t state) const
+	{
+		uint32_t bits = 0;
+		for (int i = 0; i < GROUP_WIDTH; ++i) {
+			bits |= static_cast<uint32_t>(_ctrl[i] == state) << i;
+		}
+		return bits;
+	}
+
+	uint32_t match_not_filled() const
+	{
+		uint32_t bits = 0;
+		for (int i = 0; i < GROUP_WIDTH; ++i) {
+			bits |= static_cast<uint32_t>(_ctrl[i] >> 7) << i;
+		}
+		return bits;
+	}
+
+private:
+	const uint8_t* _ctrl;
+#endif
+};
+
+/// Index of the first filled bucket in [begin, end), or end if there is none.
+/// Inspects many control bytes at a time, so long runs of empty buckets and tombstones are skipped quickly.
+inline size_t find_filled(const uint8_t* states, size_t begin, size_t end)
+{
+#if EMILIB_HASH_SSE2
+	for (; begin + GROUP_WIDTH <= end; begin += GROUP_WIDTH) {
+		const uint32_t filled = ~HashGroup(states + begin).match_not_filled() & 0xFFFFu;
+		if (filled != 0) {
+			return begin + lowest_bit_index(filled);
+		}
+	}
+#else
+	const uint64_t HIGH_BITS = 0x8080808080808080ull; // All eight bytes are INACTIVE or ACTIVE
+	for (; begin + 8 <= end; begin += 8) {
+		uint64_t word;
+		std::memcpy(&word, states + begin, 8);
+		if ((word & HIGH_BITS) != HIGH_BITS) {
+			break;
+		}
+	}
+#endif
+	while (begin < end && !is_filled(states[begin])) {
+		++begin;
+	}
+	return begin;
+}
+
+/// How many slices HashMap::for_each_parallel and HashSet::for_each_parallel split the buckets into.
+inline size_t num_parallel_jobs(size_t num_buckets)
+{
+	const size_t MIN_BUCKETS_PER_JOB = 4096;
+	const size_t MAX_JOBS            = 64;
+	return std::max<size_t>(1, std::min(MAX_JOBS, num_buckets / MIN_BUCKETS_PER_JOB));
+}
+
+/// Calls job(0), job(1), ... job(num_jobs - 1) on the threads of pool and on the calling thread,
+/// and waits for all of them. This is parallel_for with a grain of one job, so it is fine to call
+/// from inside a job of the same pool: the calling thread does whatever jobs no worker has started.
+/// parallel_for is only looked up when this is instantiated, so that the hash containers don't pull in
+/// the thread pool: code that calls for_each_parallel or insert_parallel must include parallel.hpp.
+template<typename Func>
+void run_parallel(ThreadPool& pool, size_t num_jobs, const Func& job)
+{
+	parallel_for(pool, 0, num_jobs, 1, job);
+}
+
+} // namespace hash_detail
+} // namespace emilib
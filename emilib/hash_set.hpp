@@ -6,12 +6,15 @@
 
 #pragma once
 
-#include <cstdlib> // malloc
+#include <algorithm>
 #include <iterator>
 #include <utility>
+#include <vector>
 
 #include <loguru.hpp>
 
+#include "hash_policy.hpp"
+
 namespace emilib {
 
 /// like std::equal_to but no need to `#include <functional>`
@@ -24,14 +27,16 @@ struct HashSetEqualTo
 	}
 };
 
-/// A cache-friendly hash set with open addressing, linear probing and power-of-two capacity
-template <typename KeyT, typename HashT = std::hash<KeyT>, typename EqT = HashSetEqualTo<KeyT>>
+/// A cache-friendly hash set with open addressing, linear probing and power-of-two capacity.
+/// See HashPolicy for compile-time options.
+template <typename KeyT, typename HashT = std::hash<KeyT>, typename EqT = HashSetEqualTo<KeyT>, typename PolicyT = HashPolicy>
 class HashSet
 {
 private:
-	using MyType = HashSet<KeyT, HashT, EqT>;
+	using MyType = HashSet<KeyT, HashT, EqT, PolicyT>;
 
 public:
+	using allocator_type  = typename PolicyT::Allocator;
 	using size_type       = size_t;
 	using value_type      = KeyT;
 	using reference       = KeyT&;
@@ -92,9 +97,7 @@ public:
 		void goto_next_element()
 		{
 			DCHECK_LT_F(_bucket, _set->_num_buckets);
-			do {
-				_bucket++;
-			} while (_bucket < _set->_num_buckets && _set->_states[_bucket] != State::FILLED);
+			_bucket = hash_detail::find_filled(_set->_states, _bucket + 1, _set->_num_buckets);
 		}
 
 	//private:
@@ -163,9 +166,7 @@ public:
 		void goto_next_element()
 		{
 			DCHECK_LT_F(_bucket, _set->_num_buckets);
-			do {
-				_bucket++;
-			} while (_bucket < _set->_num_buckets && _set->_states[_bucket] != State::FILLED);
+			_bucket = hash_detail::find_filled(_set->_states, _bucket + 1, _set->_num_buckets);
 		}
 
 	//private:
@@ -179,10 +180,15 @@ public:
 
 	HashSet() = default;
 
-	HashSet(const HashSet& other)
+	/// Use a copy of this allocator for all bucket arrays.
+	explicit HashSet(const allocator_type& allocator) : _allocator(allocator) { }
+
+	HashSet(const HashSet& other) : _allocator(other._allocator), _max_load_factor(other._max_load_factor)
 	{
 		reserve(other.size());
-		insert(other.cbegin(), other.cend());
+		for (const KeyT& key : other) {
+			insert_unique(key);
+		}
 	}
 
 	HashSet(HashSet&& other)
@@ -192,9 +198,13 @@ public:
 
 	HashSet& operator=(const HashSet& other)
 	{
+		if (this == &other) { return *this; }
 		clear();
+		_max_load_factor = other._max_load_factor;
 		reserve(other.size());
-		insert(other.cbegin(), other.cend());
+		for (const KeyT& key : other) {
+			insert_unique(key);
+		}
 		return *this;
 	}
 
@@ -206,44 +216,42 @@ public:
 	~HashSet()
 	{
 		for (size_t bucket=0; bucket<_num_buckets; ++bucket) {
-			if (_states[bucket] == State::FILLED) {
+			if (hash_detail::is_filled(_states[bucket])) {
 				_keys[bucket].~KeyT();
 			}
 		}
-		free(_states);
-		free(_keys);
+		deallocate_array(_states, num_state_bytes(_num_buckets));
+		deallocate_array(_keys, _num_buckets);
+		deallocate_array(_dists, _num_buckets);
 	}
 
 	void swap(HashSet& other)
 	{
 		std::swap(_hasher,           other._hasher);
 		std::swap(_eq,               other._eq);
+		std::swap(_allocator,        other._allocator);
+		std::swap(_max_load_factor,  other._max_load_factor);
 		std::swap(_states,           other._states);
 		std::swap(_keys,             other._keys);
+		std::swap(_dists,            other._dists);
 		std::swap(_num_buckets,      other._num_buckets);
 		std::swap(_num_filled,       other._num_filled);
 		std::swap(_max_probe_length, other._max_probe_length);
 		std::swap(_mask,             other._mask);
+		std::swap(_num_rehashes,     other._num_rehashes);
+		std::swap(_rehash_seconds,   other._rehash_seconds);
 	}
 
 	// -------------------------------------------------------------
 
 	iterator begin()
 	{
-		size_t bucket = 0;
-		while (bucket<_num_buckets && _states[bucket] != State::FILLED) {
-			++bucket;
-		}
-		return iterator(this, bucket);
+		return iterator(this, hash_detail::find_filled(_states, 0, _num_buckets));
 	}
 
 	const_iterator cbegin() const
 	{
-		size_t bucket = 0;
-		while (bucket<_num_buckets && _states[bucket] != State::FILLED) {
-			++bucket;
-		}
-		return const_iterator(this, bucket);
+		return const_iterator(this, hash_detail::find_filled(_states, 0, _num_buckets));
 	}
 
 	const_iterator begin() const
@@ -266,6 +274,39 @@ public:
 		return cend();
 	}
 
+	/// The elements in the buckets [bucket_begin, bucket_end), for a range-based for loop.
+	/// Split [0, bucket_count()) into slices to process the set in chunks, e.g. on several threads.
+	IteratorRange<iterator> bucket_range(size_t bucket_begin, size_t bucket_end)
+	{
+		bucket_end = std::min(bucket_end, _num_buckets);
+		bucket_begin = std::min(bucket_begin, bucket_end);
+		return {iterator(this, hash_detail::find_filled(_states, bucket_begin, _num_buckets)),
+		        iterator(this, hash_detail::find_filled(_states, bucket_end,   _num_buckets))};
+	}
+
+	IteratorRange<const_iterator> bucket_range(size_t bucket_begin, size_t bucket_end) const
+	{
+		bucket_end = std::min(bucket_end, _num_buckets);
+		bucket_begin = std::min(bucket_begin, bucket_end);
+		return {const_iterator(this, hash_detail::find_filled(_states, bucket_begin, _num_buckets)),
+		        const_iterator(this, hash_detail::find_filled(_states, bucket_end,   _num_buckets))};
+	}
+
+	/// Calls fn(key) for every key, splitting the buckets into slices that run on the threads of pool
+	/// (an emilib::ThreadPool; include parallel.hpp to use this).
+	/// Returns when all keys are done. fn must not insert or erase.
+	/// Small sets are done on the calling thread.
+	template<typename Func>
+	void for_each_parallel(ThreadPool& pool, const Func& fn) const
+	{
+		const size_t num_jobs = hash_detail::num_parallel_jobs(_num_buckets);
+		hash_detail::run_parallel(pool, num_jobs, [&](size_t job) {
+			for (const KeyT& key : bucket_range(_num_buckets * job / num_jobs, _num_buckets * (job + 1) / num_jobs)) {
+				fn(key);
+			}
+		});
+	}
+
 	size_t size() const
 	{
 		return _num_filled;
@@ -288,6 +329,25 @@ public:
 		return static_cast<float>(_num_filled) / static_cast<float>(_num_buckets);
 	}
 
+	allocator_type get_allocator() const { return _allocator; }
+
+	/// Probe lengths, tombstones, clusters etc, for finding out why a set is slow.
+	/// O(N), and calls HashT for every element (unless the policy has robin_hood).
+	HashTableStats stats() const
+	{
+		HashTableStats stats;
+		hash_detail::add_table_stats(&stats, _states, _num_buckets, _max_probe_length, [this](size_t bucket) -> size_t {
+			if (PolicyT::robin_hood) {
+				return (bucket - _dists[bucket]) & _mask;
+			} else {
+				return hash_key(_keys[bucket]) & _mask;
+			}
+		});
+		stats.num_rehashes   = _num_rehashes;
+		stats.rehash_seconds = _rehash_seconds;
+		return stats;
+	}
+
 	// ------------------------------------------------------------
 
 	iterator find(const KeyT& key)
@@ -318,6 +378,50 @@ public:
 		return find_filled_bucket(k) != (size_t)-1 ? 1 : 0;
 	}
 
+	/// Calls fn(key, other.contains(key)) for every key in this set, until fn returns false.
+	/// Returns false if fn did.
+	/// Much faster than calling contains in a loop on big sets: a batch of keys is hashed and their
+	/// buckets in other are prefetched before any of them are probed.
+	template<typename Func>
+	bool for_each_lookup_in(const HashSet& other, const Func& fn) const
+	{
+		const size_t BATCH_SIZE = 16;
+		const KeyT* keys[BATCH_SIZE];
+		size_t hash_values[BATCH_SIZE];
+		size_t batch_size = 0;
+
+		auto probe_batch = [&]() {
+			for (size_t i = 0; i < batch_size; ++i) {
+				if (!fn(*keys[i], other.find_filled_bucket_with_hash(*keys[i], hash_values[i]) != (size_t)-1)) {
+					return false;
+				}
+			}
+			batch_size = 0;
+			return true;
+		};
+
+		for (size_t bucket = hash_detail::find_filled(_states, 0, _num_buckets); bucket < _num_buckets;
+		     bucket = hash_detail::find_filled(_states, bucket + 1, _num_buckets)) {
+			keys[batch_size] = _keys + bucket;
+			if (!other.empty()) {
+				hash_values[batch_size] = other.hash_key(_keys[bucket]);
+				const size_t other_bucket = hash_values[batch_size] & other._mask;
+				hash_detail::prefetch(other._states + other_bucket);
+				hash_detail::prefetch(other._keys + other_bucket);
+			}
+			if (++batch_size == BATCH_SIZE && !probe_batch()) {
+				return false;
+			}
+		}
+		return probe_batch();
+	}
+
+	/// True if every key in this set is also in other.
+	bool is_subset_of(const HashSet& other) const
+	{
+		return size() <= other.size() && for_each_lookup_in(other, [](const KeyT&, bool contained) { return contained; });
+	}
+
 	// -----------------------------------------------------
 
 	/// Insert an element, unless it already exists.
@@ -327,17 +431,7 @@ public:
 	std::pair<iterator, bool> insert(const KeyT& key)
 	{
 		check_expand_need();
-
-		auto bucket = find_or_allocate(key);
-
-		if (_states[bucket] == State::FILLED) {
-			return { iterator(this, bucket), false };
-		} else {
-			_states[bucket] = State::FILLED;
-			new(_keys + bucket) KeyT(key);
-			_num_filled++;
-			return { iterator(this, bucket), true };
-		}
+		return insert_with_room(key);
 	}
 
 	/// Insert an element, unless it already exists.
@@ -347,17 +441,7 @@ public:
 	std::pair<iterator, bool> insert(KeyT&& key)
 	{
 		check_expand_need();
-
-		auto bucket = find_or_allocate(key);
-
-		if (_states[bucket] == State::FILLED) {
-			return { iterator(this, bucket), false };
-		} else {
-			_states[bucket] = State::FILLED;
-			new(_keys + bucket) KeyT(std::move(key));
-			_num_filled++;
-			return { iterator(this, bucket), true };
-		}
+		return insert_with_room(std::move(key));
 	}
 
 	template<class... Args>
@@ -366,9 +450,10 @@ public:
 		return insert(KeyT(std::forward<Args>(args)...));
 	}
 
+	/// Insert all keys in [begin, end), reserving space once up front.
 	void insert(const_iterator begin, const_iterator end)
 	{
-		// TODO: reserve space exactly once.
+		reserve(_num_filled + static_cast<size_t>(std::distance(begin, end)));
 		for (; begin != end; ++begin) {
 			insert(*begin);
 		}
@@ -377,12 +462,8 @@ public:
 	/// Same as above, but contains(key) MUST be false
 	void insert_unique(KeyT key)
 	{
-		DCHECK_F(!contains(key));
 		check_expand_need();
-		auto bucket = find_empty_bucket(key);
-		_states[bucket] = State::FILLED;
-		new(_keys + bucket) KeyT(std::move(key));
-		_num_filled++;
+		insert_unique_with_room(std::move(key));
 	}
 
 	// -------------------------------------------------------
@@ -393,9 +474,7 @@ public:
 	{
 		auto bucket = find_filled_bucket(key);
 		if (bucket != (size_t)-1) {
-			_states[bucket] = State::ACTIVE;
-			_keys[bucket].~KeyT();
-			_num_filled -= 1;
+			erase_bucket(bucket);
 			return true;
 		} else {
 			return false;
@@ -408,21 +487,51 @@ public:
 	{
 		DCHECK_EQ_F(it._set, this);
 		DCHECK_LT_F(it._bucket, _num_buckets);
-		_states[it._bucket] = State::ACTIVE;
-		_keys[it._bucket].~KeyT();
-		_num_filled -= 1;
+		if (erase_bucket(it._bucket)) {
+			return it; // Another element was shifted into this bucket
+		}
 		return ++it;
 	}
 
+	/// Insert all keys of other. Counts the new keys first, so the table grows at most once and no more than needed.
+	void union_with(const HashSet& other)
+	{
+		if (&other == this) { return; }
+		reserve(size() + other.count_missing_in(*this));
+		for (const KeyT& key : other) {
+			insert_with_room(key);
+		}
+	}
+
+	/// Erase all keys that are not in other.
+	void intersect_with(const HashSet& other)
+	{
+		erase_where_lookup_in(other, false);
+	}
+
+	/// Erase all keys that are in other.
+	void subtract(const HashSet& other)
+	{
+		if (other.size() < size() / 2) {
+			for (const KeyT& key : other) {
+				erase(key);
+			}
+		} else {
+			erase_where_lookup_in(other, true);
+		}
+	}
+
 	/// Remove all elements, keeping full capacity.
 	void clear()
 	{
 		for (size_t bucket=0; bucket<_num_buckets; ++bucket) {
-			if (_states[bucket] == State::FILLED) {
-				_states[bucket] = State::INACTIVE;
+			if (hash_detail::is_filled(_states[bucket])) {
 				_keys[bucket].~KeyT();
 			}
 		}
+		if (_num_buckets != 0) {
+			std::fill_n(_states, num_state_bytes(_num_buckets), hash_detail::INACTIVE);
+		}
 		_num_filled = 0;
 		_max_probe_length = -1;
 	}
@@ -430,45 +539,118 @@ public:
 	/// Make room for this many elements
 	void reserve(size_t num_elems)
 	{
-		size_t required_buckets = num_elems + num_elems/2 + 1;
+		size_t required_buckets = min_buckets_for(num_elems);
 		if (required_buckets <= _num_buckets) {
 			return;
 		}
-		size_t num_buckets = 4;
+		rehash_to(num_buckets_for(required_buckets));
+	}
+
+	/// Set the number of buckets to the smallest power of two that is at least num_buckets
+	/// and fits size() elements at max_load_factor(). This can both grow and shrink the table.
+	/// rehash(0) on an empty set frees all memory.
+	void rehash(size_t num_buckets)
+	{
+		if (_num_filled == 0 && num_buckets == 0) {
+			deallocate_array(_states, num_state_bytes(_num_buckets));
+			deallocate_array(_keys, _num_buckets);
+			deallocate_array(_dists, _num_buckets);
+			_states           = nullptr;
+			_keys             = nullptr;
+			_dists            = nullptr;
+			_num_buckets      = 0;
+			_mask             = 0;
+			_max_probe_length = -1;
+			return;
+		}
+		const size_t new_num_buckets = num_buckets_for(std::max(num_buckets, min_buckets_for(_num_filled)));
+		if (new_num_buckets != _num_buckets) {
+			rehash_to(new_num_buckets);
+		}
+	}
+
+	/// Shrink the table to fit the current elements, e.g. after clear() or a lot of erase:s.
+	void shrink_to_fit()
+	{
+		rehash(0);
+	}
+
+	/// The table grows when size() would exceed max_load_factor() * bucket_count().
+	float max_load_factor() const
+	{
+		return _max_load_factor;
+	}
+
+	/// Default is 2/3. Higher saves memory, lower gives shorter probes.
+	/// Must be in (0, 1). Grows the table right away if needed, but never shrinks it (see shrink_to_fit).
+	void max_load_factor(float max_load_factor)
+	{
+		CHECK_F(0.0f < max_load_factor && max_load_factor < 1.0f,
+			"max_load_factor must be in (0, 1), got %f", max_load_factor);
+		_max_load_factor = max_load_factor;
+		reserve(size());
+	}
+
+private:
+	// We always keep at least one bucket empty, so that lookups of missing keys terminate.
+	size_t min_buckets_for(size_t num_elems) const
+	{
+		return static_cast<size_t>(static_cast<double>(num_elems) / _max_load_factor) + 1;
+	}
+
+	static size_t num_buckets_for(size_t required_buckets)
+	{
+		size_t num_buckets = PolicyT::group_probing ? hash_detail::GROUP_WIDTH : 4;
 		while (num_buckets < required_buckets) { num_buckets *= 2; }
+		return num_buckets;
+	}
+
+	// Move all elements to a new table with this many buckets.
+	void rehash_to(size_t num_buckets)
+	{
+		if (PolicyT::count_rehashes) {
+			_num_rehashes += 1;
+		}
+		hash_detail::ScopedRehashTimer timer(PolicyT::count_rehashes ? &_rehash_seconds : nullptr);
 
-		auto new_states = (State*)malloc(num_buckets * sizeof(State));
-		auto new_keys  = (KeyT*)malloc(num_buckets * sizeof(KeyT));
+		auto new_states = allocate_array<uint8_t>(num_state_bytes(num_buckets));
+		auto new_keys   = allocate_array<KeyT>(num_buckets);
 
-		if (!new_states || !new_keys) {
-			free(new_states);
-			free(new_keys);
+		auto new_dists  = PolicyT::robin_hood ? allocate_array<uint16_t>(num_buckets) : nullptr;
+
+		if (!new_states || !new_keys || (PolicyT::robin_hood && !new_dists)) {
+			deallocate_array(new_states, num_state_bytes(num_buckets));
+			deallocate_array(new_keys, num_buckets);
+			deallocate_array(new_dists, num_buckets);
 			throw std::bad_alloc();
 		}
 
 		// auto old_num_filled  = _num_filled;
 		auto old_num_buckets = _num_buckets;
 		auto old_states      = _states;
+		auto old_dists       = _dists;
 		auto old_keys        = _keys;
 
 		_num_filled  = 0;
 		_num_buckets = num_buckets;
 		_mask        = _num_buckets - 1;
 		_states      = new_states;
+		_dists       = new_dists;
 		_keys        = new_keys;
 
-		std::fill_n(_states, num_buckets, State::INACTIVE);
+		std::fill_n(_states, num_state_bytes(num_buckets), hash_detail::INACTIVE);
 
 		_max_probe_length = -1;
 
 		for (size_t src_bucket=0; src_bucket<old_num_buckets; src_bucket++) {
-			if (old_states[src_bucket] == State::FILLED) {
+			if (hash_detail::is_filled(old_states[src_bucket])) {
 				auto& src = old_keys[src_bucket];
 
-				auto dst_bucket = find_empty_bucket(src);
+				auto hash_value = hash_key(src);
+				auto dst_bucket = find_empty_bucket(hash_value);
 				DCHECK_NE_F(dst_bucket, (size_t)-1);
-				DCHECK_NE_F(_states[dst_bucket], State::FILLED);
-				_states[dst_bucket] = State::FILLED;
+				DCHECK_F(!hash_detail::is_filled(_states[dst_bucket]));
+				set_state(dst_bucket, hash_detail::hash_fragment(hash_value));
 				new(_keys + dst_bucket) KeyT(std::move(src));
 				_num_filled += 1;
 
@@ -478,61 +660,250 @@ public:
 
 		// DCHECK_EQ_F(old_num_filled, _num_filled);
 
-		free(old_states);
-		free(old_keys);
+		deallocate_array(old_states, num_state_bytes(old_num_buckets));
+		deallocate_array(old_keys, old_num_buckets);
+		deallocate_array(old_dists, old_num_buckets);
 	}
 
-private:
 	// Can we fit another element?
 	void check_expand_need()
 	{
 		reserve(_num_filled + 1);
 	}
 
+	// insert without the reserve: the caller must already have made room for the key.
+	template<typename K>
+	std::pair<iterator, bool> insert_with_room(K&& key)
+	{
+		auto hash_value = hash_key(key);
+		auto bucket = find_or_allocate(key, hash_value);
+
+		if (hash_detail::is_filled(_states[bucket])) {
+			return { iterator(this, bucket), false };
+		} else {
+			set_state(bucket, hash_detail::hash_fragment(hash_value));
+			new(_keys + bucket) KeyT(std::forward<K>(key));
+			_num_filled++;
+			return { iterator(this, bucket), true };
+		}
+	}
+
+	// insert_unique without the reserve: the caller must already have made room for the key.
+	void insert_unique_with_room(KeyT key)
+	{
+		DCHECK_F(!contains(key));
+		auto hash_value = hash_key(key);
+		auto bucket = find_empty_bucket(hash_value);
+		set_state(bucket, hash_detail::hash_fragment(hash_value));
+		new(_keys + bucket) KeyT(std::move(key));
+		_num_filled++;
+	}
+
+	template<typename T>
+	T* allocate_array(size_t count)
+	{
+		return static_cast<T*>(_allocator.allocate(count * sizeof(T)));
+	}
+
+	template<typename T>
+	void deallocate_array(T* ptr, size_t count)
+	{
+		_allocator.deallocate(ptr, count * sizeof(T));
+	}
+
+	size_t hash_key(const KeyT& key) const
+	{
+		return hash_detail::post_mix<PolicyT>(_hasher(key));
+	}
+
+	// With group probing we keep a copy of the first GROUP_WIDTH-1 control bytes
+	// after the last bucket, so that a group can be loaded from any bucket without wrapping.
+	static size_t num_state_bytes(size_t num_buckets)
+	{
+		return PolicyT::group_probing ? num_buckets + hash_detail::GROUP_WIDTH - 1 : num_buckets;
+	}
+
+	void set_state(size_t bucket, uint8_t state)
+	{
+		_states[bucket] = state;
+		if (PolicyT::group_probing && bucket < hash_detail::GROUP_WIDTH - 1) {
+			_states[_num_buckets + bucket] = state;
+		}
+	}
+
+	template <typename K, typename H, typename E, typename P>
+	friend HashSet<K, H, E, P> set_union(const HashSet<K, H, E, P>& a, const HashSet<K, H, E, P>& b);
+
+	// How many of our keys other doesn't contain.
+	size_t count_missing_in(const HashSet& other) const
+	{
+		size_t num_missing = 0;
+		for_each_lookup_in(other, [&](const KeyT&, bool contained) {
+			num_missing += !contained;
+			return true;
+		});
+		return num_missing;
+	}
+
+	// Copy the keys of other into the same buckets, which is much faster than re-inserting them.
+	// This set must be empty, without tombstones, and have the same number of buckets as other.
+	void copy_buckets_from(const HashSet& other)
+	{
+		DCHECK_F(empty());
+		DCHECK_EQ_F(_num_buckets, other._num_buckets);
+		for (size_t bucket = hash_detail::find_filled(other._states, 0, _num_buckets); bucket < _num_buckets;
+		     bucket = hash_detail::find_filled(other._states, bucket + 1, _num_buckets)) {
+			new(_keys + bucket) KeyT(other._keys[bucket]);
+		}
+		std::copy_n(other._states, num_state_bytes(_num_buckets), _states);
+		if (PolicyT::robin_hood) {
+			std::copy_n(other._dists, _num_buckets, _dists);
+		}
+		_num_filled       = other._num_filled;
+		_max_probe_length = other._max_probe_length;
+	}
+
+	// Erase each key for which other.contains(key) == contained.
+	void erase_where_lookup_in(const HashSet& other, bool contained)
+	{
+		if (PolicyT::robin_hood) {
+			// Erasing shifts later elements back, so we can't erase while looking ahead.
+			for (auto it = begin(); it != end(); ) {
+				if (other.contains(*it) == contained) {
+					it = erase(it);
+				} else {
+					++it;
+				}
+			}
+			return;
+		}
+		// Erasing only leaves a tombstone, so the keys in the current batch stay where they are.
+		for_each_lookup_in(other, [&](const KeyT& key, bool key_in_other) {
+			if (key_in_other == contained) {
+				erase_bucket(static_cast<size_t>(&key - _keys));
+			}
+			return true;
+		});
+	}
+
 	// Find the bucket with this key, or return (size_t)-1
 	size_t find_filled_bucket(const KeyT& key) const
 	{
 		if (empty()) { return (size_t)-1; } // Optimization
+		return find_filled_bucket_with_hash(key, hash_key(key));
+	}
+
+	size_t find_filled_bucket_with_hash(const KeyT& key, size_t hash_value) const
+	{
+		if (empty()) { return (size_t)-1; }
+
+		const uint8_t fragment = hash_detail::hash_fragment(hash_value);
+
+		if (PolicyT::group_probing) {
+			// Most keys are in their home bucket. Checking it first lets the CPU fetch the
+			// key speculatively instead of waiting for the control bytes.
+			auto home = hash_value & _mask;
+			if (_states[home] == fragment && _eq(_keys[home], key)) {
+				return home;
+			}
+			uint32_t skip_home = ~1u;
+			for (int offset=0; offset<=_max_probe_length; offset += hash_detail::GROUP_WIDTH) {
+				auto group_start = (hash_value + offset) & _mask;
+				const hash_detail::HashGroup group(_states + group_start);
+				auto in_range = hash_detail::group_probe_mask(offset, _max_probe_length);
+				for (auto matches = group.match(fragment) & in_range & skip_home; matches; matches &= matches - 1) {
+					auto bucket = (group_start + hash_detail::lowest_bit_index(matches)) & _mask;
+					if (_eq(_keys[bucket], key)) {
+						return bucket;
+					}
+				}
+				if (group.match(hash_detail::INACTIVE) & in_range) {
+					return (size_t)-1; // End of the chain!
+				}
+				skip_home = ~0u;
+			}
+			return (size_t)-1;
+		}
 
-		auto hash_value = _hasher(key);
 		for (int offset=0; offset<=_max_probe_length; ++offset) {
 			auto bucket = (hash_value + offset) & _mask;
-			if (_states[bucket] == State::FILLED) {
+			if (_states[bucket] == fragment) {
 				if (_eq(_keys[bucket], key)) {
 					return bucket;
 				}
-			} else if (_states[bucket] == State::INACTIVE) {
+			} else if (_states[bucket] == hash_detail::INACTIVE) {
 				return (size_t)-1; // End of the chain!
 			}
+			if (PolicyT::robin_hood && _dists[bucket] < offset) {
+				return (size_t)-1; // The key would have displaced this richer element.
+			}
 		}
 		return (size_t)-1;
 	}
 
 	// Find the bucket with this key, or return a good empty bucket to place the key in.
 	// In the latter case, the bucket is expected to be filled.
-	size_t find_or_allocate(const KeyT& key)
+	size_t find_or_allocate(const KeyT& key, size_t hash_value)
 	{
-		auto hash_value = _hasher(key);
+		const uint8_t fragment = hash_detail::hash_fragment(hash_value);
+
+		if (PolicyT::robin_hood) {
+			for (int offset=0; ; ++offset) {
+				auto bucket = (hash_value + offset) & _mask;
+				if (!hash_detail::is_filled(_states[bucket]) || _dists[bucket] < offset) {
+					return robin_hood_claim(bucket, offset);
+				}
+				if (_states[bucket] == fragment && _eq(_keys[bucket], key)) {
+					return bucket;
+				}
+			}
+		}
+
 		size_t hole = (size_t)-1;
 		int offset=0;
-		for (; offset<=_max_probe_length; ++offset) {
-			auto bucket = (hash_value + offset) & _mask;
 
-			if (_states[bucket] == State::FILLED) {
-				if (_eq(_keys[bucket], key)) {
-					return bucket;
+		if (PolicyT::group_probing) {
+			for (; offset<=_max_probe_length; offset += hash_detail::GROUP_WIDTH) {
+				auto group_start = (hash_value + offset) & _mask;
+				const hash_detail::HashGroup group(_states + group_start);
+				auto in_range = hash_detail::group_probe_mask(offset, _max_probe_length);
+				for (auto matches = group.match(fragment) & in_range; matches; matches &= matches - 1) {
+					auto bucket = (group_start + hash_detail::lowest_bit_index(matches)) & _mask;
+					if (_eq(_keys[bucket], key)) {
+						return bucket;
+					}
 				}
-			} else if (_states[bucket] == State::INACTIVE) {
-				return bucket;
-			} else {
-				// ACTIVE: keep searching
-				if (hole == (size_t)-1) {
-					hole = bucket;
+				auto not_filled = group.match_not_filled() & in_range;
+				if (hole == (size_t)-1 && not_filled) {
+					// ACTIVE or INACTIVE - either way the key can go here if we don't find it.
+					hole = (group_start + hash_detail::lowest_bit_index(not_filled)) & _mask;
+				}
+				if (group.match(hash_detail::INACTIVE) & in_range) {
+					return hole; // End of the chain!
+				}
+			}
+			offset = _max_probe_length + 1;
+		} else {
+			for (; offset<=_max_probe_length; ++offset) {
+				auto bucket = (hash_value + offset) & _mask;
+
+				if (_states[bucket] == fragment) {
+					if (_eq(_keys[bucket], key)) {
+						return bucket;
+					}
+				} else if (_states[bucket] == hash_detail::INACTIVE) {
+					return hole != (size_t)-1 ? hole : bucket;
+				} else if (_states[bucket] == hash_detail::ACTIVE) {
+					// ACTIVE: keep searching
+					if (hole == (size_t)-1) {
+						hole = bucket;
+					}
 				}
 			}
 		}
 
 		// No key found - but maybe a hole for it
+
 		DCHECK_EQ_F(offset, _max_probe_length+1);
 
 		if (hole != (size_t)-1) {
@@ -543,20 +914,42 @@ private:
 		for (; ; ++offset) {
 			auto bucket = (hash_value + offset) & _mask;
 
-			if (_states[bucket] != State::FILLED) {
+			if (!hash_detail::is_filled(_states[bucket])) {
 				_max_probe_length = offset;
 				return bucket;
 			}
 		}
 	}
 
-	// key is not in this map. Find a place to put it.
-	size_t find_empty_bucket(const KeyT& key)
+	// key is not in this set. Find a place to put it.
+	size_t find_empty_bucket(size_t hash_value)
 	{
-		auto hash_value = _hasher(key);
+		if (PolicyT::robin_hood) {
+			for (int offset=0; ; ++offset) {
+				auto bucket = (hash_value + offset) & _mask;
+				if (!hash_detail::is_filled(_states[bucket]) || _dists[bucket] < offset) {
+					return robin_hood_claim(bucket, offset);
+				}
+			}
+		}
+
+		if (PolicyT::group_probing) {
+			for (int offset=0; ; offset += hash_detail::GROUP_WIDTH) {
+				auto group_start = (hash_value + offset) & _mask;
+				auto not_filled = hash_detail::HashGroup(_states + group_start).match_not_filled();
+				if (not_filled) {
+					offset += hash_detail::lowest_bit_index(not_filled);
+					if (offset > _max_probe_length) {
+						_max_probe_length = offset;
+					}
+					return (hash_value + offset) & _mask;
+				}
+			}
+		}
+
 		for (int offset=0; ; ++offset) {
 			auto bucket = (hash_value + offset) & _mask;
-			if (_states[bucket] != State::FILLED) {
+			if (!hash_detail::is_filled(_states[bucket])) {
 				if (offset > _max_probe_length) {
 					_max_probe_length = offset;
 				}
@@ -565,22 +958,147 @@ private:
 		}
 	}
 
-private:
-	enum class State : uint8_t
+	// Robin Hood: make room for an element at the given probe offset by shifting
+	// the rest of the cluster one step forward. Returns the now unfilled bucket.
+	size_t robin_hood_claim(size_t bucket, int offset)
 	{
-		INACTIVE, // Never been touched
-		ACTIVE,   // Is inside a search-chain, but is empty
-		FILLED    // Is set with key/value
-	};
+		size_t empty = bucket;
+		while (hash_detail::is_filled(_states[empty])) {
+			empty = (empty + 1) & _mask;
+		}
+		for (size_t dst = empty; dst != bucket; ) {
+			size_t src = (dst - 1) & _mask;
+			new(_keys + dst) KeyT(std::move(_keys[src]));
+			_keys[src].~KeyT();
+			set_state(dst, _states[src]);
+			set_dist(dst, _dists[src] + 1);
+			dst = src;
+		}
+		set_state(bucket, hash_detail::INACTIVE);
+		set_dist(bucket, offset);
+		return bucket;
+	}
 
-	HashT   _hasher;
-	EqT     _eq;
-	State*  _states           = nullptr;
-	KeyT*   _keys             = nullptr;
-	size_t  _num_buckets      =  0;
-	size_t  _num_filled       =  0;
-	int     _max_probe_length = -1; // Our longest bucket-brigade is this long. ONLY when we have zero elements is this ever negative (-1).
-	size_t  _mask             = 0;  // _num_buckets minus one
+	void set_dist(size_t bucket, int dist)
+	{
+		CHECK_LT_F(dist, 0xFFFF, "Robin Hood probe length overflow - the hash function is broken");
+		_dists[bucket] = static_cast<uint16_t>(dist);
+		if (dist > _max_probe_length) {
+			_max_probe_length = dist;
+		}
+	}
+
+	// Destroy the element in this bucket.
+	// Returns true if another element was moved into the bucket (Robin Hood backward shift).
+	bool erase_bucket(size_t bucket)
+	{
+		_keys[bucket].~KeyT();
+		_num_filled -= 1;
+
+		if (!PolicyT::robin_hood) {
+			set_state(bucket, hash_detail::ACTIVE);
+			return false;
+		}
+
+		const size_t erased = bucket;
+		for (;;) {
+			size_t next = (bucket + 1) & _mask;
+			if (!hash_detail::is_filled(_states[next]) || _dists[next] == 0) {
+				break;
+			}
+			new(_keys + bucket) KeyT(std::move(_keys[next]));
+			_keys[next].~KeyT();
+			set_state(bucket, _states[next]);
+			_dists[bucket] = _dists[next] - 1;
+			bucket = next;
+		}
+		set_state(bucket, hash_detail::INACTIVE);
+		return bucket != erased;
+	}
+
+private:
+	HashT     _hasher;
+	EqT       _eq;
+	allocator_type _allocator;
+	float     _max_load_factor  = 2.0f / 3.0f;
+	uint8_t*  _states           = nullptr; // One control byte per bucket, see hash_detail.
+	uint16_t* _dists            = nullptr; // Robin Hood only: probe offset of the element in each bucket.
+	KeyT*     _keys             = nullptr;
+	size_t    _num_buckets      =  0;
+	size_t    _num_filled       =  0;
+	int       _max_probe_length = -1; // Our longest bucket-brigade is this long. ONLY when we have zero elements is this ever negative (-1).
+	size_t    _mask             = 0;  // _num_buckets minus one
+	size_t    _num_rehashes     = 0;  // count_rehashes only.
+	double    _rehash_seconds   = 0;  // count_rehashes only.
 };
 
+/// Returns a new set with the keys that are in a or b (or both).
+/// Looks up the keys of the smaller set in the bigger one, and allocates the result once.
+template <typename KeyT, typename HashT, typename EqT, typename PolicyT>
+HashSet<KeyT, HashT, EqT, PolicyT> set_union(const HashSet<KeyT, HashT, EqT, PolicyT>& a, const HashSet<KeyT, HashT, EqT, PolicyT>& b)
+{
+	const auto& big   = a.size() >= b.size() ? a : b;
+	const auto& small = a.size() >= b.size() ? b : a;
+	HashSet<KeyT, HashT, EqT, PolicyT> result(a.get_allocator());
+	result.reserve(big.size() + small.count_missing_in(big));
+	if (result.bucket_count() == big.bucket_count()) {
+		result.copy_buckets_from(big);
+	} else {
+		for (const KeyT& key : big) {
+			result.insert_unique_with_room(key);
+		}
+	}
+	small.for_each_lookup_in(big, [&](const KeyT& key, bool contained) {
+		if (!contained) {
+			result.insert_unique_with_room(key);
+		}
+		return true;
+	});
+	return result;
+}
+
+/// Returns a new set with the keys that are in both a and b.
+/// Looks up the keys of the smaller set in the bigger one, and allocates the result once.
+template <typename KeyT, typename HashT, typename EqT, typename PolicyT>
+HashSet<KeyT, HashT, EqT, PolicyT> set_intersection(const HashSet<KeyT, HashT, EqT, PolicyT>& a, const HashSet<KeyT, HashT, EqT, PolicyT>& b)
+{
+	const auto& big   = a.size() >= b.size() ? a : b;
+	const auto& small = a.size() >= b.size() ? b : a;
+	std::vector<const KeyT*> common;
+	small.for_each_lookup_in(big, [&](const KeyT& key, bool contained) {
+		if (contained) { common.push_back(&key); }
+		return true;
+	});
+	HashSet<KeyT, HashT, EqT, PolicyT> result(a.get_allocator());
+	result.reserve(common.size());
+	for (const KeyT* key : common) {
+		result.insert_unique(*key);
+	}
+	return result;
+}
+
+/// Returns a new set with the keys of a that are not in b. Allocates the result once.
+template <typename KeyT, typename HashT, typename EqT, typename PolicyT>
+HashSet<KeyT, HashT, EqT, PolicyT> set_difference(const HashSet<KeyT, HashT, EqT, PolicyT>& a, const HashSet<KeyT, HashT, EqT, PolicyT>& b)
+{
+	std::vector<const KeyT*> kept;
+	a.for_each_lookup_in(b, [&](const KeyT& key, bool contained) {
+		if (!contained) { kept.push_back(&key); }
+		return true;
+	});
+	HashSet<KeyT, HashT, EqT, PolicyT> result(a.get_allocator());
+	result.reserve(kept.size());
+	for (const KeyT* key : kept) {
+		result.insert_unique(*key);
+	}
+	return result;
+}
+
+/// True if every key in a is also in b.
+template <typename KeyT, typename HashT, typename EqT, typename PolicyT>
+bool is_subset(const HashSet<KeyT, HashT, EqT, PolicyT>& a, const HashSet<KeyT, HashT, EqT, PolicyT>& b)
+{
+	return a.is_subset_of(b);
+}
+
 } // namespace emilib
@@ -0,0 +1,102 @@
+// By Emil Ernerfeldt 2014-2017
+// LICENSE:
+//   This software is dual-licensed to the public domain and under the following
+//   license: you are granted a perpetual, irrevocable license to copy, modify,
+//   publish, and distribute this file as you see fit.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+#ifdef __linux__
+	#include <sys/mman.h>
+#endif
+
+#include "hash_policy.hpp"
+
+namespace emilib {
+
+/// An allocator (see MallocHashAllocator) that puts big allocations on 2 MiB huge pages.
+/// A multi-GB hash table on 4 KiB pages misses the TLB on almost every lookup;
+/// with huge pages the page walks mostly go away.
+///
+/// On Linux, allocations of at least HUGE_PAGE_SIZE bytes are rounded up to whole huge pages and
+///   1. first try explicit huge pages (mmap with MAP_HUGETLB), which must be reserved by the
+///      administrator (/proc/sys/vm/nr_hugepages),
+///   2. then fall back to a 2 MiB aligned mapping with madvise(MADV_HUGEPAGE), which asks for
+///      transparent huge pages (when /sys/kernel/mm/transparent_hugepage/enabled is not "never").
+/// Smaller allocations, and all allocations on other platforms, use malloc.
+struct HugePageAllocator
+{
+	static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+	void* allocate(size_t bytes)
+	{
+#ifdef __linux__
+		if (bytes >= HUGE_PAGE_SIZE) {
+			return map_huge(round_up(bytes));
+		}
+#endif
+		return std::malloc(bytes);
+	}
+
+	void deallocate(void* ptr, size_t bytes)
+	{
+		if (!ptr) { return; }
+#ifdef __linux__
+		if (bytes >= HUGE_PAGE_SIZE) {
+			munmap(ptr, round_up(bytes));
+			return;
+		}
+#endif
+		std::free(ptr);
+	}
+
+private:
+	static size_t round_up(size_t bytes)
+	{
+		return (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+	}
+
+#ifdef __linux__
+	static void* map_huge(size_t size)
+	{
+	#ifdef MAP_HUGETLB
+		void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (ptr != MAP_FAILED) {
+			return ptr;
+		}
+	#endif
+
+		// Transparent huge pages only back 2 MiB aligned ranges, so over-allocate and trim.
+		const size_t padded_size = size + HUGE_PAGE_SIZE;
+		void* padded = mmap(nullptr, padded_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (padded == MAP_FAILED) {
+			return nullptr;
+		}
+		const uintptr_t start   = reinterpret_cast<uintptr_t>(padded);
+		const uintptr_t aligned = (start + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+		if (aligned != start) {
+			munmap(padded, aligned - start);
+		}
+		const size_t tail = (start + padded_size) - (aligned + size);
+		if (tail != 0) {
+			munmap(reinterpret_cast<void*>(aligned + size), tail);
+		}
+	#ifdef MADV_HUGEPAGE
+		madvise(reinterpret_cast<void*>(aligned), size, MADV_HUGEPAGE);
+	#endif
+		return reinterpret_cast<void*>(aligned);
+	}
+#endif
+};
+
+/// HashPolicy with HugePageAllocator, for huge tables.
+struct HugePageHashPolicy : HashPolicy
+{
+	using Allocator = HugePageAllocator;
+};
+
+} // namespace emilib
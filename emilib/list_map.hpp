@@ -6,9 +6,13 @@
 
 #pragma once
 
+#include <stdexcept>
+#include <type_traits>
 #include <vector>
 #include <utility>
 
+#include "list_set.hpp"
+
 namespace emilib {
 
 /// like std::equal_to but no need to #include <functional>
@@ -22,6 +26,8 @@ struct ListMapEqualTo
 };
 
 /// Linear lookup map for quick lookups among few values.
+/// Once it holds a few integer, enum or pointer keys (with the default EqT), they are scanned in place
+/// many at a time using SSE2, skipping over the values (when 16 bytes hold a whole number of pairs).
 template<typename KeyT, typename ValueT, typename EqT = ListMapEqualTo<KeyT>>
 class ListMap
 {
@@ -46,38 +52,24 @@ public:
 
 	iterator find(const KeyT& key)
 	{
-		iterator e=end();
-		for (iterator it=begin(); it!=e; ++it) {
-			if (_eq(it->first, key)) {
-				return it;
-			}
-		}
-		return e;
+		return begin() + find_index(key);
 	}
 
 	const_iterator find(const KeyT& key) const
 	{
-		const_iterator e=end();
-		for (const_iterator it=begin(); it!=e; ++it) {
-			if (_eq(it->first, key)) {
-				return it;
-			}
-		}
-		return e;
+		return begin() + find_index(key);
 	}
 
 	size_t count(const KeyT& key) const
 	{
-		return find(key) == end() ? 0 : 1;
+		return find_index(key) == _list.size() ? 0 : 1;
 	}
 
 	ValueT& operator[](const KeyT& key)
 	{
-		iterator e=end();
-		for (iterator it=begin(); it!=e; ++it) {
-			if (_eq(it->first, key)) {
-				return it->second;
-			}
+		const size_t index = find_index(key);
+		if (index != _list.size()) {
+			return _list[index].second;
 		}
 		_list.push_back(Pair(key, ValueT()));
 		return _list.back().second;
@@ -92,11 +84,8 @@ public:
 
 	bool insert(const Pair& p)
 	{
-		const_iterator e=end();
-		for (const_iterator it=begin(); it!=e; ++it) {
-			if (_eq(it->first, p.first)) {
-				return false; // like std::map we do not insert if we already have it
-			}
+		if (find_index(p.first) != _list.size()) {
+			return false; // like std::map we do not insert if we already have it
 		}
 		_list.push_back(p);
 		return true;
@@ -104,12 +93,10 @@ public:
 
 	void insert_or_assign(const KeyT& key, ValueT&& value)
 	{
-		const_iterator e=end();
-		for (const_iterator it=begin(); it!=e; ++it) {
-			if (_eq(it->first, key)) {
-				it->second = std::move(value);
-				return;
-			}
+		const size_t index = find_index(key);
+		if (index != _list.size()) {
+			_list[index].second = std::move(value);
+			return;
 		}
 		_list.push_back(std::make_pair(key, std::move(value)));
 	}
@@ -123,12 +110,9 @@ public:
 
 	void erase(const KeyT& key)
 	{
-		iterator e=end();
-		for (iterator it=begin(); it!=e; ++it) {
-			if (_eq(it->first, key)) {
-				erase(it);
-				return;
-			}
+		const size_t index = find_index(key);
+		if (index != _list.size()) {
+			erase(begin() + index);
 		}
 	}
 
@@ -141,6 +125,34 @@ public:
 	void clear() { _list.clear(); }
 
 private:
+	using BitwiseComparable = list_detail::is_bitwise_comparable<KeyT, EqT, ListMapEqualTo<KeyT>>;
+
+	// Index of key in _list, or _list.size()
+	size_t find_index(const KeyT& key) const
+	{
+		return find_index(key, BitwiseComparable());
+	}
+
+	size_t find_index(const KeyT& key, std::true_type) const
+	{
+		// The keys are read where they are, so there is no copy of them to get out of sync with _list.
+		const char* elements = reinterpret_cast<const char*>(_list.data());
+		if (_list.empty() || reinterpret_cast<const char*>(&_list[0].first) != elements) {
+			return find_index(key, std::false_type()); // No std::pair puts first anywhere else, but don't rely on it.
+		}
+		return list_detail::find_bitwise_strided<KeyT, sizeof(Pair)>(elements, _list.size(), key);
+	}
+
+	size_t find_index(const KeyT& key, std::false_type) const
+	{
+		for (size_t i = 0; i < _list.size(); ++i) {
+			if (_eq(_list[i].first, key)) {
+				return i;
+			}
+		}
+		return _list.size();
+	}
+
 	List _list;
 	EqT  _eq;
 };
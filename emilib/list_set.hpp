@@ -6,10 +6,172 @@
 
 #pragma once
 
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
 #include <vector>
 
+// Same switch as in hash_policy.hpp.
+#ifndef EMILIB_HASH_SSE2
+	#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+		#define EMILIB_HASH_SSE2 1
+	#else
+		#define EMILIB_HASH_SSE2 0
+	#endif
+#endif
+
+#if EMILIB_HASH_SSE2
+	#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+	#include <intrin.h>
+#endif
+
 namespace emilib {
 
+namespace list_detail {
+
+/// True if EqT is the default and says two keys are equal exactly when their bytes are,
+/// i.e. for integers, enums and pointers. Then we can compare many keys at once.
+/// Not bool, since std::vector<bool> doesn't store an array of them.
+template<typename KeyT, typename EqT, typename DefaultEqT>
+struct is_bitwise_comparable : std::integral_constant<bool,
+	std::is_same<EqT, DefaultEqT>::value && !std::is_same<KeyT, bool>::value &&
+	(std::is_integral<KeyT>::value || std::is_enum<KeyT>::value || std::is_pointer<KeyT>::value) &&
+	(sizeof(KeyT) == 1 || sizeof(KeyT) == 2 || sizeof(KeyT) == 4 || sizeof(KeyT) == 8)>
+{
+};
+
+#if EMILIB_HASH_SSE2
+// All bits set in each lane where a and b are equal, for lanes of 1, 2, 4 or 8 bytes.
+inline __m128i equal_lanes(__m128i a, __m128i b, std::integral_constant<size_t, 1>) { return _mm_cmpeq_epi8(a, b);  }
+inline __m128i equal_lanes(__m128i a, __m128i b, std::integral_constant<size_t, 2>) { return _mm_cmpeq_epi16(a, b); }
+inline __m128i equal_lanes(__m128i a, __m128i b, std::integral_constant<size_t, 4>) { return _mm_cmpeq_epi32(a, b); }
+inline __m128i equal_lanes(__m128i a, __m128i b, std::integral_constant<size_t, 8>)
+{
+	// SSE2 can't compare 64-bit lanes, so require both 32-bit halves to be equal:
+	const __m128i halves = _mm_cmpeq_epi32(a, b);
+	return _mm_and_si128(halves, _mm_shuffle_epi32(halves, _MM_SHUFFLE(2, 3, 0, 1)));
+}
+
+inline int lowest_bit_index(uint32_t bits)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, bits);
+	return static_cast<int>(index);
+#else
+	return __builtin_ctz(bits);
+#endif
+}
+#endif // EMILIB_HASH_SSE2
+
+#if EMILIB_HASH_SSE2
+// Bit i is set if byte i of 16 belongs to a key, when elements of STRIDE bytes each start with a KeyT.
+template<typename KeyT, size_t STRIDE>
+constexpr uint32_t key_byte_mask()
+{
+	uint32_t mask = 0;
+	for (size_t byte = 0; byte < 16; ++byte) {
+		if (byte % STRIDE < sizeof(KeyT)) { mask |= 1u << byte; }
+	}
+	return mask;
+}
+
+// Compares 64 bytes worth of elements per branch.
+// Each element is STRIDE bytes and starts with a KeyT. The rest of it (e.g. the value of a pair) is ignored.
+template<typename KeyT, size_t STRIDE>
+size_t find_bitwise_sse2(const char* elements, size_t num_elements, KeyT key)
+{
+	static_assert(16 % STRIDE == 0 && sizeof(KeyT) <= STRIDE, "Elements must tile 16 bytes");
+	using LaneSize = std::integral_constant<size_t, sizeof(KeyT)>;
+	const size_t   ELEMENTS_PER_GROUP = 16 / STRIDE;
+	const uint32_t KEY_BYTES = key_byte_mask<KeyT, STRIDE>(); // Same in every group, since the elements tile it.
+
+	uint64_t key_bits = 0;
+	std::memcpy(&key_bits, &key, sizeof(KeyT));
+	// Repeat the key to fill 64 bits:
+	key_bits *= sizeof(KeyT) == 1 ? 0x0101010101010101ull : sizeof(KeyT) == 2 ? 0x0001000100010001ull : sizeof(KeyT) == 4 ? 0x0000000100000001ull : 1;
+	const __m128i pattern = _mm_set1_epi64x(static_cast<long long>(key_bits));
+
+	auto equal_in_group = [elements, pattern](size_t index) {
+		return equal_lanes(_mm_loadu_si128(reinterpret_cast<const __m128i*>(elements + index * STRIDE)), pattern, LaneSize());
+	};
+	auto first_key = [](__m128i equal) { return static_cast<uint32_t>(_mm_movemask_epi8(equal)) & KEY_BYTES; };
+
+	size_t i = 0;
+	for (; i + 4 * ELEMENTS_PER_GROUP <= num_elements; i += 4 * ELEMENTS_PER_GROUP) {
+		const __m128i a = equal_in_group(i);
+		const __m128i b = equal_in_group(i + ELEMENTS_PER_GROUP);
+		const __m128i c = equal_in_group(i + 2 * ELEMENTS_PER_GROUP);
+		const __m128i d = equal_in_group(i + 3 * ELEMENTS_PER_GROUP);
+		if (first_key(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d))) != 0) {
+			break; // It's in one of these four groups, which the loop below finds.
+		}
+	}
+	for (; i + ELEMENTS_PER_GROUP <= num_elements; i += ELEMENTS_PER_GROUP) {
+		if (const uint32_t equal = first_key(equal_in_group(i))) {
+			return i + static_cast<size_t>(lowest_bit_index(equal)) / STRIDE;
+		}
+	}
+	for (; i < num_elements; ++i) {
+		KeyT element_key;
+		std::memcpy(&element_key, elements + i * STRIDE, sizeof(KeyT));
+		if (element_key == key) {
+			return i;
+		}
+	}
+	return num_elements;
+}
+#endif // EMILIB_HASH_SSE2
+
+/// Shorter lists of keys are faster to check one key at a time.
+const size_t MIN_BYTES_FOR_SSE2 = 64;
+
+template<typename KeyT, size_t STRIDE>
+size_t find_bitwise_strided(const char* elements, size_t num_elements, KeyT key, std::false_type /*tiles_16_bytes*/)
+{
+	for (size_t i = 0; i < num_elements; ++i) {
+		KeyT element_key;
+		std::memcpy(&element_key, elements + i * STRIDE, sizeof(KeyT));
+		if (element_key == key) {
+			return i;
+		}
+	}
+	return num_elements;
+}
+
+template<typename KeyT, size_t STRIDE>
+size_t find_bitwise_strided(const char* elements, size_t num_elements, KeyT key, std::true_type /*tiles_16_bytes*/)
+{
+#if EMILIB_HASH_SSE2
+	if (num_elements * sizeof(KeyT) >= MIN_BYTES_FOR_SSE2) {
+		return find_bitwise_sse2<KeyT, STRIDE>(elements, num_elements, key);
+	}
+#endif
+	return find_bitwise_strided<KeyT, STRIDE>(elements, num_elements, key, std::false_type());
+}
+
+/// Index of the first of num_elements elements, STRIDE bytes apart, that starts with the same bytes as key,
+/// or num_elements if there is none. Used to find the keys of a list of std::pair in place.
+/// With SSE2, lists of at least MIN_BYTES_FOR_SSE2 of keys whose elements tile 16 bytes are compared 16 bytes at a time.
+template<typename KeyT, size_t STRIDE>
+size_t find_bitwise_strided(const char* elements, size_t num_elements, KeyT key)
+{
+	return find_bitwise_strided<KeyT, STRIDE>(elements, num_elements, key, std::integral_constant<bool, 16 % STRIDE == 0>());
+}
+
+/// Index of the first of keys[0, num_keys) with the same bytes as key, or num_keys if there is none.
+/// With SSE2, lists of at least MIN_BYTES_FOR_SSE2 are compared 16 bytes at a time.
+template<typename KeyT>
+size_t find_bitwise(const KeyT* keys, size_t num_keys, KeyT key)
+{
+	return find_bitwise_strided<KeyT, sizeof(KeyT)>(reinterpret_cast<const char*>(keys), num_keys, key);
+}
+
+} // namespace list_detail
+
 /// like std::equal_to but no need to #include <functional>
 template<typename T>
 struct ListSetEqualTo
@@ -21,6 +183,7 @@ struct ListSetEqualTo
 };
 
 /// Linear lookup set for quick lookups among few values.
+/// Integer, enum and pointer keys (with the default EqT) are compared many at a time using SSE2.
 template<typename KeyT, typename EqT = ListSetEqualTo<KeyT>>
 class ListSet
 {
@@ -44,20 +207,13 @@ public:
 
 	int count(const KeyT& key) const
 	{
-		for (auto&& k : *this) {
-			if (_eq(k, key)) {
-				return 1;
-			}
-		}
-		return 0;
+		return find_index(key) != _list.size() ? 1 : 0;
 	}
 
 	bool insert(const KeyT& key)
 	{
-		for (auto&& k : *this) {
-			if (_eq(k, key)) {
-				return false; // like std::set we do not insert if we already have it
-			}
+		if (find_index(key) != _list.size()) {
+			return false; // like std::set we do not insert if we already have it
 		}
 		_list.push_back(key);
 		return true;
@@ -72,6 +228,29 @@ public:
 	void clear() { _list.clear(); }
 
 private:
+	using BitwiseComparable = list_detail::is_bitwise_comparable<KeyT, EqT, ListSetEqualTo<KeyT>>;
+
+	// Index of key in _list, or _list.size()
+	size_t find_index(const KeyT& key) const
+	{
+		return find_index(key, BitwiseComparable());
+	}
+
+	size_t find_index(const KeyT& key, std::true_type) const
+	{
+		return list_detail::find_bitwise(_list.data(), _list.size(), key);
+	}
+
+	size_t find_index(const KeyT& key, std::false_type) const
+	{
+		for (size_t i = 0; i < _list.size(); ++i) {
+			if (_eq(_list[i], key)) {
+				return i;
+			}
+		}
+		return _list.size();
+	}
+
 	List _list;
 	EqT  _eq;
 };
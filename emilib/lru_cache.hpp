@@ -0,0 +1,240 @@
+// By Emil Ernerfeldt 2014-2017
+// LICENSE:
+//   This software is dual-licensed to the public domain and under the following
+//   license: you are granted a perpetual, irrevocable license to copy, modify,
+//   publish, and distribute this file as you see fit.
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include <loguru.hpp>
+
+#include "hash_map.hpp"
+
+namespace emilib {
+
+/// A cache which evicts the least recently used entries when it holds more than max_count entries,
+/// or when the sum of their costs (e.g. bytes) exceeds max_cost.
+///
+/// The entries are stored packed in one array, linked together by index in order of last use,
+/// and a HashMap maps each key to its index. Looking up and touching an entry is O(1) and never allocates;
+/// inserting only allocates when the array or the HashMap grows (call reserve() to avoid that).
+/// Erasing moves the last entry of the array into the hole, so pointers to values are invalidated by
+/// insertions and erasures, just like in a HashMap.
+///
+/// Example:
+///     emilib::LruCache<std::string, Image> cache(1000, 256 * 1024 * 1024);
+///     cache.set_eviction_callback([](const std::string& path, Image& image) { LOG_F(INFO, "Evicting %s", path.c_str()); });
+///     if (Image* image = cache.try_get(path)) { return *image; }
+///     Image& image = cache.insert(path, load_image(path), image_size_in_bytes);
+///
+/// Each key is stored twice (in the array and in the HashMap), so prefer small keys.
+/// PolicyT is for the HashMap. A full cache erases a key for every insertion, so the default is
+/// RobinHoodHashPolicy, which doesn't leave tombstones behind.
+template <typename KeyT, typename ValueT, typename HashT = std::hash<KeyT>, typename EqT = HashMapEqualTo<KeyT>, typename PolicyT = RobinHoodHashPolicy>
+class LruCache
+{
+public:
+	/// Called with each entry just before it is evicted to make room for others.
+	/// The callback may move the value out, but must not use the cache.
+	using EvictionCallback = std::function<void(const KeyT& key, ValueT& value)>;
+
+	/// Holds at most max_count entries with a total cost of at most max_cost.
+	explicit LruCache(size_t max_count, size_t max_cost = (size_t)-1)
+		: _max_count(max_count), _max_cost(max_cost)
+	{
+		CHECK_GT_F(max_count, 0u);
+	}
+
+	void set_eviction_callback(EvictionCallback callback) { _on_evict = std::move(callback); }
+
+	size_t size()       const { return _entries.size(); }
+	bool   empty()      const { return _entries.empty(); }
+	size_t total_cost() const { return _total_cost; }
+	size_t max_count()  const { return _max_count; }
+	size_t max_cost()   const { return _max_cost; }
+
+	/// Change the limits, evicting entries if needed.
+	void set_limits(size_t max_count, size_t max_cost = (size_t)-1)
+	{
+		CHECK_GT_F(max_count, 0u);
+		_max_count = max_count;
+		_max_cost  = max_cost;
+		evict_to_limits();
+	}
+
+	/// Make room for this many entries without allocating.
+	void reserve(size_t num_entries)
+	{
+		_entries.reserve(num_entries);
+		_index.reserve(num_entries);
+	}
+
+	/// Returns nullptr if the key is not in the cache.
+	/// Otherwise marks the entry as the most recently used one.
+	ValueT* try_get(const KeyT& key)
+	{
+		const uint32_t* index = _index.try_get(key);
+		if (!index) {
+			return nullptr;
+		}
+		touch(*index);
+		return &_entries[*index].value;
+	}
+
+	/// Like try_get, but does not mark the entry as used.
+	const ValueT* peek(const KeyT& key) const
+	{
+		const uint32_t* index = _index.try_get(key);
+		return index ? &_entries[*index].value : nullptr;
+	}
+
+	bool contains(const KeyT& key) const
+	{
+		return _index.count(key) != 0;
+	}
+
+	/// Insert the value, or replace the value already there (without calling the eviction callback),
+	/// and mark it as the most recently used entry.
+	/// Then evicts least recently used entries until the cache is within its limits.
+	/// The new entry itself is never evicted, even if its cost alone is above max_cost.
+	ValueT& insert(const KeyT& key, ValueT value, size_t cost = 1)
+	{
+		if (const uint32_t* found = _index.try_get(key)) {
+			Entry& entry = _entries[*found];
+			_total_cost -= entry.cost;
+			entry.value = std::move(value);
+			entry.cost  = cost;
+			touch(*found);
+		} else {
+			CHECK_LT_F(_entries.size(), (size_t)NONE);
+			const uint32_t index = static_cast<uint32_t>(_entries.size());
+			_entries.push_back(Entry{key, std::move(value), cost, NONE, NONE});
+			_index.insert(key, index);
+			link_front(index);
+		}
+		_total_cost += cost;
+		evict_to_limits();
+		return _entries[_head].value;
+	}
+
+	/// Remove the entry without calling the eviction callback. Returns false if it wasn't there.
+	bool erase(const KeyT& key)
+	{
+		const uint32_t* index = _index.try_get(key);
+		if (!index) {
+			return false;
+		}
+		remove_at(*index);
+		return true;
+	}
+
+	/// Remove all entries without calling the eviction callback.
+	void clear()
+	{
+		_entries.clear();
+		_index.clear();
+		_head = _tail = NONE;
+		_total_cost = 0;
+	}
+
+	/// The key of the entry that would be evicted next. The cache must not be empty.
+	const KeyT& least_recently_used() const
+	{
+		CHECK_F(!empty());
+		return _entries[_tail].key;
+	}
+
+	/// Calls fn(key, value) for every entry, from the most to the least recently used.
+	template<typename Func>
+	void for_each(const Func& fn) const
+	{
+		for (uint32_t index = _head; index != NONE; index = _entries[index].next) {
+			fn(_entries[index].key, _entries[index].value);
+		}
+	}
+
+private:
+	static const uint32_t NONE = 0xFFFFFFFFu;
+
+	struct Entry
+	{
+		KeyT     key;
+		ValueT   value;
+		size_t   cost;
+		uint32_t prev; // More recently used, or NONE.
+		uint32_t next; // Less recently used, or NONE.
+	};
+
+	void link_front(uint32_t index)
+	{
+		Entry& entry = _entries[index];
+		entry.prev = NONE;
+		entry.next = _head;
+		if (_head != NONE) {
+			_entries[_head].prev = index;
+		} else {
+			_tail = index;
+		}
+		_head = index;
+	}
+
+	void unlink(uint32_t index)
+	{
+		Entry& entry = _entries[index];
+		if (entry.prev != NONE) { _entries[entry.prev].next = entry.next; } else { _head = entry.next; }
+		if (entry.next != NONE) { _entries[entry.next].prev = entry.prev; } else { _tail = entry.prev; }
+	}
+
+	void touch(uint32_t index)
+	{
+		if (index != _head) {
+			unlink(index);
+			link_front(index);
+		}
+	}
+
+	void evict_to_limits()
+	{
+		while (_entries.size() > 1 && (_entries.size() > _max_count || _total_cost > _max_cost)) {
+			const uint32_t index = _tail;
+			if (_on_evict) {
+				_on_evict(_entries[index].key, _entries[index].value);
+			}
+			remove_at(index);
+		}
+	}
+
+	// Unlink the entry and fill its hole with the last entry of the array.
+	void remove_at(uint32_t index)
+	{
+		unlink(index);
+		_total_cost -= _entries[index].cost;
+		_index.erase(_entries[index].key);
+
+		const uint32_t last = static_cast<uint32_t>(_entries.size() - 1);
+		if (index != last) {
+			Entry& moved = _entries[index];
+			moved = std::move(_entries[last]);
+			*_index.try_get(moved.key) = index;
+			if (moved.prev != NONE) { _entries[moved.prev].next = index; } else { _head = index; }
+			if (moved.next != NONE) { _entries[moved.next].prev = index; } else { _tail = index; }
+		}
+		_entries.pop_back();
+	}
+
+	std::vector<Entry>                           _entries;
+	HashMap<KeyT, uint32_t, HashT, EqT, PolicyT> _index;
+	uint32_t                                     _head       = NONE; // Most recently used.
+	uint32_t                                     _tail       = NONE; // Least recently used.
+	size_t                                       _total_cost = 0;
+	size_t                                       _max_count;
+	size_t                                       _max_cost;
+	EvictionCallback                             _on_evict;
+};
+
+} // namespace emilib
@@ -0,0 +1,289 @@
+// By Emil Ernerfeldt 2014-2017
+// LICENSE:
+//   This software is dual-licensed to the public domain and under the following
+//   license: you are granted a perpetual, irrevocable license to copy, modify,
+//   publish, and distribute this file as you see fit.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+// Data-parallel loops on a ThreadPool:
+//
+//     emilib::parallel_for(pool, 0, images.size(), 1, [&](size_t i) { process(images[i]); });
+//     double sum = emilib::parallel_reduce(pool, 0, v.size(), 0, 0.0,
+//         [&](size_t i) { return v[i]; }, [](double a, double b) { return a + b; });
+//
+// The calling thread does its share of the work, so it is fine to call these from inside a job.
+// The range is handed out in chunks: big ones at first, smaller ones towards the end, so that all
+// threads finish at about the same time even if some iterations are slower than others.
+// grain is the smallest chunk (pass 0 to pick one automatically). Use a bigger grain for very cheap iterations.
+//
+// Each call adds at most one job per worker thread to the pool, and waits on a single counter
+// of busy threads. Ranges no bigger than grain don't touch the pool at all.
+// The functions you pass in must not throw.
+
+namespace emilib {
+namespace parallel_detail {
+
+/// The chunks of [0, num_items) still left to do, and how many threads are still working on them.
+class ParallelLoop
+{
+public:
+	ParallelLoop(size_t num_items, size_t grain, size_t num_participants)
+		: _num_items(num_items), _grain(grain), _num_participants(num_participants)
+	{
+	}
+
+	/// Claim the next chunk. Returns false when there is nothing left.
+	bool claim(size_t* out_begin, size_t* out_end)
+	{
+		size_t begin = _next.load(std::memory_order_relaxed);
+		while (begin < _num_items) {
+			const size_t remaining = _num_items - begin;
+			const size_t size = std::min(remaining, std::max(_grain, remaining / (2 * _num_participants)));
+			if (_next.compare_exchange_weak(begin, begin + size)) {
+				*out_begin = begin;
+				*out_end   = begin + size;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/// A pool job calls this before it touches anything of the caller.
+	/// Returns false if all chunks were already claimed, and then the caller may be gone.
+	bool enter()
+	{
+		++_num_active;
+		if (_next >= _num_items) {
+			leave();
+			return false;
+		}
+		return true;
+	}
+
+	void leave()
+	{
+		if (--_num_active == 0) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			_done_cond.notify_all();
+		}
+	}
+
+	/// Called by the caller after it has failed to claim more chunks.
+	void wait_for_others()
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_done_cond.wait(lock, [this]{ return _num_active == 0; });
+	}
+
+private:
+	const size_t            _num_items;
+	const size_t            _grain;
+	const size_t            _num_participants;
+	std::atomic<size_t>     _next{0};
+	std::atomic<size_t>     _num_active{0};
+	std::mutex              _mutex;
+	std::condition_variable _done_cond;
+};
+
+/// Run participant(loop) on the calling thread and on up to one job per worker thread,
+/// where participant claims chunks of [0, num_items) until there are none left.
+template<typename Participant>
+void run(ThreadPool& pool, size_t num_items, size_t grain, const Participant& participant)
+{
+	if (num_items == 0) { return; }
+	if (grain == 0) {
+		// Small enough to balance the load, big enough to make claiming a chunk cheap in comparison:
+		grain = std::max<size_t>(1, num_items / (64 * (pool.num_threads() + 1)));
+	}
+	const size_t num_helpers = std::min(pool.num_threads(), (num_items - 1) / grain);
+	if (num_helpers == 0) {
+		ParallelLoop loop(num_items, num_items, 1);
+		participant(loop);
+		return;
+	}
+
+	// Jobs that start after we have returned only touch the loop, so it must outlive us:
+	const auto loop = std::make_shared<ParallelLoop>(num_items, grain, num_helpers + 1);
+	for (size_t i = 0; i < num_helpers; ++i) {
+		pool.add_void([loop, &participant]() {
+			if (loop->enter()) {
+				participant(*loop);
+				loop->leave();
+			}
+		});
+	}
+	participant(*loop);
+	loop->wait_for_others();
+}
+
+} // namespace parallel_detail
+
+/// Calls fn(i) for each i in [begin, end), in parallel and in no particular order.
+template<typename Func>
+void parallel_for(ThreadPool& pool, size_t begin, size_t end, size_t grain, const Func& fn)
+{
+	if (end <= begin) { return; }
+	parallel_detail::run(pool, end - begin, grain, [&](parallel_detail::ParallelLoop& loop) {
+		size_t chunk_begin, chunk_end;
+		while (loop.claim(&chunk_begin, &chunk_end)) {
+			for (size_t i = begin + chunk_begin; i < begin + chunk_end; ++i) {
+				fn(i);
+			}
+		}
+	});
+}
+
+/// Returns identity reduced with fn(i) for each i in [begin, end), i.e. reduce(reduce(identity, fn(begin)), ...).
+/// Each thread reduces the chunks it does into its own value, and these are then reduced together.
+/// reduce must therefore be associative and commutative, and identity must be an identity of reduce.
+/// Note that this makes floating point sums differ slightly from run to run.
+template<typename T, typename Func, typename Reduce>
+T parallel_reduce(ThreadPool& pool, size_t begin, size_t end, size_t grain, T identity, const Func& fn, const Reduce& reduce)
+{
+	if (end <= begin) { return identity; }
+	std::mutex result_mutex;
+	T result = identity;
+	parallel_detail::run(pool, end - begin, grain, [&](parallel_detail::ParallelLoop& loop) {
+		T local = identity;
+		size_t chunk_begin, chunk_end;
+		while (loop.claim(&chunk_begin, &chunk_end)) {
+			for (size_t i = begin + chunk_begin; i < begin + chunk_end; ++i) {
+				local = reduce(std::move(local), fn(i));
+			}
+		}
+		std::lock_guard<std::mutex> lock(result_mutex);
+		result = reduce(std::move(result), std::move(local));
+	});
+	return result;
+}
+
+/// Like std::transform: out_first[i] = fn(first[i]) for each element of [first, last), in parallel.
+/// Both iterators must be random access.
+template<typename InputIt, typename OutputIt, typename Func>
+OutputIt parallel_transform(ThreadPool& pool, InputIt first, InputIt last, OutputIt out_first, const Func& fn, size_t grain = 0)
+{
+	const size_t num_items = static_cast<size_t>(std::distance(first, last));
+	parallel_for(pool, 0, num_items, grain, [&](size_t i) {
+		out_first[i] = fn(first[i]);
+	});
+	return out_first + num_items;
+}
+
+namespace parallel_detail {
+
+/// Merging two sorted ranges into out, split into pieces that can be merged independently.
+template<typename It, typename OutIt>
+struct MergeJob
+{
+	It    a_begin, a_end;
+	It    b_begin, b_end;
+	OutIt out;
+};
+
+/// Split the merge of [a_begin, a_end) and [b_begin, b_end) into pieces of at most max_size elements.
+/// Equal elements of a stay before those of b, so the merge is stable.
+template<typename It, typename OutIt, typename Less>
+void split_merge(It a_begin, It a_end, It b_begin, It b_end, OutIt out, size_t max_size, const Less& less,
+                 std::vector<MergeJob<It, OutIt>>* out_jobs)
+{
+	const size_t a_size = static_cast<size_t>(a_end - a_begin);
+	const size_t b_size = static_cast<size_t>(b_end - b_begin);
+	if (a_size + b_size <= max_size) {
+		out_jobs->push_back(MergeJob<It, OutIt>{a_begin, a_end, b_begin, b_end, out});
+		return;
+	}
+	It a_mid, b_mid;
+	if (a_size >= b_size) {
+		// Elements of b equal to *a_mid go after it:
+		a_mid = a_begin + a_size / 2;
+		b_mid = std::lower_bound(b_begin, b_end, *a_mid, less);
+	} else {
+		// Elements of a equal to *b_mid go before it:
+		b_mid = b_begin + b_size / 2;
+		a_mid = std::upper_bound(a_begin, a_end, *b_mid, less);
+	}
+	split_merge(a_begin, a_mid, b_begin, b_mid, out, max_size, less, out_jobs);
+	split_merge(a_mid, a_end, b_mid, b_end, out + ((a_mid - a_begin) + (b_mid - b_begin)), max_size, less, out_jobs);
+}
+
+/// Merge pairs of neighboring runs of run_size sorted elements from [from, from + num_items) into to.
+template<typename It, typename OutIt, typename Less>
+void merge_runs(ThreadPool& pool, It from, OutIt to, size_t num_items, size_t run_size, size_t max_job_size, const Less& less)
+{
+	std::vector<MergeJob<It, OutIt>> jobs;
+	for (size_t begin = 0; begin < num_items; begin += 2 * run_size) {
+		const size_t mid = std::min(begin + run_size,     num_items);
+		const size_t end = std::min(begin + 2 * run_size, num_items);
+		split_merge(from + begin, from + mid, from + mid, from + end, to + begin, max_job_size, less, &jobs);
+	}
+	parallel_for(pool, 0, jobs.size(), 1, [&](size_t i) {
+		const MergeJob<It, OutIt>& job = jobs[i];
+		std::merge(std::make_move_iterator(job.a_begin), std::make_move_iterator(job.a_end),
+		           std::make_move_iterator(job.b_begin), std::make_move_iterator(job.b_end),
+		           job.out, less);
+	});
+}
+
+} // namespace parallel_detail
+
+/// Stable merge sort of [first, last) using all threads of the pool, and the calling thread.
+/// The pieces are sorted with std::stable_sort, then merged pairwise, with each merge split over the threads.
+/// Allocates a buffer of (last - first) elements, which must be default constructible.
+template<typename RandomIt, typename Less>
+void parallel_sort(ThreadPool& pool, RandomIt first, RandomIt last, const Less& less)
+{
+	using T = typename std::iterator_traits<RandomIt>::value_type;
+	const size_t num_items = static_cast<size_t>(last - first);
+	const size_t MIN_RUN_SIZE = 4096;
+	size_t num_runs = 1;
+	while (num_runs < 2 * (pool.num_threads() + 1) && num_items / (2 * num_runs) >= MIN_RUN_SIZE) {
+		num_runs *= 2;
+	}
+	if (num_runs == 1) {
+		std::stable_sort(first, last, less);
+		return;
+	}
+
+	const size_t run_size = (num_items + num_runs - 1) / num_runs;
+	parallel_for(pool, 0, num_runs, 1, [&](size_t run) {
+		const size_t begin = std::min(run * run_size, num_items);
+		std::stable_sort(first + begin, first + std::min(begin + run_size, num_items), less);
+	});
+
+	std::vector<T> buffer(num_items);
+	const size_t max_job_size = std::max(MIN_RUN_SIZE, num_items / (4 * (pool.num_threads() + 1)));
+	bool in_buffer = false;
+	for (size_t size = run_size; size < num_items; size *= 2) {
+		if (in_buffer) {
+			parallel_detail::merge_runs(pool, buffer.begin(), first, num_items, size, max_job_size, less);
+		} else {
+			parallel_detail::merge_runs(pool, first, buffer.begin(), num_items, size, max_job_size, less);
+		}
+		in_buffer = !in_buffer;
+	}
+	if (in_buffer) {
+		parallel_transform(pool, buffer.begin(), buffer.end(), first, [](T& value) { return std::move(value); }, MIN_RUN_SIZE);
+	}
+}
+
+template<typename RandomIt>
+void parallel_sort(ThreadPool& pool, RandomIt first, RandomIt last)
+{
+	parallel_sort(pool, first, last, std::less<typename std::iterator_traits<RandomIt>::value_type>());
+}
+
+} // namespace emilib
@@ -0,0 +1,433 @@
+// By Emil Ernerfeldt 2014-2017
+// LICENSE:
+//   This software is dual-licensed to the public domain and under the following
+//   license: you are granted a perpetual, irrevocable license to copy, modify,
+//   publish, and distribute this file as you see fit.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+#include "hash_map.hpp"
+
+namespace emilib {
+
+/// An immutable-by-sharing hash map (a hash array mapped trie, or HAMT).
+///
+/// Copying a PersistentHashMap is O(1): the copies share all their nodes.
+/// Modifying a copy only copies the nodes on the path to the changed key (about log32(N) nodes of
+/// at most 32 entries each), so every other copy keeps seeing exactly what it saw before.
+/// Nodes that are not shared with any other copy are modified in place, so building a map
+/// with repeated insert_or_assign does not copy more than it has to.
+/// Each node is a single allocation with an atomic reference count.
+///
+/// Different copies may be used from different threads, but a single copy must not be
+/// modified while another thread uses it. See shared_snapshot.hpp for publishing new versions
+/// of a map to many reader threads.
+///
+/// Lookups are slower than in a HashMap (a few dependent pointer loads), so use this for maps
+/// that are read by many threads and replaced now and then, like configuration or routing tables.
+/// Keys are run through hash_mix (see hash_functions.hpp), so a weak HashT is fine.
+template <typename KeyT, typename ValueT, typename HashT = std::hash<KeyT>, typename EqT = HashMapEqualTo<KeyT>>
+class PersistentHashMap
+{
+public:
+	using size_type = size_t;
+
+	PersistentHashMap() = default;
+
+	PersistentHashMap(const PersistentHashMap& other)
+		: _root(other._root ? retain(other._root) : nullptr), _size(other._size), _hasher(other._hasher), _eq(other._eq)
+	{
+	}
+
+	PersistentHashMap(PersistentHashMap&& other)
+	{
+		swap(other);
+	}
+
+	PersistentHashMap& operator=(PersistentHashMap other)
+	{
+		swap(other);
+		return *this;
+	}
+
+	~PersistentHashMap()
+	{
+		if (_root) {
+			release(_root);
+		}
+	}
+
+	void swap(PersistentHashMap& other)
+	{
+		std::swap(_root,   other._root);
+		std::swap(_size,   other._size);
+		std::swap(_hasher, other._hasher);
+		std::swap(_eq,     other._eq);
+	}
+
+	size_t size()  const { return _size; }
+	bool   empty() const { return _size == 0; }
+
+	/// Returns nullptr if the key is not in the map.
+	const ValueT* try_get(const KeyT& key) const
+	{
+		const size_t hash_value = hash_key(key);
+		const Node* node = _root;
+		for (unsigned shift = 0; node; shift += BITS_PER_LEVEL) {
+			if (shift >= HASH_BITS) {
+				for (uint32_t i = 0; i < node->num_entries; ++i) {
+					if (_eq(node->entries()[i].key, key)) {
+						return &node->entries()[i].value;
+					}
+				}
+				return nullptr;
+			}
+			const uint32_t bit = slot_bit(hash_value, shift);
+			if (node->data_map & bit) {
+				const Entry& entry = node->entries()[index_of(node->data_map, bit)];
+				return (entry.hash_value == hash_value && _eq(entry.key, key)) ? &entry.value : nullptr;
+			}
+			if ((node->node_map & bit) == 0) {
+				return nullptr;
+			}
+			node = node->children()[index_of(node->node_map, bit)];
+		}
+		return nullptr;
+	}
+
+	size_t count(const KeyT& key) const
+	{
+		return try_get(key) ? 1 : 0;
+	}
+
+	/// Insert the value, or replace the value already there.
+	/// Returns true if the key was not already in the map.
+	bool insert_or_assign(KeyT key, ValueT value)
+	{
+		if (!_root) {
+			_root = new_node(0, 0, 0, 0);
+		}
+		Entry entry{hash_key(key), std::move(key), std::move(value)};
+		bool added = false;
+		assign(_root, 0, &entry, &added);
+		_size += added;
+		return added;
+	}
+
+	/// Returns false if the key wasn't in the map.
+	bool erase(const KeyT& key)
+	{
+		if (!try_get(key)) {
+			return false; // Don't copy anything.
+		}
+		if (_size == 1) {
+			clear();
+		} else {
+			erase(_root, 0, hash_key(key), key);
+			_size -= 1;
+		}
+		return true;
+	}
+
+	void clear()
+	{
+		if (_root) {
+			release(_root);
+		}
+		_root = nullptr;
+		_size = 0;
+	}
+
+	/// Calls fn(key, value) for every element, in no particular order.
+	template<typename Func>
+	void for_each(const Func& fn) const
+	{
+		if (_root) {
+			for_each(_root, fn);
+		}
+	}
+
+private:
+	static const unsigned BITS_PER_LEVEL = 5; // 32 slots per node.
+	static const unsigned HASH_BITS      = sizeof(size_t) * 8;
+	static const size_t   NONE           = (size_t)-1;
+
+	struct Entry
+	{
+		size_t hash_value;
+		KeyT   key;
+		ValueT value;
+	};
+
+	/// Each of the 32 slots of a node is either empty, holds an entry, or holds a child node.
+	/// Below HASH_BITS the slots are used up, and a node is a plain list of entries with the same hash.
+	/// A node is a single allocation: this header, then the child pointers and the entries, in slot order.
+	struct Node
+	{
+		std::atomic<size_t> ref_count;
+		uint32_t            data_map;     // Slots with an entry.
+		uint32_t            node_map;     // Slots with a child node.
+		uint32_t            num_children;
+		uint32_t            num_entries;
+
+		Node* const* children() const { return reinterpret_cast<Node* const*>(this + 1); }
+		Node**       children()       { return reinterpret_cast<Node**>(this + 1); }
+
+		const Entry* entries() const { return reinterpret_cast<const Entry*>(reinterpret_cast<const char*>(this) + entries_offset(num_children)); }
+		Entry*       entries()       { return reinterpret_cast<Entry*>(reinterpret_cast<char*>(this) + entries_offset(num_children)); }
+	};
+
+	static_assert(alignof(Entry) <= alignof(std::max_align_t), "Over-aligned keys or values are not supported");
+
+	static size_t entries_offset(size_t num_children)
+	{
+		const size_t offset = sizeof(Node) + num_children * sizeof(Node*);
+		return (offset + alignof(Entry) - 1) / alignof(Entry) * alignof(Entry);
+	}
+
+	// The children and entries are left for the caller to construct.
+	static Node* new_node(uint32_t data_map, uint32_t node_map, uint32_t num_children, uint32_t num_entries)
+	{
+		Node* node = static_cast<Node*>(::operator new(entries_offset(num_children) + num_entries * sizeof(Entry)));
+		new (&node->ref_count) std::atomic<size_t>(1);
+		node->data_map     = data_map;
+		node->node_map     = node_map;
+		node->num_children = num_children;
+		node->num_entries  = num_entries;
+		return node;
+	}
+
+	static Node* retain(Node* node)
+	{
+		node->ref_count.fetch_add(1, std::memory_order_relaxed);
+		return node;
+	}
+
+	static void release(Node* node)
+	{
+		if (node->ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			for (uint32_t i = 0; i < node->num_children; ++i) {
+				release(node->children()[i]);
+			}
+			for (uint32_t i = 0; i < node->num_entries; ++i) {
+				node->entries()[i].~Entry();
+			}
+			node->ref_count.~atomic();
+			::operator delete(node);
+		}
+	}
+
+	// If nobody else can see the node we may change it in place (or move from it).
+	static bool is_unique(const Node* node)
+	{
+		return node->ref_count.load(std::memory_order_acquire) == 1;
+	}
+
+	// Point slot at node, letting go of what was there.
+	static void replace(Node*& slot, Node* node)
+	{
+		Node* old = slot;
+		slot = node;
+		release(old);
+	}
+
+	/// A new node with the entries and children of src, except removed_entry and removed_child (or NONE),
+	/// and with added_entry and added_child (or nullptr) inserted at the given indices.
+	/// With steal the entries are moved from src, which must be unique and released right after.
+	static Node* rebuild(Node* src, bool steal, uint32_t data_map, uint32_t node_map,
+	                     size_t removed_entry, Entry* added_entry, size_t added_entry_index,
+	                     size_t removed_child, Node* added_child, size_t added_child_index)
+	{
+		const uint32_t num_children = src->num_children - (removed_child != NONE) + (added_child != nullptr);
+		const uint32_t num_entries  = src->num_entries  - (removed_entry != NONE) + (added_entry != nullptr);
+		Node* node = new_node(data_map, node_map, num_children, num_entries);
+
+		for (size_t out = 0, in = 0; out < num_children; ++out) {
+			if (added_child && out == added_child_index) {
+				node->children()[out] = added_child;
+				continue;
+			}
+			if (in == removed_child) { ++in; }
+			node->children()[out] = retain(src->children()[in++]);
+		}
+
+		for (size_t out = 0, in = 0; out < num_entries; ++out) {
+			Entry* dst = node->entries() + out;
+			if (added_entry && out == added_entry_index) {
+				new (dst) Entry(std::move(*added_entry));
+				continue;
+			}
+			if (in == removed_entry) { ++in; }
+			if (steal) {
+				new (dst) Entry(std::move(src->entries()[in++]));
+			} else {
+				new (dst) Entry(src->entries()[in++]);
+			}
+		}
+		return node;
+	}
+
+	static Node* clone(Node* src)
+	{
+		return rebuild(src, false, src->data_map, src->node_map, NONE, nullptr, 0, NONE, nullptr, 0);
+	}
+
+	// A node with just these two entries (or a chain of nodes, if their hashes start the same).
+	static Node* make_pair_node(unsigned shift, Entry* a, Entry* b)
+	{
+		if (shift >= HASH_BITS) {
+			Node* node = new_node(0, 0, 0, 2);
+			new (node->entries() + 0) Entry(std::move(*a));
+			new (node->entries() + 1) Entry(std::move(*b));
+			return node;
+		}
+		const uint32_t bit_a = slot_bit(a->hash_value, shift);
+		const uint32_t bit_b = slot_bit(b->hash_value, shift);
+		if (bit_a == bit_b) {
+			Node* node = new_node(0, bit_a, 1, 0);
+			node->children()[0] = make_pair_node(shift + BITS_PER_LEVEL, a, b);
+			return node;
+		}
+		if (bit_b < bit_a) {
+			std::swap(a, b);
+		}
+		Node* node = new_node(bit_a | bit_b, 0, 0, 2);
+		new (node->entries() + 0) Entry(std::move(*a));
+		new (node->entries() + 1) Entry(std::move(*b));
+		return node;
+	}
+
+	static void assign_value(Node*& slot, size_t index, Entry* entry)
+	{
+		if (!is_unique(slot)) {
+			replace(slot, clone(slot));
+		}
+		slot->entries()[index].value = std::move(entry->value);
+	}
+
+	void assign(Node*& slot, unsigned shift, Entry* entry, bool* added)
+	{
+		Node* node = slot;
+		const bool unique = is_unique(node);
+
+		if (shift >= HASH_BITS) {
+			for (uint32_t i = 0; i < node->num_entries; ++i) {
+				if (_eq(node->entries()[i].key, entry->key)) {
+					assign_value(slot, i, entry);
+					return;
+				}
+			}
+			replace(slot, rebuild(node, unique, 0, 0, NONE, entry, node->num_entries, NONE, nullptr, 0));
+			*added = true;
+			return;
+		}
+
+		const uint32_t bit = slot_bit(entry->hash_value, shift);
+		if (node->data_map & bit) {
+			const size_t index = index_of(node->data_map, bit);
+			Entry& existing = node->entries()[index];
+			if (existing.hash_value == entry->hash_value && _eq(existing.key, entry->key)) {
+				assign_value(slot, index, entry);
+				return;
+			}
+			// Push both entries down to a new child node:
+			Entry pushed_down(unique ? Entry(std::move(existing)) : Entry(existing));
+			Node* child = make_pair_node(shift + BITS_PER_LEVEL, &pushed_down, entry);
+			const uint32_t node_map = node->node_map | bit;
+			replace(slot, rebuild(node, unique, node->data_map ^ bit, node_map,
+				index, nullptr, 0, NONE, child, index_of(node_map, bit)));
+			*added = true;
+		} else if (node->node_map & bit) {
+			if (!unique) {
+				node = clone(node);
+				replace(slot, node);
+			}
+			assign(node->children()[index_of(node->node_map, bit)], shift + BITS_PER_LEVEL, entry, added);
+		} else {
+			const uint32_t data_map = node->data_map | bit;
+			replace(slot, rebuild(node, unique, data_map, node->node_map,
+				NONE, entry, index_of(data_map, bit), NONE, nullptr, 0));
+			*added = true;
+		}
+	}
+
+	// The key must be in the map, and not be the only key.
+	void erase(Node*& slot, unsigned shift, size_t hash_value, const KeyT& key)
+	{
+		Node* node = slot;
+		const bool unique = is_unique(node);
+
+		if (shift >= HASH_BITS) {
+			for (uint32_t i = 0; i < node->num_entries; ++i) {
+				if (_eq(node->entries()[i].key, key)) {
+					replace(slot, rebuild(node, unique, 0, 0, i, nullptr, 0, NONE, nullptr, 0));
+					return;
+				}
+			}
+			return;
+		}
+
+		const uint32_t bit = slot_bit(hash_value, shift);
+		if (node->data_map & bit) {
+			replace(slot, rebuild(node, unique, node->data_map ^ bit, node->node_map,
+				index_of(node->data_map, bit), nullptr, 0, NONE, nullptr, 0));
+			return;
+		}
+
+		if (!unique) {
+			node = clone(node);
+			replace(slot, node);
+		}
+		const size_t child_index = index_of(node->node_map, bit);
+		erase(node->children()[child_index], shift + BITS_PER_LEVEL, hash_value, key);
+
+		// Keep the trie canonical: pull a lone entry up into this node.
+		Node* child = node->children()[child_index]; // Unique after erase.
+		if (child->num_children == 0 && child->num_entries <= 1) {
+			const uint32_t data_map = child->num_entries == 1 ? (node->data_map | bit) : node->data_map;
+			Entry* entry = child->num_entries == 1 ? child->entries() : nullptr;
+			replace(slot, rebuild(node, true, data_map, node->node_map ^ bit,
+				NONE, entry, index_of(data_map, bit), child_index, nullptr, 0));
+		}
+	}
+
+	static uint32_t slot_bit(size_t hash_value, unsigned shift)
+	{
+		return 1u << ((hash_value >> shift) & 31);
+	}
+
+	// Index into the entries or children of the slot with this bit.
+	static size_t index_of(uint32_t map, uint32_t bit)
+	{
+		return static_cast<size_t>(hash_detail::popcount(map & (bit - 1)));
+	}
+
+	size_t hash_key(const KeyT& key) const
+	{
+		return hash_mix(_hasher(key));
+	}
+
+	template<typename Func>
+	static void for_each(const Node* node, const Func& fn)
+	{
+		for (uint32_t i = 0; i < node->num_entries; ++i) {
+			fn(node->entries()[i].key, node->entries()[i].value);
+		}
+		for (uint32_t i = 0; i < node->num_children; ++i) {
+			for_each(node->children()[i], fn);
+		}
+	}
+
+	Node*  _root = nullptr; // nullptr when empty
+	size_t _size = 0;
+	HashT  _hasher;
+	EqT    _eq;
+};
+
+} // namespace emilib
@@ -0,0 +1,150 @@
+// By Emil Ernerfeldt 2014-2017
+// LICENSE:
+//   This software is dual-licensed to the public domain and under the following
+//   license: you are granted a perpetual, irrevocable license to copy, modify,
+//   publish, and distribute this file as you see fit.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include <loguru.hpp>
+
+namespace emilib {
+
+/// The current version of a value that is read by many threads and replaced now and then.
+///
+/// Readers call load() and get a reference-counted, immutable snapshot which stays valid and
+/// unchanged for as long as they hold on to it, no matter what the writers do.
+/// load() never locks: it is a handful of atomic operations, and a reader only retries one of them
+/// if another reader or a writer touched the same word meanwhile.
+/// Writers build the next version and publish it with store() or update(). Writers take turns, but
+/// never wait for readers.
+///
+/// With T = PersistentHashMap an update only copies the nodes on the path to the changed keys:
+///     emilib::SharedSnapshot<emilib::PersistentHashMap<std::string, Route>> routes;
+///     // Readers:
+///     auto snapshot = routes.load();
+///     if (const Route* route = snapshot->try_get(path)) { ... }
+///     // Writers:
+///     routes.update([&](auto& map) { map.insert_or_assign(path, route); });
+template<typename T>
+class SharedSnapshot
+{
+public:
+	SharedSnapshot() : SharedSnapshot(T()) { }
+
+	explicit SharedSnapshot(T value)
+		: _current(pack(new Version(std::make_shared<const T>(std::move(value)))))
+	{
+	}
+
+	~SharedSnapshot()
+	{
+		// Nobody can be in load() any more, so there are no readers to wait for:
+		delete version_of(_current.load());
+	}
+
+	/// The current version.
+	std::shared_ptr<const T> load() const
+	{
+		// Announce ourselves in the count next to the pointer, so that the version can't be deleted
+		// while we copy its shared_ptr (copying a shared_ptr is just an atomic increment):
+		const uint64_t current = _current.fetch_add(ONE_READER, std::memory_order_acquire);
+		Version* version = version_of(current);
+		std::shared_ptr<const T> snapshot = version->value;
+		release(version);
+		return snapshot;
+	}
+
+	/// Replace the current version.
+	void store(T value)
+	{
+		std::lock_guard<std::mutex> lock(_write_mutex);
+		publish(std::make_shared<const T>(std::move(value)));
+	}
+
+	/// Call fn on a copy of the current version, then publish the copy.
+	/// Writers take turns, so fn is called exactly once, and no update is lost.
+	template<typename Func>
+	void update(const Func& fn)
+	{
+		std::lock_guard<std::mutex> lock(_write_mutex);
+		// Only writers replace the current version, so it stays put while we hold the lock:
+		std::shared_ptr<T> next = std::make_shared<T>(*version_of(_current.load())->value);
+		fn(*next);
+		publish(std::move(next));
+	}
+
+private:
+	SharedSnapshot(const SharedSnapshot&) = delete;
+	SharedSnapshot& operator=(const SharedSnapshot&) = delete;
+
+	// A published version. It is deleted once it has been replaced and the last reader
+	// that was copying its shared_ptr is done (the snapshots themselves live on in their shared_ptr:s).
+	struct Version
+	{
+		explicit Version(std::shared_ptr<const T> value) : value(std::move(value)) {}
+
+		const std::shared_ptr<const T> value;
+		// Readers that were done after it was replaced count down from zero,
+		// and whoever replaced it adds the number of readers there were at the time.
+		std::atomic<int64_t> num_readers_left{0};
+	};
+
+	// _current holds a Version* in the low POINTER_BITS and the number of readers in load() above those.
+	// Pointers to user space fit in 48 bits on current 64-bit platforms (and in 32 on 32-bit ones).
+	static const int      POINTER_BITS = 48;
+	static const uint64_t POINTER_MASK = (uint64_t(1) << POINTER_BITS) - 1;
+	static const uint64_t ONE_READER   = uint64_t(1) << POINTER_BITS;
+
+	static uint64_t pack(Version* version)
+	{
+		const uint64_t bits = reinterpret_cast<uintptr_t>(version);
+		CHECK_F((bits & ~POINTER_MASK) == 0, "SharedSnapshot: pointer doesn't fit in %d bits", POINTER_BITS);
+		return bits;
+	}
+
+	static Version* version_of(uint64_t current)
+	{
+		return reinterpret_cast<Version*>(static_cast<uintptr_t>(current & POINTER_MASK));
+	}
+
+	static uint64_t num_readers(uint64_t current) { return current >> POINTER_BITS; }
+
+	// Undo the fetch_add in load().
+	void release(Version* version) const
+	{
+		uint64_t current = _current.load(std::memory_order_relaxed);
+		while (version_of(current) == version) {
+			// Still current. A replaced version is never published again, so this is not an ABA problem.
+			if (_current.compare_exchange_weak(current, current - ONE_READER, std::memory_order_release, std::memory_order_relaxed)) {
+				return;
+			}
+		}
+		// Replaced while we were reading it, and the writer moved our count to num_readers_left:
+		if (version->num_readers_left.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			delete version;
+		}
+	}
+
+	// Call with _write_mutex locked.
+	void publish(std::shared_ptr<const T> value)
+	{
+		const uint64_t previous = _current.exchange(pack(new Version(std::move(value))), std::memory_order_acq_rel);
+		Version* replaced = version_of(previous);
+		const int64_t readers = static_cast<int64_t>(num_readers(previous));
+		if (replaced->num_readers_left.fetch_add(readers, std::memory_order_acq_rel) == -readers) {
+			delete replaced; // All its readers are done already.
+		}
+	}
+
+	mutable std::atomic<uint64_t> _current;
+	std::mutex                    _write_mutex;
+};
+
+} // namespace emilib
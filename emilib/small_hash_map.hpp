@@ -0,0 +1,479 @@
+// By Emil Ernerfeldt 2014-2017
+// LICENSE:
+//   This software is dual-licensed to the public domain and under the following
+//   license: you are granted a perpetual, irrevocable license to copy, modify,
+//   publish, and distribute this file as you see fit.
+
+#pragma once
+
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <loguru.hpp>
+
+#include "hash_map.hpp"
+
+namespace emilib {
+
+/// A hash map which stores up to N elements inline, without any heap allocations.
+/// When it grows past N elements it moves them all to a HashMap, and stays that way until clear().
+///
+/// While small, lookups compare a 7-bit hash fragment of the key against all inline elements at once
+/// (16 at a time with SSE2), and only call EqT on matching fragments.
+/// Erasing moves the last element into the hole, so the inline elements are always packed.
+///
+/// Use it for the many tiny maps of e.g. an entity system, where a HashMap would allocate
+/// on the first insertion, and ListMap gets slow if a map happens to grow.
+///
+/// Iterators and references are invalidated by insertions and erasures.
+/// PolicyT is for the HashMap used when big (split_storage is not supported).
+template <typename KeyT, typename ValueT, size_t N = 8, typename HashT = std::hash<KeyT>, typename EqT = HashMapEqualTo<KeyT>, typename PolicyT = HashPolicy>
+class SmallHashMap
+{
+private:
+	using PairT = std::pair<KeyT, ValueT>;
+	using Map   = HashMap<KeyT, ValueT, HashT, EqT, PolicyT>;
+
+	static_assert(N > 0, "N must be positive");
+	static_assert(!PolicyT::split_storage, "SmallHashMap does not support split_storage");
+
+	// Round up, so that we can always load full groups of fragments.
+	static const size_t NUM_FRAGMENTS = (N + hash_detail::GROUP_WIDTH - 1) / hash_detail::GROUP_WIDTH * hash_detail::GROUP_WIDTH;
+
+public:
+	using size_type       = size_t;
+	using value_type      = PairT;
+	using reference       = PairT&;
+	using const_reference = const PairT&;
+
+	/// Points to an inline element, or wraps a HashMap iterator.
+	class iterator
+	{
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using difference_type   = size_t;
+		using distance_type     = size_t;
+		using value_type        = PairT;
+		using pointer           = PairT*;
+		using reference         = PairT&;
+
+		iterator() { }
+		explicit iterator(PairT* pair) : _pair(pair) { }
+		explicit iterator(typename Map::iterator it) : _it(it) { }
+
+		iterator& operator++()
+		{
+			if (_pair) { ++_pair; } else { ++_it; }
+			return *this;
+		}
+
+		iterator operator++(int)
+		{
+			iterator old = *this;
+			++*this;
+			return old;
+		}
+
+		reference operator*() const { return _pair ? *_pair : *_it; }
+		pointer operator->() const { return _pair ? _pair : &*_it; }
+
+		bool operator==(const iterator& rhs) const
+		{
+			return _pair == rhs._pair && (_pair || _it == rhs._it);
+		}
+
+		bool operator!=(const iterator& rhs) const { return !(*this == rhs); }
+
+	//private:
+	public:
+		PairT*                 _pair = nullptr;
+		typename Map::iterator _it;
+	};
+
+	class const_iterator
+	{
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using difference_type   = size_t;
+		using distance_type     = size_t;
+		using value_type        = const PairT;
+		using pointer           = const PairT*;
+		using reference         = const PairT&;
+
+		const_iterator() { }
+		const_iterator(iterator proto) : _pair(proto._pair), _it(proto._it) { }
+		explicit const_iterator(const PairT* pair) : _pair(pair) { }
+		explicit const_iterator(typename Map::const_iterator it) : _it(it) { }
+
+		const_iterator& operator++()
+		{
+			if (_pair) { ++_pair; } else { ++_it; }
+			return *this;
+		}
+
+		const_iterator operator++(int)
+		{
+			const_iterator old = *this;
+			++*this;
+			return old;
+		}
+
+		reference operator*() const { return _pair ? *_pair : *_it; }
+		pointer operator->() const { return _pair ? _pair : &*_it; }
+
+		bool operator==(const const_iterator& rhs) const
+		{
+			return _pair == rhs._pair && (_pair || _it == rhs._it);
+		}
+
+		bool operator!=(const const_iterator& rhs) const { return !(*this == rhs); }
+
+	//private:
+	public:
+		const PairT*                 _pair = nullptr;
+		typename Map::const_iterator _it;
+	};
+
+	// ------------------------------------------------------------------------
+
+	SmallHashMap()
+	{
+		std::fill_n(_fragments, NUM_FRAGMENTS, hash_detail::INACTIVE);
+	}
+
+	SmallHashMap(const SmallHashMap& other) : SmallHashMap()
+	{
+		*this = other;
+	}
+
+	SmallHashMap(SmallHashMap&& other) : SmallHashMap()
+	{
+		*this = std::move(other);
+	}
+
+	SmallHashMap& operator=(const SmallHashMap& other)
+	{
+		if (this != &other) {
+			clear();
+			if (other._is_small) {
+				for (size_t i = 0; i < other._num_small; ++i) {
+					new(small_pairs() + i) PairT(other.small_pairs()[i]);
+					_fragments[i] = other._fragments[i];
+					_num_small += 1;
+				}
+			} else {
+				_map = other._map;
+				_is_small = false;
+			}
+		}
+		return *this;
+	}
+
+	SmallHashMap& operator=(SmallHashMap&& other)
+	{
+		if (this != &other) {
+			clear();
+			if (other._is_small) {
+				for (size_t i = 0; i < other._num_small; ++i) {
+					new(small_pairs() + i) PairT(std::move(other.small_pairs()[i]));
+					_fragments[i] = other._fragments[i];
+					_num_small += 1;
+				}
+			} else {
+				_map = std::move(other._map);
+				_is_small = false;
+			}
+			other.clear();
+		}
+		return *this;
+	}
+
+	~SmallHashMap()
+	{
+		destroy_small();
+	}
+
+	// -------------------------------------------------------------
+
+	iterator begin() { return _is_small ? iterator(small_pairs()) : iterator(_map.begin()); }
+	iterator end()   { return _is_small ? iterator(small_pairs() + _num_small) : iterator(_map.end()); }
+
+	const_iterator cbegin() const { return _is_small ? const_iterator(small_pairs()) : const_iterator(_map.cbegin()); }
+	const_iterator cend()   const { return _is_small ? const_iterator(small_pairs() + _num_small) : const_iterator(_map.cend()); }
+
+	const_iterator begin() const { return cbegin(); }
+	const_iterator end()   const { return cend(); }
+
+	size_t size() const { return _is_small ? _num_small : _map.size(); }
+	bool empty() const { return size() == 0; }
+
+	/// True while the elements are stored inline.
+	bool is_small() const { return _is_small; }
+
+	/// How many elements we can store without allocating.
+	static constexpr size_t inline_capacity() { return N; }
+
+	// ------------------------------------------------------------
+
+	iterator find(const KeyT& key)
+	{
+		if (!_is_small) { return iterator(_map.find(key)); }
+		const size_t index = find_small(key, small_fragment(key));
+		return index == (size_t)-1 ? end() : iterator(small_pairs() + index);
+	}
+
+	const_iterator find(const KeyT& key) const
+	{
+		if (!_is_small) { return const_iterator(_map.find(key)); }
+		const size_t index = find_small(key, small_fragment(key));
+		return index == (size_t)-1 ? end() : const_iterator(small_pairs() + index);
+	}
+
+	bool contains(const KeyT& key) const
+	{
+		return try_get(key) != nullptr;
+	}
+
+	size_t count(const KeyT& key) const
+	{
+		return contains(key) ? 1 : 0;
+	}
+
+	/// Returns the matching ValueT or nullptr if k isn't found.
+	ValueT* try_get(const KeyT& key)
+	{
+		if (!_is_small) { return _map.try_get(key); }
+		const size_t index = find_small(key, small_fragment(key));
+		return index == (size_t)-1 ? nullptr : &small_pairs()[index].second;
+	}
+
+	/// Const version of the above
+	const ValueT* try_get(const KeyT& key) const
+	{
+		if (!_is_small) { return _map.try_get(key); }
+		const size_t index = find_small(key, small_fragment(key));
+		return index == (size_t)-1 ? nullptr : &small_pairs()[index].second;
+	}
+
+	// -----------------------------------------------------
+
+	/// Returns a pair consisting of an iterator to the inserted element
+	/// (or to the element that prevented the insertion)
+	/// and a bool denoting whether the insertion took place.
+	std::pair<iterator, bool> insert(const KeyT& key, const ValueT& value)
+	{
+		return try_emplace(key, value);
+	}
+
+	/// Same as above, but moves the key and value into the map.
+	/// Nothing is moved from if the key was already in the map.
+	std::pair<iterator, bool> insert(KeyT&& key, ValueT&& value)
+	{
+		return try_emplace(std::move(key), std::move(value));
+	}
+
+	std::pair<iterator, bool> insert(const PairT& p)
+	{
+		return try_emplace(p.first, p.second);
+	}
+
+	std::pair<iterator, bool> insert(PairT&& p)
+	{
+		return try_emplace(std::move(p.first), std::move(p.second));
+	}
+
+	/// If the key is not in the map, insert an element with a ValueT constructed from args.
+	/// Otherwise do nothing: neither key nor args are moved from.
+	/// Returns an iterator to the element with this key, and whether it was inserted.
+	template<typename... Args>
+	std::pair<iterator, bool> try_emplace(const KeyT& key, Args&&... args)
+	{
+		return emplace_impl(key, std::forward<Args>(args)...);
+	}
+
+	/// Same as above, but moves the key into the map on insertion.
+	template<typename... Args>
+	std::pair<iterator, bool> try_emplace(KeyT&& key, Args&&... args)
+	{
+		return emplace_impl(std::move(key), std::forward<Args>(args)...);
+	}
+
+	/// Insert the value, or assign it to the existing element with this key.
+	/// Returns an iterator to the element, and true if it was inserted rather than assigned.
+	template<typename V>
+	std::pair<iterator, bool> insert_or_assign(const KeyT& key, V&& value)
+	{
+		auto result = try_emplace(key, std::forward<V>(value));
+		if (!result.second) {
+			result.first->second = std::forward<V>(value);
+		}
+		return result;
+	}
+
+	/// Same as above, but moves the key into the map on insertion.
+	template<typename V>
+	std::pair<iterator, bool> insert_or_assign(KeyT&& key, V&& value)
+	{
+		auto result = try_emplace(std::move(key), std::forward<V>(value));
+		if (!result.second) {
+			result.first->second = std::forward<V>(value);
+		}
+		return result;
+	}
+
+	/// Like std::map<KeyT,ValueT>::operator[].
+	ValueT& operator[](const KeyT& key)
+	{
+		return try_emplace(key).first->second;
+	}
+
+	/// Same as above, but moves the key into the map on insertion.
+	ValueT& operator[](KeyT&& key)
+	{
+		return try_emplace(std::move(key)).first->second;
+	}
+
+	// -------------------------------------------------------
+
+	/// Erase an element from the map.
+	/// return false if element was not found
+	bool erase(const KeyT& key)
+	{
+		if (!_is_small) { return _map.erase(key); }
+		const size_t index = find_small(key, small_fragment(key));
+		if (index == (size_t)-1) {
+			return false;
+		}
+		erase_small(index);
+		return true;
+	}
+
+	/// Erase an element using an iterator.
+	/// Returns an iterator to the next element (or end()).
+	iterator erase(iterator it)
+	{
+		if (!_is_small) { return iterator(_map.erase(it._it)); }
+		DCHECK_F(small_pairs() <= it._pair && it._pair < small_pairs() + _num_small);
+		erase_small(static_cast<size_t>(it._pair - small_pairs()));
+		return it; // The last element was moved into this slot
+	}
+
+	/// Remove all elements and free the heap memory, if any.
+	void clear()
+	{
+		destroy_small();
+		if (!_is_small) {
+			Map().swap(_map);
+			_is_small = true;
+		}
+	}
+
+	/// Make room for this many elements.
+	/// Moves the elements to the heap if num_elems > N.
+	void reserve(size_t num_elems)
+	{
+		if (num_elems > N) {
+			if (_is_small) {
+				move_to_map(num_elems);
+			} else {
+				_map.reserve(num_elems);
+			}
+		}
+	}
+
+private:
+	PairT* small_pairs() { return reinterpret_cast<PairT*>(&_small); }
+	const PairT* small_pairs() const { return reinterpret_cast<const PairT*>(&_small); }
+
+	// Always mixed, so that e.g. the identity std::hash<int> still gives useful fragments.
+	uint8_t small_fragment(const KeyT& key) const
+	{
+		return hash_detail::hash_fragment(hash_mix(_hasher(key)));
+	}
+
+	size_t find_small(const KeyT& key, uint8_t fragment) const
+	{
+		for (size_t group = 0; group < _num_small; group += hash_detail::GROUP_WIDTH) {
+			uint32_t matches = hash_detail::HashGroup(_fragments + group).match(fragment);
+			while (matches) {
+				const size_t index = group + static_cast<size_t>(hash_detail::lowest_bit_index(matches));
+				if (index < _num_small && _eq(small_pairs()[index].first, key)) {
+					return index;
+				}
+				matches &= matches - 1;
+			}
+		}
+		return (size_t)-1;
+	}
+
+	template<typename K, typename... Args>
+	std::pair<iterator, bool> emplace_impl(K&& key, Args&&... args)
+	{
+		if (_is_small) {
+			const uint8_t fragment = small_fragment(key);
+			const size_t index = find_small(key, fragment);
+			if (index != (size_t)-1) {
+				return { iterator(small_pairs() + index), false };
+			}
+			if (_num_small < N) {
+				PairT* pair = small_pairs() + _num_small;
+				new(pair) PairT(std::piecewise_construct,
+					std::forward_as_tuple(std::forward<K>(key)),
+					std::forward_as_tuple(std::forward<Args>(args)...));
+				_fragments[_num_small] = fragment;
+				_num_small += 1;
+				return { iterator(pair), true };
+			}
+			move_to_map(2 * N);
+		}
+		auto result = _map.try_emplace(std::forward<K>(key), std::forward<Args>(args)...);
+		return { iterator(result.first), result.second };
+	}
+
+	void move_to_map(size_t num_elems)
+	{
+		DCHECK_F(_is_small);
+		_map.reserve(num_elems);
+		for (size_t i = 0; i < _num_small; ++i) {
+			PairT& pair = small_pairs()[i];
+			_map.insert_unique(std::move(pair.first), std::move(pair.second));
+		}
+		destroy_small();
+		_is_small = false;
+	}
+
+	void erase_small(size_t index)
+	{
+		PairT* pairs = small_pairs();
+		const size_t last = _num_small - 1;
+		if (index != last) {
+			pairs[index].~PairT();
+			new(pairs + index) PairT(std::move(pairs[last]));
+			_fragments[index] = _fragments[last];
+		}
+		pairs[last].~PairT();
+		_fragments[last] = hash_detail::INACTIVE;
+		_num_small -= 1;
+	}
+
+	void destroy_small()
+	{
+		for (size_t i = 0; i < _num_small; ++i) {
+			small_pairs()[i].~PairT();
+			_fragments[i] = hash_detail::INACTIVE;
+		}
+		_num_small = 0;
+	}
+
+	HashT   _hasher;
+	EqT     _eq;
+	bool    _is_small  = true;
+	size_t  _num_small = 0;
+	uint8_t _fragments[NUM_FRAGMENTS]; // One per inline element, INACTIVE for unused slots.
+	typename std::aligned_storage<sizeof(PairT) * N, alignof(PairT)>::type _small;
+	Map     _map; // Only used when !_is_small. Does not allocate until then.
+};
+
+} // namespace emilib
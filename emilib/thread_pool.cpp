@@ -7,11 +7,176 @@
 #include "thread_pool.hpp"
 
 #include <algorithm>
+#include <cstdlib>
+
+#ifdef _MSC_VER
+    #include <intrin.h>
+#endif
 
 #include <loguru.hpp>
 
 namespace emilib {
 
+namespace pool_detail {
+
+FreeList::FreeList(size_t block_size)
+    : _stride(HEADER_SIZE + (block_size + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t))
+{
+    static_assert(sizeof(Header) <= HEADER_SIZE, "The header must fit before the block");
+    for (auto& chunk : _chunks) {
+        chunk = nullptr;
+    }
+}
+
+FreeList::~FreeList()
+{
+    for (auto& chunk : _chunks) {
+        std::free(chunk.load());
+    }
+}
+
+FreeList::Header* FreeList::header_at(uint32_t index) const
+{
+    // Chunk i starts at index FIRST_CHUNK_SIZE * (2^i - 1):
+    const uint32_t scaled = index / FIRST_CHUNK_SIZE + 1;
+#ifdef _MSC_VER
+    unsigned long chunk_nr;
+    _BitScanReverse(&chunk_nr, scaled);
+#else
+    const size_t chunk_nr = 31 - __builtin_clz(scaled);
+#endif
+    const size_t offset = index - FIRST_CHUNK_SIZE * ((size_t(1) << chunk_nr) - 1);
+    return reinterpret_cast<Header*>(_chunks[chunk_nr].load(std::memory_order_acquire) + offset * _stride);
+}
+
+void* FreeList::allocate()
+{
+    uint64_t head = _head.load(std::memory_order_acquire);
+    while (true) {
+        const uint32_t first = static_cast<uint32_t>(head);
+        if (first == 0) {
+            grow();
+            head = _head.load(std::memory_order_acquire);
+            continue;
+        }
+        Header* header = header_at(first - 1);
+        // If someone else takes this block before us, the tag will have changed and the exchange fails:
+        const uint64_t new_head = ((head >> 32) + 1) << 32 | header->next_free.load(std::memory_order_relaxed);
+        if (_head.compare_exchange_weak(head, new_head, std::memory_order_acquire, std::memory_order_acquire)) {
+            return reinterpret_cast<char*>(header) + HEADER_SIZE;
+        }
+    }
+}
+
+void FreeList::deallocate(void* block)
+{
+    Header* header = reinterpret_cast<Header*>(static_cast<char*>(block) - HEADER_SIZE);
+    uint64_t head = _head.load(std::memory_order_relaxed);
+    while (true) {
+        header->next_free.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+        const uint64_t new_head = ((head >> 32) + 1) << 32 | (header->index + 1);
+        if (_head.compare_exchange_weak(head, new_head, std::memory_order_release, std::memory_order_relaxed)) {
+            return;
+        }
+    }
+}
+
+void FreeList::grow()
+{
+    std::lock_guard<std::mutex> lock(_grow_mutex);
+    if (static_cast<uint32_t>(_head.load()) != 0) {
+        return; // Someone else grew it, or freed a block, while we waited for the lock.
+    }
+    CHECK_LT_F(_num_chunks, MAX_CHUNKS, "FreeList: too many blocks in use");
+    const size_t chunk_size  = FIRST_CHUNK_SIZE << _num_chunks;
+    const size_t first_index = FIRST_CHUNK_SIZE * ((size_t(1) << _num_chunks) - 1);
+    char* chunk = static_cast<char*>(std::malloc(chunk_size * _stride));
+    CHECK_NOTNULL_F(chunk);
+    _chunks[_num_chunks].store(chunk, std::memory_order_release);
+    _num_chunks += 1;
+
+    // Link the new blocks to each other, then put them all on the list at once:
+    for (size_t i = 0; i < chunk_size; ++i) {
+        Header* header = new (chunk + i * _stride) Header();
+        header->index = static_cast<uint32_t>(first_index + i);
+        header->next_free.store(i + 1 < chunk_size ? header->index + 2 : 0, std::memory_order_relaxed);
+    }
+    Header* last = reinterpret_cast<Header*>(chunk + (chunk_size - 1) * _stride);
+    uint64_t head = _head.load(std::memory_order_relaxed);
+    while (true) {
+        last->next_free.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+        const uint64_t new_head = ((head >> 32) + 1) << 32 | (first_index + 1);
+        if (_head.compare_exchange_weak(head, new_head, std::memory_order_release, std::memory_order_relaxed)) {
+            return;
+        }
+    }
+}
+
+namespace {
+
+const size_t RECYCLED_SIZES[] = {64, 128, 256, 512};
+
+// Never destroyed, since futures may be destroyed after static destructors have run.
+FreeList* recycled_blocks(size_t size_class)
+{
+    static FreeList* s_lists[] = {
+        new FreeList(RECYCLED_SIZES[0]), new FreeList(RECYCLED_SIZES[1]),
+        new FreeList(RECYCLED_SIZES[2]), new FreeList(RECYCLED_SIZES[3]),
+    };
+    return s_lists[size_class];
+}
+
+size_t size_class(size_t size)
+{
+    size_t i = 0;
+    while (i < sizeof(RECYCLED_SIZES) / sizeof(RECYCLED_SIZES[0]) && RECYCLED_SIZES[i] < size) {
+        ++i;
+    }
+    return i;
+}
+
+} // namespace
+
+void* allocate_recycled(size_t size)
+{
+    const size_t i = size_class(size);
+    if (i == sizeof(RECYCLED_SIZES) / sizeof(RECYCLED_SIZES[0])) {
+        return ::operator new(size);
+    }
+    return recycled_blocks(i)->allocate();
+}
+
+void deallocate_recycled(void* block, size_t size)
+{
+    const size_t i = size_class(size);
+    if (i == sizeof(RECYCLED_SIZES) / sizeof(RECYCLED_SIZES[0])) {
+        ::operator delete(block);
+    } else {
+        recycled_blocks(i)->deallocate(block);
+    }
+}
+
+} // namespace pool_detail
+
+using pool_detail::JobNode;
+
+// A doubly linked list of JobNode:s, so that pushing and popping never allocates.
+struct ThreadPool::WorkerQueue
+{
+    std::mutex          mutex;
+    JobNode*            front = nullptr;
+    JobNode*            back  = nullptr;
+    std::atomic<size_t> size{0}; // So thieves can skip empty queues without locking them.
+};
+
+namespace {
+
+// The pool and queue of the worker thread we are running on, if any.
+thread_local const ThreadPool* s_current_pool   = nullptr;
+thread_local size_t            s_current_thread = 0;
+
+} // namespace
+
 ThreadPool::ThreadPool() : ThreadPool(std::max(2u, std::thread::hardware_concurrency()))
 {
 }
@@ -19,6 +184,9 @@ ThreadPool::ThreadPool() : ThreadPool(std::max(2u, std::thread::hardware_concurr
 ThreadPool::ThreadPool(size_t num_threads)
 {
     CHECK_NE_F(num_threads, 0u);
+    for (size_t i = 0; i < num_threads; ++i) {
+        _queues.emplace_back(new WorkerQueue());
+    }
     for (size_t i = 0; i < num_threads; ++i) {
         _threads.emplace_back([=](){ _thread_worker(i); });
     }
@@ -26,40 +194,140 @@ ThreadPool::ThreadPool(size_t num_threads)
 
 ThreadPool::~ThreadPool()
 {
+    wait();
+
     {
-        // Stop the threads by posting empty jobs:
-        std::lock_guard<std::mutex> lock(_mutex);
-        for (size_t i = 0; i < _threads.size(); ++i) {
-            _job_queue.push_back({});
-            _new_job_cond.notify_one();
-        }
+        std::lock_guard<std::mutex> lock(_sleep_mutex);
+        _stop = true;
     }
+    _new_job_cond.notify_all();
 
     for (auto& thread : _threads) {
         thread.join();
     }
 }
 
-void ThreadPool::add_void(const Job& job)
+void ThreadPool::_push(JobNode* node)
 {
-    CHECK_F(!!job);
-    std::lock_guard<std::mutex> lock(_mutex);
-    _job_queue.push_back(job);
+    const bool from_worker = _is_worker_thread();
+    WorkerQueue& queue = *_queues[from_worker ? s_current_thread : _next_queue++ % _queues.size()];
+
+    // Count the job before anyone can take it:
     ++_num_unfinished_jobs;
-    _new_job_cond.notify_one();
+    ++_num_queued_jobs;
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        node->prev = queue.back;
+        node->next = nullptr;
+        (queue.back ? queue.back->next : queue.front) = node;
+        queue.back = node;
+        ++queue.size;
+    }
+
+    // A worker about to sleep first stops searching and counts itself as sleeping, then checks _num_queued_jobs
+    // one last time (all seq_cst). So either we see it searching or sleeping, or it sees our job.
+    // If we see another worker searching, that one will in turn see our job before it can go to sleep.
+    if (_num_searching == 0 && _num_sleeping > 0) {
+        _wake_one();
+    }
+}
+
+void ThreadPool::_wake_one()
+{
+    std::lock_guard<std::mutex> lock(_sleep_mutex);
+    if (_num_sleeping > _num_wakeups) {
+        // Count it as searching right away, so that nobody else wakes another one meanwhile:
+        ++_num_searching;
+        ++_num_wakeups;
+        _new_job_cond.notify_one();
+    }
 }
 
 void ThreadPool::wait()
 {
+    CHECK_F(!_is_worker_thread(), "ThreadPool::wait() called from one of its jobs");
     std::unique_lock<std::mutex> lock(_mutex);
     _job_finished_cond.wait(lock, [this]{ return _num_unfinished_jobs == 0; });
 }
 
 void ThreadPool::clear()
 {
-    std::unique_lock<std::mutex> lock(_mutex);
-    _num_unfinished_jobs -= _job_queue.size();
-    _job_queue.clear();
+    size_t num_removed = 0;
+    for (auto& queue : _queues) {
+        JobNode* removed;
+        {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            removed = queue->front;
+            num_removed += queue->size;
+            _num_queued_jobs -= queue->size;
+            queue->front = queue->back = nullptr;
+            queue->size = 0;
+        }
+        // Destroying the jobs may run destructors of things they captured, so don't hold the lock meanwhile:
+        while (removed) {
+            JobNode* next = removed->next;
+            removed->~JobNode();
+            _job_nodes.deallocate(removed);
+            removed = next;
+        }
+    }
+    if (num_removed > 0 && (_num_unfinished_jobs -= num_removed) == 0) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _job_finished_cond.notify_all();
+    }
+}
+
+JobNode* ThreadPool::_try_pop(size_t thread_nr)
+{
+    // Our own queue first, newest job first:
+    for (size_t i = 0; i < _queues.size(); ++i) {
+        WorkerQueue& queue = *_queues[(thread_nr + i) % _queues.size()];
+        if (queue.size == 0) { continue; }
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.front) { continue; }
+        JobNode* node;
+        if (i == 0) {
+            node = queue.back;
+            queue.back = node->prev;
+            (queue.back ? queue.back->next : queue.front) = nullptr;
+        } else {
+            // Steal the oldest job, which is likely to be a big one:
+            node = queue.front;
+            queue.front = node->next;
+            (queue.front ? queue.front->prev : queue.back) = nullptr;
+        }
+        --queue.size;
+        --_num_queued_jobs;
+        return node;
+    }
+    return nullptr;
+}
+
+void ThreadPool::_run(JobNode* node)
+{
+    node->job();
+    node->~JobNode();
+    _job_nodes.deallocate(node);
+
+    if (--_num_unfinished_jobs == 0) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _job_finished_cond.notify_all();
+    }
+}
+
+bool ThreadPool::_is_worker_thread() const
+{
+    return s_current_pool == this;
+}
+
+bool ThreadPool::_run_one_job()
+{
+    JobNode* node = _try_pop(s_current_thread);
+    if (!node) {
+        return false;
+    }
+    _run(node);
+    return true;
 }
 
 void ThreadPool::_thread_worker(size_t thread_nr)
@@ -67,26 +335,66 @@ void ThreadPool::_thread_worker(size_t thread_nr)
     char thread_name[32];
     snprintf(thread_name, sizeof(thread_name) - 1, "pool_worker_%lu", thread_nr);
     loguru::set_thread_name(thread_name);
+    s_current_pool   = this;
+    s_current_thread = thread_nr;
 
+    bool searching = false;
     while (true) {
-        Job job;
-
-        {
-            std::unique_lock<std::mutex> lock(_mutex);
-            _new_job_cond.wait(lock, [this]{ return !_job_queue.empty(); });
-            CHECK_F(!_job_queue.empty());
-            job = std::move(_job_queue.front());
-            _job_queue.pop_front();
+        if (JobNode* node = _try_pop(thread_nr)) {
+            if (searching) {
+                searching = false;
+                // If there is more work, let someone else search for it:
+                if (--_num_searching == 0 && _num_queued_jobs > 0 && _num_sleeping > 0) {
+                    _wake_one();
+                }
+            }
+            _run(node);
+            continue;
         }
 
-        if (!job) { break; }
+        std::unique_lock<std::mutex> lock(_sleep_mutex);
+        if (searching) {
+            searching = false;
+            --_num_searching;
+        }
+        // Count ourselves as sleeping before the last look at _num_queued_jobs. _push counts its job
+        // before it looks at _num_sleeping, so either it sees us sleeping and wakes us, or we see its job.
+        ++_num_sleeping;
+        if (_num_queued_jobs > 0) {
+            // Added after we looked, or we lost the race for it. Look again:
+            --_num_sleeping;
+            searching = true;
+            ++_num_searching;
+            continue;
+        }
+        if (_stop) {
+            --_num_sleeping;
+            break;
+        }
+        _new_job_cond.wait(lock, [this]{ return _num_wakeups > 0 || _stop; });
+        --_num_sleeping;
+        if (_num_wakeups > 0) {
+            // _wake_one already counted us as searching.
+            --_num_wakeups;
+            searching = true;
+        }
+    }
+}
 
-        job();
+// ----------------------------------------------------------------------------
 
-        std::unique_lock<std::mutex> lock(_mutex);
-        --_num_unfinished_jobs;
-        _job_finished_cond.notify_all();
+void TaskGroup::_finish_one()
+{
+    // Lock before counting down, or wait() could return and the group be gone before we notify:
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (--_num_unfinished_jobs == 0) {
+        _done_cond.notify_all();
     }
 }
 
+void TaskGroup::wait()
+{
+    _pool._wait_until(_mutex, _done_cond, [this]{ return _num_unfinished_jobs == 0; });
+}
+
 } // namespace emilib
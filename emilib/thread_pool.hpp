@@ -6,17 +6,208 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
-#include <deque>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <future>
 #include <memory>
 #include <mutex>
+#include <new>
 #include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include <loguru.hpp>
+
 namespace emilib {
 
+template<typename T>
+class Task;
+class TaskGroup;
+namespace task_detail { class TaskStateBase; }
+
+namespace pool_detail {
+
+/// Fixed-size blocks of memory that are reused instead of freed. allocate() and deallocate() are lock-free
+/// (except when allocate() needs to grow, which takes a lock and allocates more blocks than last time).
+/// The blocks are only given back to the system when the FreeList is destroyed.
+class FreeList
+{
+public:
+	/// Blocks of block_size bytes, aligned like std::max_align_t.
+	explicit FreeList(size_t block_size);
+	~FreeList();
+
+	FreeList(const FreeList&) = delete;
+	FreeList& operator=(const FreeList&) = delete;
+
+	void* allocate();
+	void deallocate(void* block);
+
+private:
+	// Each block is preceded by a header, which links it to the next free block.
+	// The links are indices rather than pointers, so that the head can hold a version tag too:
+	// without it a pop could succeed with a stale next (the ABA problem).
+	struct Header
+	{
+		std::atomic<uint32_t> next_free; // index + 1, or 0 for none.
+		uint32_t              index;
+	};
+
+	// The blocks follow their headers at this offset, to keep them aligned:
+	static const size_t HEADER_SIZE      = alignof(std::max_align_t);
+	static const size_t FIRST_CHUNK_SIZE = 64;
+	static const size_t MAX_CHUNKS       = 26; // Chunk i has FIRST_CHUNK_SIZE << i blocks.
+
+	Header* header_at(uint32_t index) const;
+	void grow();
+
+	const size_t          _stride; // Bytes per header + block.
+	std::atomic<uint64_t> _head{0}; // Version tag in the high bits, index + 1 of the first free block in the low.
+	std::atomic<char*>    _chunks[MAX_CHUNKS];
+	size_t                _num_chunks = 0; // Protected by _grow_mutex.
+	std::mutex            _grow_mutex;
+};
+
+/// Blocks from process-wide free lists of a few sizes, or from operator new for bigger ones.
+/// For the shared states of futures and tasks, which may outlive the pool that made them.
+void* allocate_recycled(size_t size);
+void deallocate_recycled(void* block, size_t size);
+
+/// For std::promise and std::allocate_shared.
+template<typename T>
+struct RecyclingAllocator
+{
+	static_assert(alignof(T) <= alignof(std::max_align_t), "Over-aligned types are not supported");
+
+	using value_type = T;
+
+	RecyclingAllocator() = default;
+	template<typename U>
+	RecyclingAllocator(const RecyclingAllocator<U>&) {}
+
+	T* allocate(size_t n) { return static_cast<T*>(allocate_recycled(n * sizeof(T))); }
+	void deallocate(T* ptr, size_t n) { deallocate_recycled(ptr, n * sizeof(T)); }
+};
+
+template<typename T, typename U>
+bool operator==(const RecyclingAllocator<T>&, const RecyclingAllocator<U>&) { return true; }
+
+template<typename T, typename U>
+bool operator!=(const RecyclingAllocator<T>&, const RecyclingAllocator<U>&) { return false; }
+
+inline bool is_set(const std::function<void()>& job) { return !!job; }
+
+template<typename Func>
+bool is_set(const Func&) { return true; }
+
+/// A callable taking no arguments, like std::function<void()>, but stored in place if it fits in INLINE_SIZE bytes.
+/// It may be move-only. It can't be copied or moved itself, since it stays put in its JobNode.
+class InlineJob
+{
+public:
+	static const size_t INLINE_SIZE = 64;
+
+	InlineJob() = default;
+	~InlineJob() { reset(); }
+
+	InlineJob(const InlineJob&) = delete;
+	InlineJob& operator=(const InlineJob&) = delete;
+
+	template<typename Func>
+	void emplace(Func&& fn)
+	{
+		using F = typename std::decay<Func>::type;
+		reset();
+		emplace<F>(std::forward<Func>(fn), std::integral_constant<bool, sizeof(F) <= INLINE_SIZE && alignof(F) <= alignof(Storage)>());
+	}
+
+	void operator()() { _ops->call(&_storage); }
+
+	void reset()
+	{
+		if (_ops) {
+			_ops->destroy(&_storage);
+			_ops = nullptr;
+		}
+	}
+
+private:
+	using Storage = typename std::aligned_storage<INLINE_SIZE, alignof(std::max_align_t)>::type;
+
+	struct Ops
+	{
+		void (*call)(void* storage);
+		void (*destroy)(void* storage);
+	};
+
+	template<typename F>
+	struct InlineOps
+	{
+		static void call(void* storage) { (*static_cast<F*>(storage))(); }
+		static void destroy(void* storage) { static_cast<F*>(storage)->~F(); }
+		static const Ops ops;
+	};
+
+	// Too big to fit: the storage holds a pointer to it.
+	template<typename F>
+	struct HeapOps
+	{
+		static void call(void* storage) { (**static_cast<F**>(storage))(); }
+		static void destroy(void* storage) { delete *static_cast<F**>(storage); }
+		static const Ops ops;
+	};
+
+	template<typename F, typename Func>
+	void emplace(Func&& fn, std::true_type)
+	{
+		new (&_storage) F(std::forward<Func>(fn));
+		_ops = &InlineOps<F>::ops;
+	}
+
+	template<typename F, typename Func>
+	void emplace(Func&& fn, std::false_type)
+	{
+		new (&_storage) F*(new F(std::forward<Func>(fn)));
+		_ops = &HeapOps<F>::ops;
+	}
+
+	Storage    _storage;
+	const Ops* _ops = nullptr;
+};
+
+template<typename F>
+const InlineJob::Ops InlineJob::InlineOps<F>::ops = { &InlineOps<F>::call, &InlineOps<F>::destroy };
+
+template<typename F>
+const InlineJob::Ops InlineJob::HeapOps<F>::ops = { &HeapOps<F>::call, &HeapOps<F>::destroy };
+
+/// A queued job, linked to its neighbors in the queue.
+struct JobNode
+{
+	InlineJob job;
+	JobNode*  prev = nullptr;
+	JobNode*  next = nullptr;
+};
+
+} // namespace pool_detail
+
+/// Each worker thread has its own queue of jobs. A job added from a worker goes to the back of that
+/// worker's queue, and a job added from any other thread goes to the queues in turn.
+/// A worker takes jobs from the back of its own queue (the most recently added ones, which are likely to be
+/// in its cache), and when that is empty it steals from the front of the others.
+/// This way workers rarely touch the same lock, even with many workers and short jobs.
+///
+/// wait() waits for every job in the pool. To wait for only some of them, or to run a job
+/// when others are done, use add_task (below) or a TaskGroup.
+///
+/// Adding a job doesn't allocate (once the pool has been in use for a while) as long as the job
+/// captures at most 64 bytes: the queues are linked lists of nodes from a lock-free FreeList, which
+/// store the job in place. Futures and tasks are allocated from process-wide free lists.
 class ThreadPool
 {
 public:
@@ -32,38 +223,435 @@ public:
 	~ThreadPool();
 
 	/// Wait for all jobs to finish.
+	/// Don't call this from a job (it would wait for itself).
 	void wait();
 
 	/// Remove all jobs in the queue (but those that have already started will still finish).
 	void clear();
 
 	/// Add to queue and return immediately.
-	void add_void(const Job& job);
+	template<typename Func>
+	void add_void(Func&& job)
+	{
+		CHECK_F(pool_detail::is_set(job));
+		pool_detail::JobNode* node = new (_job_nodes.allocate()) pool_detail::JobNode();
+		node->job.emplace(std::forward<Func>(job));
+		_push(node);
+	}
 
 	/// Add to queue and return immediately.
-	template<typename Result>
-	std::future<Result> add(std::function<Result()> job)
+	template<typename Result, typename Func>
+	std::future<Result> add(Func job)
 	{
-		const auto promise = std::make_shared<std::promise<Result>>();
-		std::future<Result> future = promise->get_future();
-		add_void([=]() {
-			promise->set_value(job());
+		std::promise<Result> promise(std::allocator_arg, pool_detail::RecyclingAllocator<Result>());
+		std::future<Result> future = promise.get_future();
+		add_void([promise = std::move(promise), job]() mutable {
+			promise.set_value(job());
 		});
 		return future;
 	}
 
+	/// Add to queue and return immediately. Use the returned Task to wait for fn(),
+	/// get its result, or to run more jobs after it with then().
+	template<typename Func>
+	auto add_task(Func fn) -> Task<decltype(fn())>;
+
+	size_t num_threads() const { return _threads.size(); }
+
 	// TODO: add way to add jobs to front of queue.
-	// TODO: add way to add job after waiting for for empty queue first.
 
 private:
+	friend class TaskGroup;
+	friend class task_detail::TaskStateBase;
+
+	struct WorkerQueue;
+
+	void _push(pool_detail::JobNode* node);
 	void _thread_worker(size_t thread_nr);
+	pool_detail::JobNode* _try_pop(size_t thread_nr);
+	void _run(pool_detail::JobNode* node);
+	void _wake_one();
+	bool _is_worker_thread() const;
+	bool _run_one_job();
+
+	// Blocks until is_done(), which is called with mutex locked. Whoever makes it true must notify cond.
+	// On one of our workers this runs other jobs meanwhile, so jobs waiting for jobs can't block every worker.
+	template<typename IsDone>
+	void _wait_until(std::mutex& mutex, std::condition_variable& cond, const IsDone& is_done)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		if (!_is_worker_thread()) {
+			cond.wait(lock, is_done);
+			return;
+		}
+		while (!is_done()) {
+			lock.unlock();
+			const bool ran_job = _run_one_job();
+			lock.lock();
+			if (!ran_job) {
+				// What we wait for runs on another thread. Check back now and then in case it adds jobs.
+				cond.wait_for(lock, std::chrono::milliseconds(1), is_done);
+			}
+		}
+	}
+
+	pool_detail::FreeList                     _job_nodes{sizeof(pool_detail::JobNode)};
+	std::vector<std::thread>                  _threads;
+	std::vector<std::unique_ptr<WorkerQueue>> _queues; // One per thread.
+	std::atomic<size_t>                       _next_queue{0};           // For jobs added from outside the pool.
+	std::atomic<size_t>                       _num_queued_jobs{0};      // Jobs in any of the queues.
+	std::atomic<size_t>                       _num_unfinished_jobs{0};  // Queued or running.
+
+	// Idle workers sleep on _new_job_cond. A woken worker is searching for a job until it finds one.
+	// While one is, there is no need to wake another, so a burst of new jobs doesn't wake every worker at once.
+	std::mutex                                _sleep_mutex;
+	std::atomic<size_t>                       _num_sleeping{0};
+	std::atomic<size_t>                       _num_searching{0};
+	size_t                                    _num_wakeups = 0;  // Protected by _sleep_mutex.
+	bool                                      _stop        = false; // Protected by _sleep_mutex.
+	std::condition_variable                   _new_job_cond;
+
+	// wait() sleeps on _job_finished_cond, which is notified when _num_unfinished_jobs reaches zero:
+	std::mutex                                _mutex;
+	std::condition_variable                   _job_finished_cond;
+};
+
+namespace task_detail {
+
+template<typename T>
+struct TaskResult { using type = const T&; };
+
+template<>
+struct TaskResult<void> { using type = void; };
+
+// Room for the result of a task, set at most once.
+template<typename T>
+class TaskValue
+{
+public:
+	TaskValue() = default;
+	TaskValue(const TaskValue&) = delete;
+	TaskValue& operator=(const TaskValue&) = delete;
+
+	~TaskValue()
+	{
+		if (_has_value) {
+			get().~T();
+		}
+	}
+
+	template<typename Func>
+	void set_from(Func& fn)
+	{
+		new (&_storage) T(fn());
+		_has_value = true;
+	}
+
+	const T& get() const { return *reinterpret_cast<const T*>(&_storage); }
+
+private:
+	typename std::aligned_storage<sizeof(T), alignof(T)>::type _storage;
+	bool _has_value = false;
+};
+
+template<>
+class TaskValue<void>
+{
+public:
+	template<typename Func>
+	void set_from(Func& fn) { fn(); }
+
+	void get() const {}
+};
+
+class TaskStateBase
+{
+public:
+	explicit TaskStateBase(ThreadPool& pool) : pool(pool) {}
+
+	bool is_done() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _done;
+	}
+
+	void wait()
+	{
+		pool._wait_until(_mutex, _done_cond, [this]{ return _done; });
+	}
+
+	ThreadPool& pool;
+
+protected:
+	mutable std::mutex      _mutex;
+	std::condition_variable _done_cond;
+	bool                    _done = false; // Protected by _mutex.
+};
+
+/// Shared by all copies of a Task: its result, and what to run when it is done.
+template<typename T>
+class TaskState : public TaskStateBase
+{
+public:
+	using Continuation = std::function<void(const std::shared_ptr<TaskState>&)>;
+
+	explicit TaskState(ThreadPool& pool) : TaskStateBase(pool) {}
+
+	/// Set the result to fn(), then run the continuations on this thread.
+	template<typename Func>
+	static void finish(const std::shared_ptr<TaskState>& state, Func& fn)
+	{
+		state->_value.set_from(fn);
+		std::vector<Continuation> continuations;
+		{
+			std::lock_guard<std::mutex> lock(state->_mutex);
+			state->_done = true;
+			continuations.swap(state->_continuations);
+		}
+		state->_done_cond.notify_all();
+		for (const auto& continuation : continuations) {
+			continuation(state);
+		}
+	}
+
+	/// Call continuation(state) once the task is done: right away if it already is.
+	static void on_done(const std::shared_ptr<TaskState>& state, Continuation continuation)
+	{
+		{
+			std::lock_guard<std::mutex> lock(state->_mutex);
+			if (!state->_done) {
+				state->_continuations.push_back(std::move(continuation));
+				return;
+			}
+		}
+		continuation(state);
+	}
+
+	/// Only once done.
+	typename TaskResult<T>::type value() const { return _value.get(); }
+
+private:
+	TaskValue<T>              _value;
+	std::vector<Continuation> _continuations; // Protected by _mutex.
+};
+
+// fn(result), or fn() for a Task<void>.
+template<typename T, typename Func>
+auto call_with_value(const TaskState<T>& state, Func& fn) -> decltype(fn(state.value()))
+{
+	return fn(state.value());
+}
+
+template<typename Func>
+auto call_with_value(const TaskState<void>&, Func& fn) -> decltype(fn())
+{
+	return fn();
+}
+
+class Join;
+
+} // namespace task_detail
+
+/// The result of a job added with ThreadPool::add_task, or with Task::then.
+/// Copies refer to the same job. Jobs added this way must not throw.
+///
+///     auto pixels  = pool.add_task([&]() { return decode(file); });
+///     auto mips    = pixels.then([](const Image& image) { return generate_mips(image); });
+///     auto staging = mips.then([&](const MipChain& chain) { upload(chain); });
+///     // ... and another pipeline for the next file overlaps with this one.
+///     staging.wait();
+///
+/// Note that ThreadPool::clear() may remove a task before it has run, and then it is never done.
+template<typename T>
+class Task
+{
+public:
+	/// Not refering to any job.
+	Task() = default;
+
+	bool valid() const { return !!_state; }
+
+	ThreadPool& pool() const
+	{
+		CHECK_F(valid());
+		return _state->pool;
+	}
+
+	bool is_done() const
+	{
+		CHECK_F(valid());
+		return _state->is_done();
+	}
+
+	/// Block until the job has run. Called from a job in the same pool, this runs other jobs while it waits.
+	void wait() const
+	{
+		CHECK_F(valid());
+		_state->wait();
+	}
+
+	/// Wait, then return the result.
+	typename task_detail::TaskResult<T>::type get() const
+	{
+		wait();
+		return _state->value();
+	}
+
+	/// When this task is done, add fn(result) to the pool (fn() for a Task<void>).
+	/// Returns immediately with the Task of that. Unlike add_task, this allocates memory for the continuation.
+	template<typename Func>
+	auto then(Func fn) const -> Task<decltype(task_detail::call_with_value(std::declval<const task_detail::TaskState<T>&>(), fn))>
+	{
+		using Result = decltype(task_detail::call_with_value(std::declval<const task_detail::TaskState<T>&>(), fn));
+		using Parent = task_detail::TaskState<T>;
+		using Next   = task_detail::TaskState<Result>;
+		CHECK_F(valid());
+		const auto next = std::allocate_shared<Next>(pool_detail::RecyclingAllocator<Next>(), _state->pool);
+		Parent::on_done(_state, [next, fn](const std::shared_ptr<Parent>& parent) {
+			next->pool.add_void([parent, next, fn]() mutable {
+				auto call = [&]() { return task_detail::call_with_value(*parent, fn); };
+				Next::finish(next, call);
+			});
+		});
+		return Task<Result>(next);
+	}
+
+private:
+	template<typename U>
+	friend class Task;
+	friend class ThreadPool;
+	friend class task_detail::Join;
+
+	explicit Task(std::shared_ptr<task_detail::TaskState<T>> state) : _state(std::move(state)) {}
+
+	std::shared_ptr<task_detail::TaskState<T>> _state;
+};
+
+namespace task_detail {
+
+// Finishes a Task<void> when the last of a number of tasks is done.
+class Join
+{
+public:
+	Join(ThreadPool& pool, size_t num_tasks)
+		: _joined(std::allocate_shared<TaskState<void>>(pool_detail::RecyclingAllocator<TaskState<void>>(), pool)), _num_left(num_tasks)
+	{
+	}
+
+	template<typename T>
+	static void add(const std::shared_ptr<Join>& join, const Task<T>& task)
+	{
+		CHECK_F(task.valid());
+		CHECK_F(&task.pool() == &join->_joined->pool, "when_all: all tasks must be in the same ThreadPool");
+		TaskState<T>::on_done(task._state, [join](const std::shared_ptr<TaskState<T>>&) {
+			join->arrive();
+		});
+	}
+
+	/// Count one of the tasks as done.
+	void arrive()
+	{
+		if (--_num_left == 0) {
+			auto nothing = []() {};
+			TaskState<void>::finish(_joined, nothing);
+		}
+	}
+
+	Task<void> task() const { return Task<void>(_joined); }
+
+private:
+	std::shared_ptr<TaskState<void>> _joined;
+	std::atomic<size_t>              _num_left;
+};
+
+} // namespace task_detail
+
+/// A Task which is done once all the given tasks are. Then fn() in when_all(...).then(fn) can get() their results.
+/// This doesn't add any job of its own.
+template<typename T, typename... Ts>
+Task<void> when_all(const Task<T>& first, const Task<Ts>&... rest)
+{
+	const auto join = std::make_shared<task_detail::Join>(first.pool(), 1 + sizeof...(rest));
+	task_detail::Join::add(join, first);
+	using expand = int[];
+	(void)expand{0, (task_detail::Join::add(join, rest), 0)...};
+	return join->task();
+}
+
+/// Same, but for any number of tasks (of the same type) in the given pool.
+template<typename T>
+Task<void> when_all(ThreadPool& pool, const std::vector<Task<T>>& tasks)
+{
+	const auto join = std::make_shared<task_detail::Join>(pool, tasks.size() + 1);
+	for (const auto& task : tasks) {
+		task_detail::Join::add(join, task);
+	}
+	// We count as one, so that the join is done only once we are through the list, or right away for an empty one:
+	join->arrive();
+	return join->task();
+}
+
+template<typename Func>
+auto ThreadPool::add_task(Func fn) -> Task<decltype(fn())>
+{
+	using Result = decltype(fn());
+	using State = task_detail::TaskState<Result>;
+	const auto state = std::allocate_shared<State>(pool_detail::RecyclingAllocator<State>(), *this);
+	add_void([state, fn]() mutable {
+		State::finish(state, fn);
+	});
+	return Task<Result>(state);
+}
+
+/// A set of jobs in a ThreadPool that can be waited for without waiting for the rest of the pool:
+///
+///     emilib::TaskGroup group(pool);
+///     for (auto& asset : assets) {
+///         group.add_void([&]() { load(asset); });
+///     }
+///     group.wait();
+///
+/// Jobs of the group may add more jobs to it, which are then waited for too.
+/// Unlike ThreadPool::wait(), TaskGroup::wait() may be called from a job: it then runs other jobs while it waits.
+/// Note that ThreadPool::clear() may remove jobs of the group, which then never finishes.
+class TaskGroup
+{
+public:
+	explicit TaskGroup(ThreadPool& pool) : _pool(pool) {}
+
+	/// Will block until all jobs of the group have finished.
+	~TaskGroup() { wait(); }
+
+	TaskGroup(const TaskGroup&) = delete;
+	TaskGroup& operator=(const TaskGroup&) = delete;
+
+	/// Add to the pool and return immediately.
+	template<typename Func>
+	void add_void(Func&& job)
+	{
+		CHECK_F(pool_detail::is_set(job));
+		++_num_unfinished_jobs;
+		_pool.add_void([this, job = std::forward<Func>(job)]() mutable {
+			job();
+			_finish_one();
+		});
+	}
+
+	/// Wait for all jobs added to the group.
+	void wait();
+
+	/// True if all jobs added to the group have finished.
+	bool is_done() const { return _num_unfinished_jobs == 0; }
+
+	ThreadPool& pool() const { return _pool; }
+
+private:
+	void _finish_one();
 
-	std::mutex               _mutex;
-	std::vector<std::thread> _threads;
-	std::deque<Job>          _job_queue;
-	size_t                   _num_unfinished_jobs = 0;
-	std::condition_variable  _new_job_cond;
-	std::condition_variable  _job_finished_cond;
+	ThreadPool&             _pool;
+	std::atomic<size_t>     _num_unfinished_jobs{0};
+	std::mutex              _mutex;
+	std::condition_variable _done_cond;
 };
 
 } // namespace emilib
@@ -0,0 +1,70 @@
+#include <string>
+#include <utility>
+
+#include <catch.hpp>
+
+#include <emilib/bloom_filter.hpp>
+#include <emilib/hash_cache.hpp>
+#include <emilib/hash_functions.hpp>
+
+/// Fraction of the hash values [first, first + count) that the filter lets through.
+/// None of them should have been inserted, unless we are checking for false negatives.
+static double false_positive_rate(const emilib::BloomFilter& filter, size_t first, size_t count)
+{
+	size_t num_positives = 0;
+	for (size_t i = first; i < first + count; ++i) {
+		num_positives += filter.may_contain_hash(i);
+	}
+	return static_cast<double>(num_positives) / static_cast<double>(count);
+}
+
+TEST_CASE( "no false negatives and few false positives", "BloomFilter" ) {
+	const size_t NUM_KEYS = 100 * 1000;
+	emilib::BloomFilter filter(NUM_KEYS);
+	REQUIRE(filter.num_bits() >= 10 * NUM_KEYS);
+	REQUIRE(false_positive_rate(filter, 0, NUM_KEYS) == 0);
+
+	// Consecutive integers, like std::hash<int> gives, must not cluster:
+	for (size_t i = 0; i < NUM_KEYS; ++i) {
+		filter.insert_hash(i);
+	}
+	REQUIRE(false_positive_rate(filter, 0, NUM_KEYS) == 1);
+	const double default_rate = false_positive_rate(filter, NUM_KEYS, 10 * NUM_KEYS);
+	REQUIRE(default_rate < 0.015);
+
+	emilib::BloomFilter bigger(NUM_KEYS, 16);
+	for (size_t i = 0; i < NUM_KEYS; ++i) {
+		bigger.insert_hash(i * 7919);
+		REQUIRE(bigger.may_contain_hash(i * 7919));
+	}
+	REQUIRE(false_positive_rate(bigger, 7919 * NUM_KEYS, 10 * NUM_KEYS) < default_rate / 5);
+
+	emilib::BloomFilter copy = filter;
+	filter.clear();
+	REQUIRE(false_positive_rate(filter, 0, NUM_KEYS) == 0);
+	REQUIRE(false_positive_rate(copy, 0, NUM_KEYS) == 1);
+	filter = std::move(copy);
+	REQUIRE(false_positive_rate(filter, 0, NUM_KEYS) == 1);
+
+	emilib::BloomFilter tiny(0);
+	REQUIRE(!tiny.may_contain_hash(42));
+	tiny.insert_hash(42);
+	REQUIRE(tiny.may_contain_hash(42));
+}
+
+TEST_CASE( "built from a HashSet<HashCache<string>>", "BloomFilter" ) {
+	using Key = emilib::HashCache<std::string>;
+	emilib::HashSet<Key> set;
+	for (int i = 0; i < 1000; ++i) {
+		set.insert(Key(std::to_string(i)));
+	}
+	const emilib::BloomFilter filter(set);
+	for (const Key& key : set) {
+		REQUIRE(filter.may_contain_hash(key.hash()));
+	}
+	size_t num_positives = 0;
+	for (int i = 1000; i < 11000; ++i) {
+		num_positives += filter.may_contain_hash(Key(std::to_string(i)).hash());
+	}
+	REQUIRE(num_positives < 150);
+}
@@ -0,0 +1,50 @@
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <catch.hpp>
+
+#include <emilib/concurrent_hash_map.hpp>
+
+TEST_CASE( "[int -> int] threads", "ConcurrentHashMap" ) {
+	emilib::ConcurrentHashMap<int, int> map(16);
+	REQUIRE(map.num_shards() == 16);
+
+	const int NUM_THREADS = 4;
+	const int NUM_KEYS = 1000;
+	std::vector<std::thread> threads;
+	for (int t = 0; t < NUM_THREADS; ++t) {
+		threads.emplace_back([&map, t]() {
+			for (int key = 0; key < NUM_KEYS; ++key) {
+				map.insert(key, 0);
+				map.visit(key, [](int& value) { value += 1; });
+				if (key % NUM_THREADS == t) {
+					map.insert_or_assign(NUM_KEYS + key, t);
+				}
+			}
+		});
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+
+	REQUIRE(map.size() == 2 * NUM_KEYS);
+	for (int key = 0; key < NUM_KEYS; ++key) {
+		int value = -1;
+		REQUIRE(map.find(key, &value));
+		REQUIRE(value == NUM_THREADS);
+		REQUIRE(map.find(NUM_KEYS + key, &value));
+		REQUIRE(value == key % NUM_THREADS);
+	}
+
+	size_t num_visited = 0;
+	map.for_each([&](const int&, const int&) { num_visited += 1; });
+	REQUIRE(num_visited == 2 * NUM_KEYS);
+
+	REQUIRE(map.erase(0));
+	REQUIRE(!map.erase(0));
+	REQUIRE(!map.contains(0));
+	REQUIRE(!map.visit(0, [](int&) {}));
+	map.clear();
+	REQUIRE(map.empty());
+}
@@ -0,0 +1,179 @@
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <catch.hpp>
+
+#include <emilib/frozen_hash_map.hpp>
+#include <emilib/mem_map.cpp>
+
+namespace {
+
+struct AssetInfo
+{
+	uint32_t offset;
+	uint32_t size;
+};
+
+} // namespace
+
+TEST_CASE( "[string -> AssetInfo] save and mmap", "FrozenHashMap" ) {
+	emilib::FrozenHashMapBuilder<std::string, AssetInfo> builder;
+	const int N = 1000;
+	for (int i = 0; i < N; ++i) {
+		REQUIRE(builder.insert("asset_" + std::to_string(i), AssetInfo{(uint32_t)i, (uint32_t)(2 * i)}));
+	}
+	REQUIRE(!builder.insert("asset_0", AssetInfo{}));
+	builder.insert_or_assign("", AssetInfo{7, 7});
+
+	const char* path = "/tmp/emilib_frozen_hash_map_test.bin";
+	builder.save(path);
+
+	emilib::FrozenHashMap<std::string, AssetInfo> map(path);
+	REQUIRE(map.size() == N + 1);
+	for (int i = 0; i < N; ++i) {
+		const std::string key = "asset_" + std::to_string(i);
+		const AssetInfo* info = map.try_get(key);
+		REQUIRE(info != nullptr);
+		REQUIRE(info->offset == (uint32_t)i);
+		REQUIRE(info->size == (uint32_t)(2 * i));
+		REQUIRE(map.try_get(key.data(), key.size()) == info);
+	}
+	REQUIRE(map.contains(std::string()));
+	REQUIRE(map.try_get("asset_" + std::to_string(N)) == nullptr);
+	REQUIRE(map.find(std::string("nope")) == map.end());
+	REQUIRE(map.count(std::string("asset_42")) == 1);
+
+	auto it = map.find(std::string("asset_42"));
+	REQUIRE(it != map.end());
+	REQUIRE(it->first.str() == "asset_42");
+	REQUIRE(it->first.data[it->first.size] == '\0');
+	REQUIRE(it->second.offset == 42u);
+
+	size_t num_iterated = 0;
+	for (const auto& pair : map) {
+		REQUIRE(map.try_get(pair.first.data, pair.first.size) == &pair.second);
+		num_iterated += 1;
+	}
+	REQUIRE(num_iterated == map.size());
+
+	REQUIRE_THROWS((emilib::FrozenHashMap<std::string, uint32_t>(path)));
+	REQUIRE_THROWS((emilib::FrozenHashMap<int, AssetInfo>(path)));
+	std::remove(path);
+}
+
+TEST_CASE( "[int -> double] from memory", "FrozenHashMap" ) {
+	emilib::FrozenHashMapBuilder<int, double> builder;
+	for (int i = -500; i < 500; i += 2) {
+		builder.insert(i, i * 0.5);
+	}
+	const auto blob = builder.build();
+	emilib::FrozenHashMap<int, double> map(blob.data(), blob.size());
+	REQUIRE(map.size() == 500);
+	for (int i = -500; i < 500; ++i) {
+		const double* value = map.try_get(i);
+		if (i % 2 == 0) {
+			REQUIRE(value != nullptr);
+			REQUIRE(*value == i * 0.5);
+		} else {
+			REQUIRE(value == nullptr);
+		}
+	}
+
+	const auto empty_blob = emilib::FrozenHashMapBuilder<int, double>().build();
+	emilib::FrozenHashMap<int, double> empty(empty_blob.data(), empty_blob.size());
+	REQUIRE(empty.empty());
+	REQUIRE(empty.begin() == empty.end());
+	REQUIRE(empty.try_get(0) == nullptr);
+
+	REQUIRE_THROWS((emilib::FrozenHashMap<int, double>(blob.data(), blob.size() - 1)));
+}
+
+// Whatever is damaged, opening must throw rather than read out of bounds later.
+TEST_CASE( "corrupt blobs throw", "FrozenHashMap" ) {
+	using Header = emilib::frozen_detail::Header;
+	emilib::FrozenHashMapBuilder<std::string, uint32_t> builder;
+	for (uint32_t i = 0; i < 100; ++i) {
+		builder.insert("key_" + std::to_string(i), i);
+	}
+	const auto blob = builder.build();
+	Header header;
+	std::memcpy(&header, blob.data(), sizeof(header));
+	using Map = emilib::FrozenHashMap<std::string, uint32_t>;
+	REQUIRE_NOTHROW((Map(blob.data(), blob.size())));
+
+	const auto with_header = [&](const Header& changed) {
+		auto copy = blob;
+		std::memcpy(copy.data(), &changed, sizeof(changed));
+		return copy;
+	};
+	const auto throws = [](const std::vector<uint8_t>& corrupt) {
+		try {
+			Map map(corrupt.data(), corrupt.size());
+		} catch (const std::runtime_error&) {
+			return true;
+		}
+		return false;
+	};
+
+	for (uint64_t num_buckets : {(uint64_t)0, (uint64_t)3, header.num_buckets + 1, header.num_buckets * 2, (uint64_t)1 << 62}) {
+		Header changed = header;
+		changed.num_buckets = num_buckets;
+		REQUIRE(throws(with_header(changed)));
+	}
+	{
+		Header changed = header;
+		changed.num_elements = header.num_buckets;
+		REQUIRE(throws(with_header(changed)));
+	}
+	{
+		// Would wrap around to a small number without overflow checks:
+		Header changed = header;
+		changed.strings_offset = ~(uint64_t)0 - 10;
+		changed.strings_size   = 20;
+		REQUIRE(throws(with_header(changed)));
+	}
+	{
+		// Every bucket claims to be filled, so looking up a missing key would never end:
+		emilib::FrozenHashMapBuilder<int, uint32_t> int_builder;
+		int_builder.insert(1, 1);
+		auto int_blob = int_builder.build();
+		Header int_header;
+		std::memcpy(&int_header, int_blob.data(), sizeof(int_header));
+		REQUIRE_NOTHROW((emilib::FrozenHashMap<int, uint32_t>(int_blob.data(), int_blob.size())));
+		std::memset(int_blob.data() + int_header.states_offset, 0x7F, int_header.num_buckets);
+		REQUIRE_THROWS((emilib::FrozenHashMap<int, uint32_t>(int_blob.data(), int_blob.size())));
+	}
+
+	size_t filled = 0;
+	while (blob[header.states_offset + filled] == emilib::frozen_detail::EMPTY) { ++filled; }
+	{
+		// One element fewer than the header says:
+		auto corrupt = blob;
+		corrupt[header.states_offset + filled] = emilib::frozen_detail::EMPTY;
+		REQUIRE(throws(corrupt));
+	}
+
+	// Keys pointing outside of the string section, or at a string without its zero:
+	using Entry = emilib::frozen_detail::Entry<std::string, uint32_t>;
+	const size_t key_offset = header.entries_offset + filled * sizeof(Entry);
+	Entry entry;
+	std::memcpy(&entry, blob.data() + key_offset, sizeof(entry));
+	const uint64_t bad_keys[][2] = {
+		{header.strings_size, 1},
+		{~(uint64_t)0, 2},
+		{0, ~(uint64_t)0},
+		{entry.key.offset, entry.key.size + 1},
+		{0, header.strings_size},
+	};
+	for (const auto& bad_key : bad_keys) {
+		Entry changed = entry;
+		changed.key.offset = bad_key[0];
+		changed.key.size   = bad_key[1];
+		auto corrupt = blob;
+		std::memcpy(corrupt.data() + key_offset, &changed, sizeof(changed));
+		REQUIRE(throws(corrupt));
+	}
+}
@@ -1,9 +1,16 @@
+#include <algorithm>
+#include <atomic>
+#include <random>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include <catch.hpp>
 
 #include <emilib/hash_map.hpp>
 #include <emilib/hash_set.hpp>
+#include <emilib/huge_page_allocator.hpp>
+#include <emilib/parallel.hpp>
 
 using namespace std;
 
@@ -120,3 +127,954 @@ TEST_CASE( "[string]", "HashSet" ) {
 	REQUIRE(set.size() == 5);
 	REQUIRE(set.count("2") == 0);
 }
+
+template<typename Map>
+void test_against_unordered_map()
+{
+	std::mt19937 rng(0);
+	Map map;
+	std::unordered_map<int, int> reference;
+	for (int i = 0; i < 20000; ++i) {
+		int key = rng() % 2000;
+		if (rng() % 3 == 0) {
+			REQUIRE(map.erase(key) == (reference.erase(key) == 1));
+		} else {
+			map[key] = i;
+			reference[key] = i;
+		}
+		REQUIRE(map.size() == reference.size());
+	}
+	for (int key = 0; key < 2000; ++key) {
+		auto it = reference.find(key);
+		if (it == reference.end()) {
+			REQUIRE(map.count(key) == 0);
+		} else {
+			REQUIRE(map.count(key) == 1);
+			REQUIRE(*map.try_get(key) == it->second);
+		}
+	}
+	size_t num_iterated = 0;
+	for (const auto& p : map) {
+		REQUIRE(reference.at(p.first) == p.second);
+		num_iterated += 1;
+	}
+	REQUIRE(num_iterated == reference.size());
+	map.clear();
+	REQUIRE(map.empty());
+	REQUIRE(map.count(0) == 0);
+}
+
+TEST_CASE( "[int -> int] random insert/erase", "HashMap" ) {
+	test_against_unordered_map<emilib::HashMap<int, int>>();
+}
+
+TEST_CASE( "[int -> int] group probing", "HashMap" ) {
+	using Map = emilib::HashMap<int, int, std::hash<int>, emilib::HashMapEqualTo<int>, emilib::GroupProbingHashPolicy>;
+	test_against_unordered_map<Map>();
+
+	emilib::HashMap<string, string, std::hash<string>, emilib::HashMapEqualTo<string>, emilib::GroupProbingHashPolicy> map;
+	map["1"] = "one";
+	map["2"] = "two";
+	REQUIRE(map["1"] == "one");
+	REQUIRE(map["2"] == "two");
+	REQUIRE(map.count("3") == 0);
+}
+
+TEST_CASE( "[int] group probing", "HashSet" ) {
+	emilib::HashSet<int, std::hash<int>, emilib::HashSetEqualTo<int>, emilib::GroupProbingHashPolicy> set;
+	for (int i = 0; i < 1000; ++i) {
+		set.insert(i * 7);
+	}
+	for (int i = 0; i < 1000; i += 2) {
+		set.erase(i * 7);
+	}
+	REQUIRE(set.size() == 500);
+	for (int i = 0; i < 7000; ++i) {
+		REQUIRE(set.count(i) == (i % 14 == 7 ? 1u : 0u));
+	}
+}
+
+struct GroupedRobinHoodPolicy : emilib::RobinHoodHashPolicy
+{
+	static constexpr bool group_probing = true;
+};
+
+TEST_CASE( "[int -> int] robin hood", "HashMap" ) {
+	using Map = emilib::HashMap<int, int, std::hash<int>, emilib::HashMapEqualTo<int>, emilib::RobinHoodHashPolicy>;
+	test_against_unordered_map<Map>();
+	test_against_unordered_map<emilib::HashMap<int, int, std::hash<int>, emilib::HashMapEqualTo<int>, GroupedRobinHoodPolicy>>();
+
+	// Erasing while iterating:
+	Map map;
+	for (int i = 0; i < 100; ++i) {
+		map[i * 16] = i;
+	}
+	for (auto it = map.begin(); it != map.end(); ) {
+		if (it->second % 2 == 0) {
+			it = map.erase(it);
+		} else {
+			++it;
+		}
+	}
+	REQUIRE(map.size() == 50);
+	for (int i = 0; i < 100; ++i) {
+		REQUIRE(map.count(i * 16) == (i % 2 == 0 ? 0u : 1u));
+	}
+}
+
+struct SlowIncrementalRehashPolicy : emilib::IncrementalRehashHashPolicy
+{
+	static constexpr size_t rehash_buckets_per_insert = 2;
+};
+
+struct IncrementalRobinHoodPolicy : SlowIncrementalRehashPolicy
+{
+	static constexpr bool robin_hood = true;
+};
+
+template<typename Map>
+void test_incremental_rehash()
+{
+	test_against_unordered_map<Map>();
+
+	Map map;
+	bool saw_rehashing = false;
+	for (int i = 0; i < 5000; ++i) {
+		map[i] = i;
+		if (map.is_rehashing()) {
+			saw_rehashing = true;
+
+			// Lookups, iteration and erase must see both tables:
+			REQUIRE(map.size() == (size_t)i + 1);
+			REQUIRE((size_t)std::distance(map.begin(), map.end()) == (size_t)i + 1);
+			for (int key = 0; key <= i; key += 97) {
+				REQUIRE(map.count(key) == 1);
+				REQUIRE(map[key] == key);
+			}
+			if (i % 10 == 0) {
+				REQUIRE(map.erase(i / 2));
+				REQUIRE(!map.contains(i / 2));
+				map[i / 2] = i / 2;
+			}
+		}
+	}
+	REQUIRE(saw_rehashing);
+	map.finish_rehash();
+	REQUIRE(!map.is_rehashing());
+	REQUIRE(map.size() == 5000);
+	for (int key = 0; key < 5000; ++key) {
+		REQUIRE(map.try_get(key) != nullptr);
+		REQUIRE(*map.try_get(key) == key);
+	}
+
+	// Erasing while iterating, in the middle of a rehash:
+	while (!map.is_rehashing()) {
+		map[(int)map.size()] = (int)map.size();
+	}
+	const size_t size_before = map.size();
+	for (auto it = map.begin(); it != map.end(); ) {
+		if (it->second % 2 == 0) {
+			it = map.erase(it);
+		} else {
+			++it;
+		}
+	}
+	REQUIRE(map.size() == size_before / 2);
+	for (const auto& p : map) {
+		REQUIRE(p.second % 2 == 1);
+	}
+}
+
+TEST_CASE( "[int -> int] incremental rehash", "HashMap" ) {
+	test_incremental_rehash<emilib::HashMap<int, int, std::hash<int>, emilib::HashMapEqualTo<int>, SlowIncrementalRehashPolicy>>();
+	test_incremental_rehash<emilib::HashMap<int, int, std::hash<int>, emilib::HashMapEqualTo<int>, IncrementalRobinHoodPolicy>>();
+}
+
+struct SplitRobinHoodIncrementalPolicy : IncrementalRobinHoodPolicy
+{
+	static constexpr bool split_storage = true;
+	static constexpr bool group_probing = true;
+};
+
+TEST_CASE( "[int -> int] split storage", "HashMap" ) {
+	test_against_unordered_map<emilib::HashMap<int, int, std::hash<int>, emilib::HashMapEqualTo<int>, emilib::SplitStorageHashPolicy>>();
+	test_incremental_rehash<emilib::HashMap<int, int, std::hash<int>, emilib::HashMapEqualTo<int>, SplitRobinHoodIncrementalPolicy>>();
+
+	emilib::HashMap<string, string, std::hash<string>, emilib::HashMapEqualTo<string>, emilib::SplitStorageHashPolicy> map;
+	map["1"] = "one";
+	map.insert("2", "two");
+	map.try_emplace("3", 5, 'x');
+	REQUIRE(map.size() == 3);
+	REQUIRE(map["3"] == "xxxxx");
+
+	auto it = map.find("1");
+	REQUIRE(it != map.end());
+	REQUIRE(it->first == "1");
+	it->second = "uno";
+	REQUIRE(*map.try_get("1") == "uno");
+	REQUIRE((*it).second == "uno");
+
+	size_t num_iterated = 0;
+	for (auto pair : map) {
+		pair.second += "!";
+		num_iterated += 1;
+	}
+	REQUIRE(num_iterated == 3);
+	REQUIRE(map["2"] == "two!");
+
+	const auto copy = map;
+	REQUIRE(copy.size() == 3);
+	for (const auto& pair : copy) {
+		REQUIRE(*map.try_get(pair.first) == pair.second);
+	}
+	REQUIRE(copy.find("2")->second == "two!");
+}
+
+struct CountingHash
+{
+	static size_t s_num_calls;
+
+	size_t operator()(const string& key) const
+	{
+		s_num_calls += 1;
+		return std::hash<string>()(key);
+	}
+};
+
+size_t CountingHash::s_num_calls = 0;
+
+struct StoreHashRobinHoodIncrementalPolicy : IncrementalRobinHoodPolicy
+{
+	static constexpr bool store_hash = true;
+};
+
+TEST_CASE( "[string -> int] store hash", "HashMap" ) {
+	test_against_unordered_map<emilib::HashMap<int, int, std::hash<int>, emilib::HashMapEqualTo<int>, emilib::StoreHashHashPolicy>>();
+	test_incremental_rehash<emilib::HashMap<int, int, std::hash<int>, emilib::HashMapEqualTo<int>, StoreHashRobinHoodIncrementalPolicy>>();
+
+	emilib::HashMap<string, int, CountingHash, emilib::HashMapEqualTo<string>, emilib::StoreHashHashPolicy> map;
+	CountingHash::s_num_calls = 0;
+	const int N = 10000;
+	for (int i = 0; i < N; ++i) {
+		map[std::to_string(i)] = i;
+	}
+	REQUIRE(CountingHash::s_num_calls == (size_t)N); // Growing never rehashes the keys
+	map.reserve(4 * N);
+	REQUIRE(CountingHash::s_num_calls == (size_t)N);
+
+	for (int i = 0; i < N; ++i) {
+		REQUIRE(map[std::to_string(i)] == i);
+	}
+	REQUIRE(map.count("nope") == 0);
+	for (int i = 0; i < N; i += 2) {
+		REQUIRE(map.erase(std::to_string(i)));
+	}
+	REQUIRE(map.size() == (size_t)N / 2);
+	for (int i = 0; i < N; ++i) {
+		REQUIRE(map.count(std::to_string(i)) == (i % 2 == 0 ? 0u : 1u));
+	}
+}
+
+TEST_CASE( "[string] robin hood", "HashSet" ) {
+	emilib::HashSet<string, std::hash<string>, emilib::HashSetEqualTo<string>, emilib::RobinHoodHashPolicy> set;
+	for (int i = 0; i < 1000; ++i) {
+		set.insert(std::to_string(i));
+	}
+	for (int i = 0; i < 1000; i += 3) {
+		REQUIRE(set.erase(std::to_string(i)));
+	}
+	for (int i = 0; i < 1000; ++i) {
+		REQUIRE(set.count(std::to_string(i)) == (i % 3 == 0 ? 0u : 1u));
+	}
+}
+
+TEST_CASE( "[uint64_t -> int] batch lookup", "HashMap" ) {
+	emilib::HashMap<uint64_t, int> map;
+	for (uint64_t i = 0; i < 1000; ++i) {
+		map[i * 3] = static_cast<int>(i);
+	}
+	std::vector<uint64_t> keys;
+	for (uint64_t i = 0; i < 100; ++i) {
+		keys.push_back(i);
+	}
+	std::vector<int*> values(keys.size());
+	map.try_get_batch(keys.data(), keys.size(), values.data());
+	std::vector<emilib::HashMap<uint64_t, int>::const_iterator> its(keys.size());
+	const auto& const_map = map;
+	const_map.find_batch(keys.data(), keys.size(), its.data());
+	for (size_t i = 0; i < keys.size(); ++i) {
+		REQUIRE(values[i] == map.try_get(keys[i]));
+		REQUIRE((its[i] == const_map.find(keys[i])));
+		REQUIRE((const_map.find_with_hash(keys[i], std::hash<uint64_t>()(keys[i])) == its[i]));
+	}
+
+	emilib::HashMap<uint64_t, int> empty_map;
+	empty_map.try_get_batch(keys.data(), keys.size(), values.data());
+	REQUIRE(values[0] == nullptr);
+}
+
+namespace {
+
+/// Counts copies, so we can check that the map never copies unless asked to.
+struct CopyCounter
+{
+	static int s_num_copies;
+	int value = 0;
+
+	CopyCounter() = default;
+	explicit CopyCounter(int v) : value(v) { }
+	CopyCounter(int a, int b) : value(a + b) { }
+	CopyCounter(const CopyCounter& other) : value(other.value) { s_num_copies += 1; }
+	CopyCounter(CopyCounter&& other) noexcept : value(other.value) { other.value = -1; }
+	CopyCounter& operator=(const CopyCounter& other) { value = other.value; s_num_copies += 1; return *this; }
+	CopyCounter& operator=(CopyCounter&& other) noexcept { value = other.value; other.value = -1; return *this; }
+};
+
+int CopyCounter::s_num_copies = 0;
+
+/// Throws from its constructor when given a negative number.
+struct MaybeThrowing
+{
+	explicit MaybeThrowing(int v) : value(v) { if (v < 0) { throw v; } }
+	int value;
+};
+
+} // namespace
+
+TEST_CASE( "[string -> CopyCounter] move-aware insertion", "HashMap" ) {
+	emilib::HashMap<string, CopyCounter> map;
+	CopyCounter::s_num_copies = 0;
+
+	REQUIRE(map.try_emplace("a", 1).second);
+	REQUIRE(map.try_emplace("b", 2, 3).second);
+	REQUIRE(map["b"].value == 5);
+	REQUIRE(map.emplace(std::piecewise_construct, std::forward_as_tuple(3, 'c'), std::forward_as_tuple(4)).second);
+	REQUIRE(map["ccc"].value == 4);
+	REQUIRE(map.emplace("d", CopyCounter(6)).second);
+	REQUIRE(map.insert("e", CopyCounter(7)).second);
+	REQUIRE(map.insert(std::make_pair(string("f"), CopyCounter(8))).second);
+	REQUIRE(map.insert_or_assign("a", CopyCounter(10)).second == false);
+	REQUIRE(map["a"].value == 10);
+	REQUIRE(map.insert_or_assign("g", CopyCounter(11)).second == true);
+
+	// Failed insertions must not move from their arguments:
+	string key = "a";
+	CopyCounter value(99);
+	REQUIRE(!map.try_emplace(std::move(key), std::move(value)).second);
+	REQUIRE(!map.insert(std::move(key), std::move(value)).second);
+	REQUIRE(!map.insert(key, std::move(value)).second);
+	REQUIRE(key == "a");
+	REQUIRE(value.value == 99);
+
+	std::vector<std::pair<string, CopyCounter>> more;
+	for (int i = 0; i < 100; ++i) {
+		more.emplace_back(std::to_string(i), CopyCounter(i));
+	}
+	map.insert(std::make_move_iterator(more.begin()), std::make_move_iterator(more.end()));
+	REQUIRE(map.size() == 107);
+	REQUIRE(map["42"].value == 42);
+	REQUIRE(more[42].second.value == -1);
+
+	const string existing_key = "i";
+	REQUIRE(map.insert(existing_key, CopyCounter(14)).second);
+	REQUIRE(map["i"].value == 14);
+
+	REQUIRE(CopyCounter::s_num_copies == 0);
+
+	REQUIRE(map.set_get("a", CopyCounter(12)).value == 10);
+	REQUIRE(map["a"].value == 12);
+	REQUIRE(map.set_get("h", CopyCounter(13)).value == 0);
+	REQUIRE(map["h"].value == 13);
+
+	auto copy = map;
+	REQUIRE(copy.size() == map.size());
+	REQUIRE(copy["a"].value == 12);
+}
+
+template<typename Map>
+void test_throwing_constructor()
+{
+	Map map;
+	for (int key = 0; key < 1000; ++key) {
+		map.try_emplace(key, key);
+	}
+	// Keys that probe through the existing clusters, so that Robin Hood shifts them to make room:
+	const int offset = static_cast<int>(map.bucket_count());
+	for (int key = offset; key < offset + 1000; ++key) {
+		REQUIRE_THROWS(map.try_emplace(key, -1));
+	}
+	REQUIRE(map.size() == 1000);
+	for (int key = 0; key < 1000; ++key) {
+		REQUIRE(map.try_get(key) != nullptr);
+		REQUIRE(map.try_get(key)->value == key);
+		REQUIRE(map.count(key + offset) == 0);
+	}
+	size_t num_iterated = 0;
+	for (const auto& pair : map) {
+		REQUIRE(pair.first == pair.second.value);
+		num_iterated += 1;
+	}
+	REQUIRE(num_iterated == 1000);
+}
+
+TEST_CASE( "[int -> MaybeThrowing] throwing value constructor", "HashMap" ) {
+	test_throwing_constructor<emilib::HashMap<int, MaybeThrowing>>();
+	test_throwing_constructor<emilib::HashMap<int, MaybeThrowing, std::hash<int>, emilib::HashMapEqualTo<int>, emilib::SplitStorageHashPolicy>>();
+	test_throwing_constructor<emilib::HashMap<int, MaybeThrowing, std::hash<int>, emilib::HashMapEqualTo<int>, emilib::RobinHoodHashPolicy>>();
+	test_throwing_constructor<emilib::HashMap<int, MaybeThrowing, std::hash<int>, emilib::HashMapEqualTo<int>, GroupedRobinHoodPolicy>>();
+}
+
+TEST_CASE( "hash functions", "Hash" ) {
+	// Strided keys must still spread over the low bits:
+	std::vector<bool> used(1024, false);
+	size_t num_used = 0;
+	for (uint64_t i = 0; i < 1024; ++i) {
+		size_t bucket = emilib::IntHash<uint64_t>()(i * 1024) & 1023;
+		num_used += used[bucket] ? 0 : 1;
+		used[bucket] = true;
+	}
+	REQUIRE(num_used > 600); // ~647 for a random function
+
+	// Every byte of every length matters:
+	emilib::HashSet<size_t> hashes;
+	string str;
+	for (int i = 0; i < 100; ++i) {
+		REQUIRE(emilib::StringHash()(str) == emilib::StringHash()(str.c_str()));
+		REQUIRE(hashes.insert(emilib::StringHash()(str)).second);
+		str += 'a';
+		for (size_t j = 0; j < str.size(); ++j) {
+			string changed = str;
+			changed[j] = 'b';
+			REQUIRE(emilib::hash_bytes(changed.data(), changed.size()) != emilib::hash_bytes(str.data(), str.size()));
+		}
+	}
+	REQUIRE(emilib::hash_bytes("foo", 3, 1) != emilib::hash_bytes("foo", 3, 2));
+
+	using Pair = std::pair<int, string>;
+	REQUIRE(emilib::Hash<Pair>()(Pair(1, "a")) == emilib::hash_members(1, string("a")));
+	REQUIRE(emilib::Hash<Pair>()(Pair(1, "a")) != emilib::Hash<Pair>()(Pair(2, "a")));
+	REQUIRE(emilib::hash_members(1, 2) != emilib::hash_members(2, 1));
+	using Tuple = std::tuple<int, int>;
+	REQUIRE(emilib::Hash<Tuple>()(Tuple(1, 2)) == emilib::hash_members(1, 2));
+
+	emilib::HashMap<Pair, int, emilib::Hash<Pair>> map;
+	map[Pair(1, "a")] = 1;
+	map[Pair(2, "a")] = 2;
+	REQUIRE(map[Pair(1, "a")] == 1);
+	REQUIRE(map.count(Pair(1, "b")) == 0);
+}
+
+TEST_CASE( "[int -> int] post mix hash", "HashMap" ) {
+	using Map = emilib::HashMap<int, int, std::hash<int>, emilib::HashMapEqualTo<int>, emilib::PostMixHashPolicy>;
+	test_against_unordered_map<Map>();
+
+	Map map;
+	for (int i = 0; i < 10000; ++i) {
+		map[i << 12] = i;
+	}
+	for (int i = 0; i < 10000; ++i) {
+		REQUIRE(map[i << 12] == i);
+		REQUIRE(*map.try_get_with_hash(i << 12, std::hash<int>()(i << 12)) == i);
+	}
+
+	emilib::HashSet<int, std::hash<int>, emilib::HashSetEqualTo<int>, emilib::PostMixHashPolicy> set;
+	for (int i = 0; i < 1000; ++i) {
+		set.insert(i << 12);
+	}
+	REQUIRE(set.size() == 1000);
+	REQUIRE(set.count(1 << 12) == 1);
+	REQUIRE(set.count(1) == 0);
+}
+
+struct RobinHoodStoreHashPolicy : emilib::RobinHoodHashPolicy
+{
+	static constexpr bool store_hash = true;
+};
+
+struct CountingIncrementalPolicy : SlowIncrementalRehashPolicy
+{
+	static constexpr bool count_rehashes = true;
+};
+
+template<typename Table>
+void check_stats_consistency(const Table& table)
+{
+	const emilib::HashTableStats stats = table.stats();
+	REQUIRE(stats.num_filled == table.size());
+	REQUIRE(stats.num_filled + stats.num_active + stats.num_inactive == stats.num_buckets);
+	size_t num_in_histogram = 0;
+	for (size_t count : stats.probe_length_histogram) {
+		num_in_histogram += count;
+	}
+	REQUIRE(num_in_histogram == table.size());
+	REQUIRE((int)stats.probe_length_histogram.size() <= stats.max_probe_length + 1);
+	REQUIRE(stats.longest_cluster <= stats.num_buckets);
+}
+
+TEST_CASE( "stats", "HashMap" ) {
+	emilib::HashMap<int, int> map;
+	REQUIRE(map.stats().num_filled == 0);
+	REQUIRE(map.stats().avg_unsuccessful_probe_length == 0);
+
+	// The identity hash puts sequential keys in their home buckets:
+	for (int i = 0; i < 1000; ++i) {
+		map[i] = i;
+	}
+	auto stats = map.stats();
+	check_stats_consistency(map);
+	REQUIRE(stats.probe_length_histogram.size() == 1);
+	REQUIRE(stats.avg_successful_probe_length == 1.0);
+	REQUIRE(stats.longest_cluster == 1000);
+	REQUIRE(stats.num_active == 0);
+	REQUIRE(stats.num_rehashes == 0); // Not counted by default
+
+	// Tombstones:
+	for (int i = 0; i < 1000; i += 2) {
+		map.erase(i);
+	}
+	stats = map.stats();
+	check_stats_consistency(map);
+	REQUIRE(stats.num_active == 500);
+	REQUIRE(stats.longest_cluster == 1000);
+
+	// Strided keys cluster with the identity hash, but not when post-mixed:
+	emilib::HashMap<int, int> strided;
+	emilib::HashMap<int, int, std::hash<int>, emilib::HashMapEqualTo<int>, emilib::PostMixHashPolicy> mixed;
+	for (int i = 0; i < 1000; ++i) {
+		strided[i << 10] = i;
+		mixed[i << 10] = i;
+	}
+	check_stats_consistency(strided);
+	check_stats_consistency(mixed);
+	REQUIRE(strided.stats().avg_successful_probe_length > 100);
+	REQUIRE(mixed.stats().avg_successful_probe_length < 3);
+	REQUIRE(mixed.stats().avg_unsuccessful_probe_length < strided.stats().avg_unsuccessful_probe_length);
+
+	emilib::HashMap<int, int, std::hash<int>, emilib::HashMapEqualTo<int>, RobinHoodStoreHashPolicy> robin_hood;
+	emilib::HashMap<int, int, std::hash<int>, emilib::HashMapEqualTo<int>, CountingIncrementalPolicy> incremental;
+	emilib::HashSet<int, std::hash<int>, emilib::HashSetEqualTo<int>, emilib::CountRehashesHashPolicy> set;
+	std::mt19937 rng(0);
+	for (int i = 0; i < 10000; ++i) {
+		const int key = rng() % 5000;
+		if (rng() % 4 == 0) {
+			robin_hood.erase(key);
+			incremental.erase(key);
+			set.erase(key);
+		} else {
+			robin_hood[key] = i;
+			incremental[key] = i;
+			set.insert(key);
+		}
+		if (i % 1000 == 0) {
+			check_stats_consistency(robin_hood);
+			check_stats_consistency(incremental);
+			check_stats_consistency(set);
+		}
+	}
+	REQUIRE(robin_hood.stats().num_active == 0); // Backward-shift deletion leaves no tombstones
+	REQUIRE(incremental.stats().num_rehashes > 5);
+	REQUIRE(set.stats().num_rehashes > 5);
+	REQUIRE(set.stats().rehash_seconds > 0);
+}
+
+/// Keeps track of the number of bytes allocated through all copies of it.
+struct CountingAllocator
+{
+	size_t* num_bytes = nullptr;
+
+	void* allocate(size_t bytes)
+	{
+		*num_bytes += bytes;
+		return malloc(bytes);
+	}
+
+	void deallocate(void* ptr, size_t bytes)
+	{
+		if (ptr) { *num_bytes -= bytes; }
+		free(ptr);
+	}
+};
+
+struct CountingAllocatorPolicy : emilib::HashPolicy
+{
+	using Allocator = CountingAllocator;
+};
+
+struct CountingAllocatorEverythingPolicy : StoreHashRobinHoodIncrementalPolicy
+{
+	using Allocator = CountingAllocator;
+	static constexpr bool split_storage = true;
+};
+
+template<typename Map>
+void test_counting_allocator()
+{
+	size_t num_bytes = 0;
+	{
+		Map map(CountingAllocator{&num_bytes});
+		for (int i = 0; i < 1000; ++i) {
+			map[i] = i;
+		}
+		REQUIRE(num_bytes >= map.bucket_count() * sizeof(int) * 2);
+		auto copy = map;
+		Map moved = std::move(copy);
+		REQUIRE(moved.get_allocator().num_bytes == &num_bytes);
+		map.clear();
+	}
+	REQUIRE(num_bytes == 0);
+}
+
+TEST_CASE( "allocators", "HashMap" ) {
+	test_counting_allocator<emilib::HashMap<int, int, std::hash<int>, emilib::HashMapEqualTo<int>, CountingAllocatorPolicy>>();
+	test_counting_allocator<emilib::HashMap<int, int, std::hash<int>, emilib::HashMapEqualTo<int>, CountingAllocatorEverythingPolicy>>();
+
+	size_t num_bytes = 0;
+	{
+		emilib::HashSet<int, std::hash<int>, emilib::HashSetEqualTo<int>, CountingAllocatorPolicy> set(CountingAllocator{&num_bytes});
+		for (int i = 0; i < 1000; ++i) {
+			set.insert(i);
+		}
+		REQUIRE(num_bytes > 0);
+	}
+	REQUIRE(num_bytes == 0);
+
+	// Big enough for huge pages:
+	emilib::HashMap<int, int, std::hash<int>, emilib::HashMapEqualTo<int>, emilib::HugePageHashPolicy> map;
+	for (int i = 0; i < 300000; ++i) {
+		map[i] = i;
+	}
+	for (int i = 0; i < 300000; ++i) {
+		REQUIRE(map[i] == i);
+	}
+	emilib::HugePageAllocator allocator;
+	const size_t size = emilib::HugePageAllocator::HUGE_PAGE_SIZE + 1;
+	char* ptr = static_cast<char*>(allocator.allocate(size));
+	REQUIRE(ptr != nullptr);
+	REQUIRE(reinterpret_cast<uintptr_t>(ptr) % 4096 == 0);
+	ptr[0] = ptr[size - 1] = 42;
+	allocator.deallocate(ptr, size);
+	allocator.deallocate(nullptr, 1 << 30);
+}
+
+template<typename Table, typename InsertFunc>
+void test_load_factor_and_shrinking(const InsertFunc& insert)
+{
+	Table table;
+	REQUIRE(table.max_load_factor() > 0.6f);
+	table.max_load_factor(0.9f);
+	for (int i = 0; i < 1000; ++i) {
+		insert(table, i);
+		REQUIRE(table.load_factor() <= 0.9f);
+	}
+	REQUIRE(table.bucket_count() == 2048); // 1024 would be 98% full
+
+	table.max_load_factor(0.25f);
+	REQUIRE(table.bucket_count() == 4096);
+	REQUIRE(table.load_factor() <= 0.25f);
+
+	// Copies keep the max_load_factor:
+	const Table copy = table;
+	REQUIRE(copy.max_load_factor() == 0.25f);
+	Table assigned;
+	assigned = table;
+	REQUIRE(assigned.max_load_factor() == 0.25f);
+	REQUIRE(assigned.load_factor() <= 0.25f);
+	const Table& same = assigned;
+	assigned = same;
+	REQUIRE(assigned.size() == 1000);
+
+	// rehash can grow and shrink, but never below what max_load_factor allows:
+	table.rehash(10000);
+	REQUIRE(table.bucket_count() == 16384);
+	table.rehash(0);
+	REQUIRE(table.bucket_count() == 4096);
+	REQUIRE(table.size() == 1000);
+	REQUIRE(table.count(999) == 1);
+
+	for (int i = 0; i < 990; ++i) {
+		table.erase(i);
+	}
+	table.shrink_to_fit();
+	REQUIRE(table.bucket_count() == 64);
+	REQUIRE(table.size() == 10);
+	for (int i = 0; i < 1000; ++i) {
+		REQUIRE(table.count(i) == (i >= 990 ? 1u : 0u));
+	}
+
+	table.clear();
+	table.shrink_to_fit();
+	REQUIRE(table.bucket_count() == 0);
+	REQUIRE(table.count(0) == 0);
+	insert(table, 0);
+	REQUIRE(table.count(0) == 1);
+}
+
+TEST_CASE( "max_load_factor, rehash and shrink_to_fit", "HashMap" ) {
+	test_load_factor_and_shrinking<emilib::HashMap<int, int>>([](emilib::HashMap<int, int>& map, int i) {
+		map[i] = i;
+	});
+	using Incremental = emilib::HashMap<int, int, std::hash<int>, emilib::HashMapEqualTo<int>, StoreHashRobinHoodIncrementalPolicy>;
+	test_load_factor_and_shrinking<Incremental>([](Incremental& map, int i) {
+		map[i] = i;
+	});
+	test_load_factor_and_shrinking<emilib::HashSet<int>>([](emilib::HashSet<int>& set, int i) {
+		set.insert(i);
+	});
+}
+
+template<typename Map>
+void test_insert_parallel(emilib::ThreadPool& pool)
+{
+	// Many duplicates, and keys clustering at the ends of regions:
+	std::vector<std::pair<int, int>> pairs;
+	std::mt19937 rng(0);
+	for (int i = 0; i < 100000; ++i) {
+		pairs.emplace_back(rng() % 50000, i);
+	}
+
+	Map serial;
+	serial.insert(pairs.begin(), pairs.end());
+
+	Map parallel;
+	parallel[-1] = -1;
+	parallel.erase(-1); // Leave a tombstone
+	parallel[-2] = -2;
+	parallel.insert_parallel(pairs.begin(), pairs.end(), pool);
+	REQUIRE(parallel.size() == serial.size() + 1);
+	for (const auto& pair : serial) {
+		REQUIRE(*parallel.try_get(pair.first) == pair.second); // First one wins
+	}
+	REQUIRE(parallel[-2] == -2);
+	REQUIRE(parallel.count(-1) == 0);
+
+	// Still an ordinary map:
+	for (int i = 0; i < 50000; i += 2) {
+		parallel.erase(i);
+	}
+	for (int i = 0; i < 50000; i += 3) {
+		parallel[i] = -i;
+	}
+	for (int i = 0; i < 50000; ++i) {
+		if (i % 3 == 0) {
+			REQUIRE(parallel[i] == -i);
+		} else if (i % 2 == 0) {
+			REQUIRE(parallel.count(i) == 0);
+		} else {
+			const int* value = parallel.try_get(i);
+			REQUIRE((value == nullptr) == (serial.count(i) == 0));
+			REQUIRE((!value || *value == serial[i]));
+		}
+	}
+}
+
+struct GroupStoreHashPolicy : emilib::GroupProbingHashPolicy
+{
+	static constexpr bool store_hash = true;
+};
+
+TEST_CASE( "insert_parallel", "HashMap" ) {
+	emilib::ThreadPool pool(4);
+	test_insert_parallel<emilib::HashMap<int, int>>(pool);
+	test_insert_parallel<emilib::HashMap<int, int, std::hash<int>, emilib::HashMapEqualTo<int>, GroupStoreHashPolicy>>(pool);
+	test_insert_parallel<emilib::HashMap<int, int, std::hash<int>, emilib::HashMapEqualTo<int>, emilib::PostMixHashPolicy>>(pool);
+	test_insert_parallel<emilib::HashMap<int, int, std::hash<int>, emilib::HashMapEqualTo<int>, emilib::SplitStorageHashPolicy>>(pool);
+	test_insert_parallel<emilib::HashMap<int, int, std::hash<int>, emilib::HashMapEqualTo<int>, emilib::RobinHoodHashPolicy>>(pool); // Not parallel
+
+	std::vector<std::pair<string, string>> pairs;
+	for (int i = 0; i < 10000; ++i) {
+		pairs.emplace_back(std::to_string(i), std::to_string(i));
+	}
+	emilib::HashMap<string, string> map;
+	map.insert_parallel(std::make_move_iterator(pairs.begin()), std::make_move_iterator(pairs.end()), pool);
+	REQUIRE(map.size() == 10000);
+	REQUIRE(map["42"] == "42");
+	REQUIRE(pairs[42].first.empty());
+}
+
+template<typename Map>
+void test_bucket_range(emilib::ThreadPool& pool)
+{
+	Map map;
+	REQUIRE(map.bucket_range(0, (size_t)-1).begin() == map.end());
+	std::atomic<size_t> count(0);
+	map.for_each_parallel(pool, [&](typename Map::reference) { count += 1; });
+	REQUIRE(count == 0);
+
+	// Sparse and full of tombstones:
+	for (int i = 0; i < 100000; ++i) {
+		map[i] = i;
+	}
+	for (int i = 0; i < 100000; ++i) {
+		if (i % 10 != 0) {
+			map.erase(i);
+		}
+	}
+
+	// Uneven slices visit every element once:
+	std::vector<int> visits(100000, 0);
+	const size_t slice_size = map.bucket_count() / 7 + 3;
+	for (size_t bucket = 0; bucket < map.bucket_count(); bucket += slice_size) {
+		const size_t slice_end = bucket + slice_size < map.bucket_count() ? bucket + slice_size : (size_t)-1;
+		for (const auto& pair : map.bucket_range(bucket, slice_end)) {
+			REQUIRE(pair.first == pair.second);
+			visits[pair.first] += 1;
+		}
+	}
+	for (int i = 0; i < 100000; ++i) {
+		REQUIRE(visits[i] == (i % 10 == 0 ? 1 : 0));
+	}
+
+	map.for_each_parallel(pool, [](typename Map::reference pair) { pair.second *= 2; });
+	std::atomic<long long> sum(0);
+	std::atomic<size_t> num_wrong(0);
+	const Map& const_map = map;
+	const_map.for_each_parallel(pool, [&](typename Map::const_reference pair) {
+		// Catch is not thread safe, so no REQUIRE in here.
+		num_wrong += (pair.second != 2 * pair.first);
+		sum += pair.second;
+		count += 1;
+	});
+	REQUIRE(count == map.size());
+	REQUIRE(num_wrong == 0);
+	REQUIRE(sum == 2LL * 10 * (9999 * 10000 / 2));
+}
+
+TEST_CASE( "bucket_range and for_each_parallel", "HashMap" ) {
+	emilib::ThreadPool pool(4);
+	test_bucket_range<emilib::HashMap<int, int>>(pool);
+	test_bucket_range<emilib::HashMap<int, int, std::hash<int>, emilib::HashMapEqualTo<int>, GroupStoreHashPolicy>>(pool);
+	test_bucket_range<emilib::HashMap<int, int, std::hash<int>, emilib::HashMapEqualTo<int>, emilib::SplitStorageHashPolicy>>(pool);
+	test_bucket_range<emilib::HashMap<int, int, std::hash<int>, emilib::HashMapEqualTo<int>, emilib::RobinHoodHashPolicy>>(pool);
+
+	// In the middle of an incremental rehash, the old table comes after bucket_count():
+	emilib::HashMap<int, int, std::hash<int>, emilib::HashMapEqualTo<int>, SlowIncrementalRehashPolicy> growing;
+	int num_keys = 0;
+	do {
+		growing[num_keys] = num_keys;
+		++num_keys;
+	} while (growing.stats().num_buckets == growing.bucket_count());
+	std::vector<int> visits(num_keys, 0);
+	for (const auto& pair : growing.bucket_range(0, growing.bucket_count())) { visits[pair.first] += 1; }
+	for (const auto& pair : growing.bucket_range(growing.bucket_count(), (size_t)-1)) { visits[pair.first] += 1; }
+	REQUIRE(std::count(visits.begin(), visits.end(), 1) == num_keys);
+
+	emilib::HashSet<int> set;
+	for (int i = 0; i < 100000; i += 3) {
+		set.insert(i);
+	}
+	std::atomic<size_t> count(0);
+	std::atomic<size_t> num_wrong(0);
+	set.for_each_parallel(pool, [&](int key) {
+		num_wrong += (key % 3 != 0);
+		count += 1;
+	});
+	REQUIRE(count == set.size());
+	REQUIRE(num_wrong == 0);
+	size_t num_in_halves = 0;
+	for (int key : set.bucket_range(0, set.bucket_count() / 2)) { num_in_halves += 1; (void)key; }
+	for (int key : set.bucket_range(set.bucket_count() / 2, set.bucket_count())) { num_in_halves += 1; (void)key; }
+	REQUIRE(num_in_halves == set.size());
+
+	// From inside a job, while the only worker is busy running that job:
+	emilib::ThreadPool single_worker(1);
+	std::atomic<size_t> count_in_job(0);
+	single_worker.add_void([&]() {
+		set.for_each_parallel(single_worker, [&](int) { count_in_job += 1; });
+	});
+	single_worker.wait();
+	REQUIRE(count_in_job == set.size());
+}
+
+template<typename Set>
+void test_set_algebra()
+{
+	const int MAX_KEY = 4000;
+	std::mt19937 rng(0);
+	for (int round = 0; round < 20; ++round) {
+		Set a, b;
+		std::vector<bool> in_a(MAX_KEY, false), in_b(MAX_KEY, false);
+		const int size_a = static_cast<int>(rng() % 3000);
+		const int size_b = round % 4 == 0 ? 0 : static_cast<int>(rng() % 3000);
+		for (int i = 0; i < size_a; ++i) { int key = rng() % MAX_KEY; a.insert(key); in_a[key] = true; }
+		for (int i = 0; i < size_b; ++i) { int key = rng() % MAX_KEY; b.insert(key); in_b[key] = true; }
+		for (int i = 0; i < 100; ++i) { int key = rng() % MAX_KEY; a.erase(key); in_a[key] = false; } // Tombstones
+
+		// Checks the contents, and that the set was allocated once for its final size.
+		auto require_equal = [&](const Set& set, const std::function<bool(int)>& reference) {
+			size_t reference_size = 0;
+			for (int key = 0; key < MAX_KEY; ++key) {
+				REQUIRE(set.count(key) == (reference(key) ? 1u : 0u));
+				reference_size += reference(key);
+			}
+			REQUIRE(set.size() == reference_size);
+			Set exact;
+			exact.reserve(set.size());
+			REQUIRE(set.bucket_count() <= std::max<size_t>(exact.bucket_count(), 1));
+		};
+		auto in_union        = [&](int key) { return in_a[key] || in_b[key]; };
+		auto in_intersection = [&](int key) { return in_a[key] && in_b[key]; };
+		auto in_difference   = [&](int key) { return in_a[key] && !in_b[key]; };
+
+		require_equal(emilib::set_union(a, b), in_union);
+		require_equal(emilib::set_union(b, a), in_union);
+		require_equal(emilib::set_intersection(a, b), in_intersection);
+		require_equal(emilib::set_intersection(b, a), in_intersection);
+		require_equal(emilib::set_difference(a, b), in_difference);
+
+		bool a_in_b = true;
+		for (int key = 0; key < MAX_KEY; ++key) { a_in_b &= !in_a[key] || in_b[key]; }
+		REQUIRE(emilib::is_subset(a, b) == a_in_b);
+		REQUIRE(emilib::is_subset(emilib::set_intersection(a, b), a));
+		REQUIRE(emilib::is_subset(a, emilib::set_union(a, b)));
+		REQUIRE(emilib::is_subset(a, a));
+
+		Set united = a;
+		united.union_with(b);
+		for (int key = 0; key < MAX_KEY; ++key) { REQUIRE(united.count(key) == (in_union(key) ? 1u : 0u)); }
+
+		Set intersected = a;
+		intersected.intersect_with(b);
+		for (int key = 0; key < MAX_KEY; ++key) { REQUIRE(intersected.count(key) == (in_intersection(key) ? 1u : 0u)); }
+
+		Set subtracted = a;
+		subtracted.subtract(b);
+		for (int key = 0; key < MAX_KEY; ++key) { REQUIRE(subtracted.count(key) == (in_difference(key) ? 1u : 0u)); }
+
+		Set big_minus_small = emilib::set_union(a, b);
+		big_minus_small.subtract(b);
+		for (int key = 0; key < MAX_KEY; ++key) { REQUIRE(big_minus_small.count(key) == (in_difference(key) ? 1u : 0u)); }
+
+		subtracted.subtract(subtracted);
+		REQUIRE(subtracted.empty());
+	}
+
+	// A full table: unions that add nothing to it must not grow it.
+	size_t capacity = 1;
+	for (;;) {
+		Set now, next;
+		now.reserve(capacity);
+		next.reserve(capacity + 1);
+		if (next.bucket_count() != now.bucket_count()) { break; }
+		++capacity;
+	}
+	Set full;
+	for (int key = 0; key < static_cast<int>(capacity); ++key) { full.insert(key); }
+	const size_t full_buckets = full.bucket_count();
+	Set first_key;
+	first_key.insert(0);
+	REQUIRE(emilib::set_union(full, first_key).bucket_count() == full_buckets);
+	REQUIRE(emilib::set_union(first_key, full).bucket_count() == full_buckets);
+	full.union_with(first_key);
+	REQUIRE(full.bucket_count() == full_buckets);
+	full.union_with(full);
+	REQUIRE(full.bucket_count() == full_buckets);
+	REQUIRE(full.size() == capacity);
+	for (int key = 0; key < static_cast<int>(capacity); ++key) { REQUIRE(full.count(key) == 1); }
+}
+
+TEST_CASE( "set algebra", "HashSet" ) {
+	test_set_algebra<emilib::HashSet<int>>();
+	test_set_algebra<emilib::HashSet<int, std::hash<int>, emilib::HashSetEqualTo<int>, emilib::GroupProbingHashPolicy>>();
+	test_set_algebra<emilib::HashSet<int, std::hash<int>, emilib::HashSetEqualTo<int>, emilib::RobinHoodHashPolicy>>();
+	test_set_algebra<emilib::HashSet<int, std::hash<int>, emilib::HashSetEqualTo<int>, emilib::PostMixHashPolicy>>();
+}
@@ -0,0 +1,99 @@
+#include <cstdint>
+#include <map>
+#include <random>
+#include <string>
+
+#include <catch.hpp>
+
+#include <emilib/list_map.hpp>
+#include <emilib/list_set.hpp>
+
+enum class Color : uint16_t { Red, Green, Blue };
+
+template<typename Key, typename MakeKey>
+void test_list_map_against_std_map(int max_key, const MakeKey& make_key)
+{
+	emilib::ListMap<Key, int> map;
+	emilib::ListSet<Key> set;
+	std::map<Key, int> reference;
+
+	std::mt19937 rng(0);
+	for (int i = 0; i < 3000; ++i) {
+		const Key key = make_key(static_cast<int>(rng() % max_key));
+		switch (rng() % 4) {
+			case 0: {
+				map.erase(key);
+				reference.erase(key);
+			} break;
+			case 1: {
+				REQUIRE(map.insert(std::make_pair(key, i)) == (reference.count(key) == 0));
+				reference.insert(std::make_pair(key, i));
+			} break;
+			default: {
+				map[key] = i;
+				reference[key] = i;
+			} break;
+		}
+		const bool was_in_set = set.count(key) == 1;
+		REQUIRE(set.insert(key) == !was_in_set);
+		REQUIRE(set.count(key) == 1);
+		REQUIRE(map.size() == reference.size());
+		if (i % 10 == 0) {
+			for (int k = 0; k < max_key; ++k) {
+				const Key other = make_key(k);
+				REQUIRE(map.count(other) == reference.count(other));
+				const auto it = map.find(other);
+				REQUIRE((it == map.end() ? -1 : it->second) == (reference.count(other) ? reference.at(other) : -1));
+			}
+		}
+	}
+	for (const auto& pair : map) {
+		REQUIRE(reference.at(pair.first) == pair.second);
+	}
+	map.clear();
+	REQUIRE(map.count(make_key(0)) == 0);
+	map.insert_or_assign(make_key(0), 42);
+	REQUIRE(map.at(make_key(0)) == 42);
+}
+
+TEST_CASE( "against std::map", "ListMap" ) {
+	test_list_map_against_std_map<uint8_t>(100, [](int k) { return static_cast<uint8_t>(k); });
+	test_list_map_against_std_map<int16_t>(100, [](int k) { return static_cast<int16_t>(-k); });
+	test_list_map_against_std_map<int>(100, [](int k) { return k * 65537; });
+	test_list_map_against_std_map<uint64_t>(100, [](int k) { return static_cast<uint64_t>(k) << 40 | 7; });
+	static int ints[100];
+	test_list_map_against_std_map<const int*>(100, [](int k) { return ints + k; });
+	test_list_map_against_std_map<Color>(3, [](int k) { return static_cast<Color>(k); });
+	test_list_map_against_std_map<std::string>(50, [](int k) { return std::to_string(k); });
+}
+
+template<typename Key, typename Value>
+void test_keys_in_place()
+{
+	emilib::ListMap<Key, Value> map;
+	for (int i = 0; i < 100; ++i) {
+		map[static_cast<Key>(2 * i)] = static_cast<Value>(2 * i + 1); // The values look like the missing keys
+	}
+	for (int i = 0; i < 200; ++i) {
+		REQUIRE(map.count(static_cast<Key>(i)) == (i % 2 == 0 ? 1u : 0u));
+	}
+
+	// Keys may be changed through iterators:
+	for (auto& pair : map) {
+		pair.first = static_cast<Key>(pair.first + 1);
+	}
+	for (int i = 0; i < 200; ++i) {
+		REQUIRE(map.count(static_cast<Key>(i)) == (i % 2 == 1 ? 1u : 0u));
+	}
+	REQUIRE(map.find(static_cast<Key>(199))->second == static_cast<Value>(199));
+}
+
+TEST_CASE( "keys are found in place", "ListMap" ) {
+	test_keys_in_place<uint8_t,  uint8_t>();
+	test_keys_in_place<uint16_t, uint16_t>();
+	test_keys_in_place<uint32_t, uint32_t>();
+	test_keys_in_place<uint32_t, char>();        // Padding after the value
+	test_keys_in_place<uint32_t, uint64_t>();    // Padding after the key
+	test_keys_in_place<uint64_t, uint64_t>();
+	test_keys_in_place<uint16_t, long double>(); // Too big to tile 16 bytes
+}
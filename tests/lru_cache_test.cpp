@@ -0,0 +1,135 @@
+#include <list>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <catch.hpp>
+
+#include <emilib/lru_cache.hpp>
+
+using namespace std;
+
+static vector<int> lru_keys(const emilib::LruCache<int, int>& cache)
+{
+	vector<int> keys;
+	cache.for_each([&](int key, int) { keys.push_back(key); });
+	return keys;
+}
+
+TEST_CASE( "[int -> int] eviction order", "LruCache" ) {
+	vector<pair<int, int>> evicted;
+	emilib::LruCache<int, int> cache(3);
+	cache.set_eviction_callback([&](const int& key, int& value) { evicted.emplace_back(key, value); });
+
+	cache.insert(1, 10);
+	cache.insert(2, 20);
+	cache.insert(3, 30);
+	REQUIRE(lru_keys(cache) == (vector<int>{3, 2, 1}));
+	REQUIRE(cache.least_recently_used() == 1);
+
+	REQUIRE(*cache.try_get(1) == 10); // Touch
+	REQUIRE(*cache.peek(2) == 20);    // No touch
+	REQUIRE(cache.try_get(4) == nullptr);
+	REQUIRE(lru_keys(cache) == (vector<int>{1, 3, 2}));
+
+	cache.insert(4, 40);
+	REQUIRE(evicted == (vector<pair<int, int>>{{2, 20}}));
+	REQUIRE(!cache.contains(2));
+	// Evicting moved the last entry of the array into the hole; everything is still found:
+	REQUIRE(*cache.peek(1) == 10);
+	REQUIRE(*cache.peek(3) == 30);
+	REQUIRE(*cache.peek(4) == 40);
+	REQUIRE(lru_keys(cache) == (vector<int>{4, 1, 3}));
+
+	cache.insert(3, 33); // Replace: no eviction
+	REQUIRE(evicted.size() == 1);
+	REQUIRE(*cache.peek(3) == 33);
+	REQUIRE(lru_keys(cache) == (vector<int>{3, 4, 1}));
+
+	REQUIRE(cache.erase(4));
+	REQUIRE(!cache.erase(4));
+	REQUIRE(lru_keys(cache) == (vector<int>{3, 1}));
+	REQUIRE(evicted.size() == 1);
+
+	cache.set_limits(1);
+	REQUIRE(evicted == (vector<pair<int, int>>{{2, 20}, {1, 10}}));
+	REQUIRE(lru_keys(cache) == (vector<int>{3}));
+
+	cache.clear();
+	REQUIRE(cache.empty());
+	REQUIRE(cache.total_cost() == 0);
+	REQUIRE(evicted.size() == 2);
+}
+
+TEST_CASE( "[string -> string] eviction by cost", "LruCache" ) {
+	vector<string> evicted;
+	emilib::LruCache<string, string> cache(100, 10);
+	cache.set_eviction_callback([&](const string& key, string& value) {
+		evicted.push_back(key);
+		REQUIRE(value == key + key);
+	});
+
+	for (const char* key : {"a", "b", "c", "d"}) {
+		cache.insert(key, string(key) + key, 2);
+	}
+	REQUIRE(cache.total_cost() == 8);
+	REQUIRE(evicted.empty());
+
+	cache.try_get("a");
+	cache.insert("e", "ee", 5);
+	REQUIRE(evicted == (vector<string>{"b", "c"}));
+	REQUIRE(cache.total_cost() == 9);
+
+	// Too big to fit with anything else, but still kept:
+	cache.insert("f", "ff", 1000);
+	REQUIRE(cache.size() == 1);
+	REQUIRE(cache.total_cost() == 1000);
+	REQUIRE(*cache.try_get("f") == "ff");
+
+	cache.insert("f", "ff", 2);
+	REQUIRE(cache.total_cost() == 2);
+}
+
+TEST_CASE( "[int -> int] against a list", "LruCache" ) {
+	const size_t MAX_COUNT = 50;
+	emilib::LruCache<int, int> cache(MAX_COUNT);
+	list<pair<int, int>> reference; // Most recently used first
+
+	auto find_in_reference = [&](int key) {
+		for (auto it = reference.begin(); it != reference.end(); ++it) {
+			if (it->first == key) { return it; }
+		}
+		return reference.end();
+	};
+
+	std::mt19937 rng(0);
+	for (int i = 0; i < 20000; ++i) {
+		const int key = static_cast<int>(rng() % 100);
+		const int op = static_cast<int>(rng() % 3);
+		auto it = find_in_reference(key);
+		if (op == 0) {
+			int* value = cache.try_get(key);
+			REQUIRE((value != nullptr) == (it != reference.end()));
+			if (value) {
+				REQUIRE(*value == it->second);
+				reference.splice(reference.begin(), reference, it);
+			}
+		} else if (op == 1) {
+			cache.insert(key, i);
+			if (it != reference.end()) { reference.erase(it); }
+			reference.emplace_front(key, i);
+			if (reference.size() > MAX_COUNT) { reference.pop_back(); }
+		} else {
+			REQUIRE(cache.erase(key) == (it != reference.end()));
+			if (it != reference.end()) { reference.erase(it); }
+		}
+
+		REQUIRE(cache.size() == reference.size());
+		REQUIRE(cache.total_cost() == reference.size());
+	}
+
+	vector<pair<int, int>> entries;
+	cache.for_each([&](int key, int value) { entries.emplace_back(key, value); });
+	REQUIRE((entries == vector<pair<int, int>>(reference.begin(), reference.end())));
+}
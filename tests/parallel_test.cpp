@@ -0,0 +1,68 @@
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <catch.hpp>
+
+#include <emilib/parallel.hpp>
+
+TEST_CASE( "parallel_for, parallel_reduce and parallel_transform", "parallel" ) {
+	emilib::ThreadPool pool(3);
+	for (size_t size : {0, 1, 2, 7, 1000, 100000}) {
+		for (size_t grain : {0, 1, 64}) {
+			std::vector<int> visits(size, 0);
+			emilib::parallel_for(pool, 0, size, grain, [&](size_t i) { visits[i] += 1; });
+			REQUIRE(std::count(visits.begin(), visits.end(), 1) == static_cast<long>(size));
+
+			const size_t sum = emilib::parallel_reduce(pool, 10, 10 + size, grain, size_t(0),
+				[](size_t i) { return i; }, [](size_t a, size_t b) { return a + b; });
+			REQUIRE(sum == size * (size + 19) / 2);
+
+			std::vector<std::string> strings(size);
+			emilib::parallel_transform(pool, visits.begin(), visits.end(), strings.begin(),
+				[](int visit) { return std::to_string(visit); }, grain);
+			REQUIRE(std::count(strings.begin(), strings.end(), "1") == static_cast<long>(size));
+		}
+	}
+
+	// Nested inside jobs, and inside each other:
+	std::atomic<size_t> num_inner(0);
+	emilib::parallel_for(pool, 0, 20, 1, [&](size_t) {
+		emilib::parallel_for(pool, 0, 1000, 0, [&](size_t) { num_inner += 1; });
+	});
+	REQUIRE(num_inner == 20000);
+	pool.add_void([&]() {
+		emilib::parallel_for(pool, 0, 1000, 0, [&](size_t) { num_inner += 1; });
+	});
+	pool.wait();
+	REQUIRE(num_inner == 21000);
+}
+
+TEST_CASE( "parallel_sort is a stable sort", "parallel" ) {
+	emilib::ThreadPool pool(3);
+	std::mt19937 rng(0);
+	for (size_t size : {0, 1, 1000, 50000, 123457}) {
+		// Few distinct keys, so that stability matters:
+		std::vector<std::pair<int, size_t>> values;
+		for (size_t i = 0; i < size; ++i) {
+			values.emplace_back(static_cast<int>(rng() % 100), i);
+		}
+		auto expected = values;
+		const auto by_key = [](const std::pair<int, size_t>& a, const std::pair<int, size_t>& b) { return a.first < b.first; };
+		std::stable_sort(expected.begin(), expected.end(), by_key);
+		emilib::parallel_sort(pool, values.begin(), values.end(), by_key);
+		REQUIRE((values == expected));
+	}
+
+	std::vector<std::string> strings;
+	for (int i = 0; i < 30000; ++i) {
+		strings.push_back(std::to_string(rng()));
+	}
+	auto expected = strings;
+	std::sort(expected.begin(), expected.end());
+	emilib::parallel_sort(pool, strings.begin(), strings.end());
+	REQUIRE((strings == expected));
+}
@@ -0,0 +1,198 @@
+#include <atomic>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <catch.hpp>
+
+#include <emilib/persistent_hash_map.hpp>
+#include <emilib/shared_snapshot.hpp>
+
+template<typename Map, typename Reference>
+void require_same_contents(const Map& map, const Reference& reference)
+{
+	REQUIRE(map.size() == reference.size());
+	for (const auto& pair : reference) {
+		const auto* value = map.try_get(pair.first);
+		REQUIRE(value);
+		REQUIRE(*value == pair.second);
+	}
+	size_t num_visited = 0;
+	map.for_each([&](const typename Reference::key_type& key, const typename Reference::mapped_type& value) {
+		REQUIRE(reference.at(key) == value);
+		num_visited += 1;
+	});
+	REQUIRE(num_visited == reference.size());
+}
+
+/// Many keys with the same hash, to exercise the collision nodes at the bottom of the trie.
+struct BadHash
+{
+	size_t operator()(int key) const { return static_cast<size_t>(key % 4); }
+};
+
+template<typename Map>
+void test_persistent_against_std_map(int max_key)
+{
+	Map map;
+	std::map<int, int> reference;
+	std::vector<std::pair<Map, std::map<int, int>>> snapshots;
+
+	std::mt19937 rng(0);
+	for (int i = 0; i < 20000; ++i) {
+		const int key = static_cast<int>(rng() % max_key);
+		if (rng() % 3 == 0) {
+			REQUIRE(map.erase(key) == (reference.erase(key) == 1));
+		} else {
+			REQUIRE(map.insert_or_assign(key, i) == (reference.count(key) == 0));
+			reference[key] = i;
+		}
+		REQUIRE(map.size() == reference.size());
+		REQUIRE(map.count(key) == reference.count(key));
+		if (i % 1000 == 0) {
+			snapshots.emplace_back(map, reference);
+		}
+	}
+	require_same_contents(map, reference);
+
+	// Modifying the map didn't change the copies:
+	for (const auto& snapshot : snapshots) {
+		require_same_contents(snapshot.first, snapshot.second);
+	}
+
+	while (!reference.empty()) {
+		REQUIRE(map.erase(reference.begin()->first));
+		reference.erase(reference.begin());
+	}
+	REQUIRE(map.empty());
+	REQUIRE(!map.erase(0));
+	require_same_contents(snapshots.back().first, snapshots.back().second);
+}
+
+TEST_CASE( "[int -> int] copies against std::map", "PersistentHashMap" ) {
+	test_persistent_against_std_map<emilib::PersistentHashMap<int, int>>(3000);
+	test_persistent_against_std_map<emilib::PersistentHashMap<int, int, BadHash>>(100);
+
+	emilib::PersistentHashMap<std::string, std::string> strings;
+	strings.insert_or_assign("hello", "world");
+	auto copy = strings;
+	strings.insert_or_assign("hello", "there");
+	REQUIRE(*copy.try_get("hello") == "world");
+	REQUIRE(*strings.try_get("hello") == "there");
+
+	for (int i = 0; i < 1000; ++i) {
+		strings.insert_or_assign(std::to_string(i), std::string(100, 'a' + i % 26));
+	}
+	copy = strings;
+	for (int i = 0; i < 1000; i += 2) {
+		REQUIRE(copy.erase(std::to_string(i)));
+	}
+	REQUIRE(copy.size() == 501);
+	REQUIRE(strings.size() == 1001);
+	REQUIRE(*strings.try_get("42") == std::string(100, 'a' + 42 % 26));
+}
+
+TEST_CASE( "readers and writers", "SharedSnapshot" ) {
+	// Every version maps all keys to the same value, so readers can check that they see a whole version.
+	const int NUM_KEYS = 200;
+	using Map = emilib::PersistentHashMap<int, int>;
+	Map first;
+	for (int key = 0; key < NUM_KEYS; ++key) {
+		first.insert_or_assign(key, 0);
+	}
+	emilib::SharedSnapshot<Map> shared(first);
+
+	std::atomic<bool> done(false);
+	std::atomic<size_t> num_torn(0);
+	std::vector<std::thread> readers;
+	for (int i = 0; i < 3; ++i) {
+		readers.emplace_back([&]() {
+			int last_version = 0;
+			while (!done) {
+				const std::shared_ptr<const Map> snapshot = shared.load();
+				const int version = *snapshot->try_get(0);
+				for (int key = 0; key < NUM_KEYS; ++key) {
+					num_torn += (*snapshot->try_get(key) != version);
+				}
+				num_torn += (version < last_version);
+				last_version = version;
+			}
+		});
+	}
+
+	std::vector<std::thread> writers;
+	for (int i = 0; i < 2; ++i) {
+		writers.emplace_back([&]() {
+			for (int n = 0; n < 100; ++n) {
+				shared.update([](Map& map) {
+					const int version = *map.try_get(0) + 1;
+					for (int key = 0; key < NUM_KEYS; ++key) {
+						map.insert_or_assign(key, version);
+					}
+				});
+			}
+		});
+	}
+	for (auto& writer : writers) { writer.join(); }
+	done = true;
+	for (auto& reader : readers) { reader.join(); }
+
+	REQUIRE(num_torn == 0);
+	REQUIRE(*shared.load()->try_get(NUM_KEYS - 1) == 200);
+	REQUIRE(*first.try_get(0) == 0);
+
+	shared.store(Map());
+	REQUIRE(shared.load()->empty());
+}
+
+// Counts how many are alive, to check that every version is freed exactly once.
+struct CountedVersion
+{
+	explicit CountedVersion(std::atomic<int>* num_alive = nullptr, int number = 0) : num_alive(num_alive), number(number)
+	{
+		if (num_alive) { *num_alive += 1; }
+	}
+	CountedVersion(const CountedVersion& other) : CountedVersion(other.num_alive, other.number) {}
+	CountedVersion& operator=(const CountedVersion&) = delete;
+	~CountedVersion() { if (num_alive) { *num_alive -= 1; } }
+
+	std::atomic<int>* num_alive;
+	int               number;
+};
+
+TEST_CASE( "versions are freed when the last reader lets go", "SharedSnapshot" ) {
+	std::atomic<int> num_alive(0);
+	{
+		emilib::SharedSnapshot<CountedVersion> shared(CountedVersion(&num_alive, 0));
+		const auto kept = shared.load();
+		std::atomic<bool> done(false);
+		std::atomic<size_t> num_backwards(0);
+		std::vector<std::thread> readers;
+		for (int i = 0; i < 3; ++i) {
+			readers.emplace_back([&]() {
+				int last_number = 0;
+				while (!done) {
+					const int number = shared.load()->number;
+					num_backwards += (number < last_number);
+					last_number = number;
+				}
+			});
+		}
+		for (int n = 1; n <= 1000; ++n) {
+			if (n % 2 == 0) {
+				shared.store(CountedVersion(&num_alive, n));
+			} else {
+				shared.update([n](CountedVersion& version) { version.number = n; });
+			}
+		}
+		done = true;
+		for (auto& reader : readers) { reader.join(); }
+		REQUIRE(num_backwards == 0);
+		REQUIRE(num_alive == 2); // The current one, and the one we kept.
+		REQUIRE(kept->number == 0);
+		REQUIRE(shared.load()->number == 1000);
+	}
+	REQUIRE(num_alive == 0);
+}
@@ -0,0 +1,104 @@
+#include <map>
+#include <random>
+#include <string>
+
+#include <catch.hpp>
+
+#include <emilib/small_hash_map.hpp>
+
+using namespace std;
+
+TEST_CASE( "[string -> int] small and big", "SmallHashMap" ) {
+	emilib::SmallHashMap<string, int, 4> map;
+	REQUIRE(map.empty());
+	REQUIRE(map.is_small());
+	REQUIRE(map.begin() == map.end());
+
+	REQUIRE(map.insert("one", 1).second);
+	REQUIRE(!map.insert("one", 11).second);
+	map["two"] = 2;
+	map.insert_or_assign("three", 3);
+	map.insert_or_assign("three", 33);
+	REQUIRE(map.size() == 3);
+	REQUIRE(map.is_small());
+	REQUIRE(map["one"] == 1);
+	REQUIRE(*map.try_get("three") == 33);
+	REQUIRE(map.try_get("four") == nullptr);
+	REQUIRE(map.find("two")->second == 2);
+	REQUIRE(map.count("two") == 1);
+
+	REQUIRE(map.erase("one"));
+	REQUIRE(!map.erase("one"));
+	REQUIRE(map.size() == 2);
+	REQUIRE(map["three"] == 33);
+
+	map["four"] = 4;
+	map["five"] = 5;
+	REQUIRE(map.is_small());
+	map["six"] = 6;
+	REQUIRE(!map.is_small());
+	REQUIRE(map.size() == 5);
+	REQUIRE(map["two"] == 2);
+	REQUIRE(map["six"] == 6);
+
+	int sum = 0;
+	for (const auto& pair : map) {
+		sum += pair.second;
+	}
+	REQUIRE(sum == 2 + 33 + 4 + 5 + 6);
+
+	auto copy = map;
+	map.clear();
+	REQUIRE(map.is_small());
+	REQUIRE(map.empty());
+	REQUIRE(copy.size() == 5);
+	REQUIRE(copy["five"] == 5);
+
+	auto moved = std::move(copy);
+	REQUIRE(copy.empty());
+	REQUIRE(moved.size() == 5);
+}
+
+TEST_CASE( "[int -> int] against std::map", "SmallHashMap" ) {
+	// 20 elements means more than one group of inline fragments:
+	using Map = emilib::SmallHashMap<int, int, 20>;
+	std::mt19937 rng(0);
+	for (int round = 0; round < 50; ++round) {
+		Map map;
+		std::map<int, int> reference;
+		const int num_keys = 1 + round;
+		for (int i = 0; i < 500; ++i) {
+			const int key = rng() % num_keys;
+			if (rng() % 3 == 0) {
+				REQUIRE(map.erase(key) == (reference.erase(key) == 1));
+			} else {
+				map[key] = i;
+				reference[key] = i;
+			}
+			REQUIRE(map.size() == reference.size());
+		}
+		if (num_keys <= 20) {
+			REQUIRE(map.is_small());
+		}
+		for (int key = 0; key < num_keys; ++key) {
+			auto it = reference.find(key);
+			const int* value = map.try_get(key);
+			REQUIRE((value != nullptr) == (it != reference.end()));
+			if (value) {
+				REQUIRE(*value == it->second);
+			}
+		}
+		size_t num_iterated = 0;
+		for (const auto& p : map) {
+			REQUIRE(reference.at(p.first) == p.second);
+			num_iterated += 1;
+		}
+		REQUIRE(num_iterated == reference.size());
+
+		// Erase everything through iterators:
+		for (auto it = map.begin(); it != map.end(); ) {
+			it = map.erase(it);
+		}
+		REQUIRE(map.empty());
+	}
+}
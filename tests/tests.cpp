@@ -5,4 +5,15 @@
 #define LOGURU_IMPLEMENTATION 1
 #include <loguru.hpp>
 
+#include <emilib/thread_pool.cpp>
+
 #include "hash_test.cpp"
+#include "concurrent_hash_map_test.cpp"
+#include "frozen_hash_map_test.cpp"
+#include "small_hash_map_test.cpp"
+#include "lru_cache_test.cpp"
+#include "persistent_hash_map_test.cpp"
+#include "bloom_filter_test.cpp"
+#include "list_map_test.cpp"
+#include "thread_pool_test.cpp"
+#include "parallel_test.cpp"
@@ -0,0 +1,245 @@
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <catch.hpp>
+
+#include <emilib/thread_pool.hpp>
+
+// Adds two jobs for each level of depth, from inside the pool.
+// Ends up with 2^depth leaves.
+static void add_tree(emilib::ThreadPool& pool, std::atomic<size_t>& num_leaves, int depth)
+{
+	if (depth == 0) {
+		num_leaves += 1;
+		return;
+	}
+	for (int i = 0; i < 2; ++i) {
+		pool.add_void([&pool, &num_leaves, depth]() { add_tree(pool, num_leaves, depth - 1); });
+	}
+}
+
+TEST_CASE( "jobs, nested jobs and futures", "ThreadPool" ) {
+	for (size_t num_threads : {1, 2, 5}) {
+		std::atomic<size_t> num_run_by_destructor(0);
+		{
+			emilib::ThreadPool pool(num_threads);
+			REQUIRE(pool.num_threads() == num_threads);
+
+			std::atomic<size_t> sum(0);
+			for (size_t i = 0; i < 10000; ++i) {
+				pool.add_void([&sum, i]() { sum += i; });
+			}
+			pool.wait();
+			REQUIRE(sum == 10000 * 9999 / 2);
+
+			// Jobs added by jobs are waited for too:
+			std::atomic<size_t> num_leaves(0);
+			pool.add_void([&]() { add_tree(pool, num_leaves, 12); });
+			pool.wait();
+			REQUIRE(num_leaves == 4096);
+
+			std::vector<std::future<size_t>> futures;
+			for (size_t i = 0; i < 100; ++i) {
+				futures.push_back(pool.add<size_t>([i]() { return i * i; }));
+			}
+			for (size_t i = 0; i < 100; ++i) {
+				REQUIRE(futures[i].get() == i * i);
+			}
+
+			// Keep all workers busy while we clear the rest:
+			std::atomic<size_t> num_busy(0);
+			std::atomic<bool> go(false);
+			for (size_t i = 0; i < num_threads; ++i) {
+				pool.add_void([&]() {
+					num_busy += 1;
+					while (!go) { std::this_thread::yield(); }
+				});
+			}
+			while (num_busy < num_threads) { std::this_thread::yield(); }
+			std::atomic<size_t> num_cleared_run(0);
+			for (size_t i = 0; i < 1000; ++i) {
+				pool.add_void([&]() { num_cleared_run += 1; });
+			}
+			pool.clear();
+			go = true;
+			pool.wait();
+			REQUIRE(num_cleared_run == 0);
+
+			for (size_t i = 0; i < 1000; ++i) {
+				pool.add_void([&]() { num_run_by_destructor += 1; });
+			}
+		}
+		REQUIRE(num_run_by_destructor == 1000);
+	}
+}
+
+TEST_CASE( "tasks, continuations, when_all and task groups", "ThreadPool" ) {
+	for (size_t num_threads : {1, 2, 5}) {
+		emilib::ThreadPool pool(num_threads);
+
+		emilib::Task<int> answer = pool.add_task([]() { return 6 * 7; });
+		auto text    = answer.then([](int value) { return std::to_string(value); });
+		auto doubled = answer.then([](int value) { return 2 * value; });
+		std::atomic<int> num_void_run(0);
+		auto nothing = text.then([&](const std::string&) { num_void_run += 1; });
+		auto after_nothing = nothing.then([&]() { return num_void_run.load(); });
+		REQUIRE(text.get() == "42");
+		REQUIRE(doubled.get() == 84);
+		REQUIRE(after_nothing.get() == 1);
+		REQUIRE(nothing.is_done());
+		// Continuing a task that is already done:
+		REQUIRE(answer.then([](int value) { return value + 1; }).get() == 43);
+
+		auto all = emilib::when_all(answer, text, nothing);
+		REQUIRE(all.then([=]() { return text.get() + "!"; }).get() == "42!");
+
+		std::vector<emilib::Task<size_t>> squares;
+		for (size_t i = 0; i < 100; ++i) {
+			squares.push_back(pool.add_task([i]() { return i * i; }));
+		}
+		auto sum = emilib::when_all(pool, squares).then([=]() {
+			size_t sum = 0;
+			for (const auto& square : squares) { sum += square.get(); }
+			return sum;
+		});
+		REQUIRE(sum.get() == 328350);
+		emilib::when_all(pool, std::vector<emilib::Task<int>>()).wait();
+
+		// A group only waits for its own jobs:
+		if (num_threads > 1) {
+			std::atomic<bool> go(false);
+			pool.add_void([&]() { while (!go) { std::this_thread::yield(); } });
+			emilib::TaskGroup group(pool);
+			std::atomic<size_t> num_group_run(0);
+			for (size_t i = 0; i < 100; ++i) {
+				group.add_void([&]() { num_group_run += 1; });
+			}
+			group.wait();
+			REQUIRE(group.is_done());
+			REQUIRE(num_group_run == 100);
+			go = true;
+			pool.wait();
+		}
+
+		// Jobs waiting for their own groups and tasks, even with a single worker:
+		std::atomic<size_t> num_leaves(0);
+		std::atomic<size_t> num_bad_results(0);
+		{
+			emilib::TaskGroup outer(pool);
+			for (int i = 0; i < 4; ++i) {
+				outer.add_void([&]() {
+					emilib::TaskGroup inner(pool);
+					for (int j = 0; j < 10; ++j) {
+						inner.add_void([&]() {
+							inner.add_void([&]() { num_leaves += 1; });
+						});
+					}
+					inner.wait();
+					if (num_leaves < 10 || pool.add_task([]() { return 1; }).get() != 1) {
+						num_bad_results += 1;
+					}
+				});
+			}
+		}
+		REQUIRE(num_leaves == 40);
+		REQUIRE(num_bad_results == 0);
+	}
+}
+
+// Counts how many copies of it are alive.
+struct LiveCounter
+{
+	explicit LiveCounter(std::atomic<int>& num_alive) : num_alive(num_alive) { num_alive += 1; }
+	LiveCounter(const LiveCounter& other) : num_alive(other.num_alive) { num_alive += 1; }
+	~LiveCounter() { num_alive -= 1; }
+	std::atomic<int>& num_alive;
+};
+
+TEST_CASE( "jobs of any size, and the free list behind them", "ThreadPool" ) {
+	std::atomic<int> num_alive(0);
+	{
+		emilib::ThreadPool pool(2);
+		std::atomic<size_t> sum(0);
+		std::array<size_t, 32> big; // Doesn't fit in a job node.
+		big.fill(1);
+		for (size_t i = 0; i < 1000; ++i) {
+			std::unique_ptr<size_t> move_only(new size_t(i));
+			pool.add_void([&sum, move_only = std::move(move_only)]() { sum += *move_only; });
+			pool.add_void([&sum, big]() { sum += big[31]; });
+			LiveCounter counter(num_alive);
+			pool.add_void([counter]() {});
+		}
+		auto big_result = pool.add<size_t>([big]() { return big[0] + big[31]; });
+		pool.wait();
+		REQUIRE(sum == 1000 * 999 / 2 + 1000);
+		REQUIRE(big_result.get() == 2);
+		REQUIRE(num_alive == 0);
+
+		// Captures of cleared jobs are destroyed too:
+		std::atomic<bool> go(false);
+		pool.add_void([&]() { while (!go) { std::this_thread::yield(); } });
+		pool.add_void([&]() { while (!go) { std::this_thread::yield(); } });
+		for (size_t i = 0; i < 100; ++i) {
+			LiveCounter counter(num_alive);
+			pool.add_void([counter]() {});
+		}
+		pool.clear();
+		REQUIRE(num_alive <= 2); // The two blocking jobs may not have started, and then they are cleared too.
+		go = true;
+	}
+	REQUIRE(num_alive == 0);
+
+	// No block may be handed out twice:
+	emilib::pool_detail::FreeList free_list(sizeof(size_t));
+	std::atomic<size_t> num_bad_blocks(0);
+	std::vector<std::thread> threads;
+	for (size_t thread_nr = 0; thread_nr < 4; ++thread_nr) {
+		threads.emplace_back([&, thread_nr]() {
+			std::vector<size_t*> blocks;
+			for (size_t round = 0; round < 200; ++round) {
+				for (size_t i = 0; i < 50; ++i) {
+					size_t* block = static_cast<size_t*>(free_list.allocate());
+					*block = thread_nr;
+					blocks.push_back(block);
+				}
+				for (size_t* block : blocks) {
+					num_bad_blocks += *block != thread_nr;
+					free_list.deallocate(block);
+				}
+				blocks.clear();
+			}
+		});
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	REQUIRE(num_bad_blocks == 0);
+}
+
+TEST_CASE( "single jobs added while the only worker goes to sleep", "ThreadPool" ) {
+	emilib::ThreadPool pool(1);
+	std::atomic<size_t> num_run(0);
+	size_t num_lost = 0;
+	for (size_t i = 1; i <= 20000; ++i) {
+		// Add the next job right as the worker runs out of jobs, and is about to sleep:
+		pool.add_void([&]() { num_run += 1; });
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+		while (num_run < i && std::chrono::steady_clock::now() < deadline) {
+			std::this_thread::yield();
+		}
+		if (num_run < i) {
+			// The worker slept through our job. Wake it with another, so that we don't hang:
+			num_lost += 1;
+			pool.add_void([&]() { num_run += 0; });
+			while (num_run < i) { std::this_thread::yield(); }
+		}
+	}
+	pool.wait();
+	REQUIRE(num_lost == 0);
+}